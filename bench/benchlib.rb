@@ -0,0 +1,155 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Shared fixture for the benchmarks in this directory. Each benchmark
+# gets a private p4d (run over rsh, as the tests do) and a workspace
+# populated with a configurable number of small files.
+#
+#   P4D_BIN          p4d to run (default: p4d on the PATH)
+#   P4RUBY_BENCH_PORT use an existing server instead
+#
+
+$:.unshift File.expand_path('../lib', __dir__)
+
+require 'fileutils'
+require 'json'
+require 'tmpdir'
+require 'P4'
+
+module P4Bench
+  P4D = ENV['P4D_BIN'] || 'p4d'
+
+  #
+  # Yields a connected P4 with a workspace holding 'files' submitted
+  # files, then tears everything down again. With 'unicode' set the
+  # server is switched to unicode mode and the client uses utf8, or
+  # the charset given.
+  #
+  def self.with_server( files: 1000, size: 64, unicode: false )
+    Dir.mktmpdir( 'p4bench' ) do |root|
+      server = File.join( root, 'server' )
+      client = File.join( root, 'workspace' )
+      FileUtils.mkdir_p( [ server, client ] )
+      system( P4D, '-r', server, '-xi', out: File::NULL ) if unicode
+      Dir.chdir( client ) do
+        p4 = P4.new
+        p4.charset = unicode == true ? 'utf8' : ( unicode || nil )
+        p4.port = ENV['P4RUBY_BENCH_PORT'] ||
+                  %(rsh:#{P4D} -r #{server} -C1 -J off -i)
+        p4.client = 'bench'
+        p4.connect
+        begin
+          spec = p4.fetch_client
+          spec._root = client
+          p4.save_client( spec )
+          populate( p4, files, size ) if files > 0
+          yield p4
+        ensure
+          p4.disconnect if p4.connected?
+        end
+      end
+    end
+  end
+
+  def self.populate( p4, files, size )
+    FileUtils.mkdir_p( 'data' )
+    files.times do |i|
+      File.write( "data/file#{i}.txt", "#{i}\n" * ( size / 8 + 1 ) )
+    end
+    p4.run_add( 'data/...' )
+    p4.run_submit( '-dBenchmark data' )
+  end
+
+  #
+  # Runs the block 'iterations' times after 'warmup' untimed runs and
+  # returns the median wall time in seconds.
+  #
+  def self.measure( iterations: 10, warmup: 2 )
+    warmup.times { yield }
+    times = Array.new( iterations ) do
+      t = Process.clock_gettime( Process::CLOCK_MONOTONIC )
+      yield
+      Process.clock_gettime( Process::CLOCK_MONOTONIC ) - t
+    end
+    times.sort[ times.length / 2 ]
+  end
+
+  #
+  # Like measure, but returns a Hash with the median wall time, the
+  # median number of objects allocated per run and the peak RSS in KB
+  # over the timed runs. The setup block, if given, is run untimed
+  # before each run.
+  #
+  def self.profile( iterations: 10, warmup: 2, setup: nil )
+    warmup.times { setup.call if setup; yield }
+    reset_peak_rss
+    runs = Array.new( iterations ) do
+      setup.call if setup
+      a = GC.stat( :total_allocated_objects )
+      t = Process.clock_gettime( Process::CLOCK_MONOTONIC )
+      yield
+      t = Process.clock_gettime( Process::CLOCK_MONOTONIC ) - t
+      [ t, GC.stat( :total_allocated_objects ) - a ]
+    end
+    {
+      'seconds' => runs.map( &:first ).sort[ iterations / 2 ],
+      'allocations' => runs.map( &:last ).sort[ iterations / 2 ],
+      'peak_rss_kb' => peak_rss
+    }
+  end
+
+  #
+  # Peak resident set size of this process in KB. On Linux the peak can
+  # be reset, so each profile reports its own. Elsewhere this falls back
+  # to the current RSS from ps, or nil if that fails too.
+  #
+  def self.peak_rss
+    status = '/proc/self/status'
+    if File.exist?( status )
+      File.foreach( status ) do |line|
+        return line.split[ 1 ].to_i if line.start_with?( 'VmHWM:' )
+      end
+    end
+    rss = `ps -o rss= -p #{Process.pid}`.to_i rescue 0
+    rss > 0 ? rss : nil
+  end
+
+  def self.reset_peak_rss
+    File.write( '/proc/self/clear_refs', '5' )
+  rescue SystemCallError, IOError
+  end
+
+  def self.report( label, value, unit = '' )
+    printf( "%-32s %12s %s\n", label, format_value( value ), unit )
+  end
+
+  def self.format_value( v )
+    v.kind_of?( Float ) ? format( '%.6f', v ) : v.to_s
+  end
+end
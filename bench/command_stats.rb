@@ -0,0 +1,63 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Measures the cost of the always-on counters behind
+# P4#last_command_stats. Build the extension twice, once normally and
+# once with the timers compiled out:
+#
+#   rake compile -- --with-cppflags=-DP4RUBY_NO_COMMAND_STATS
+#
+# and compare the per-record times this script reports for each.
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 20 ).to_i
+
+P4Bench.with_server( files: files ) do |p4|
+  median = P4Bench.measure( iterations: iterations ) do
+    p4.run_fstat( '//...' )
+  end
+  stats = p4.last_command_stats
+  timed = stats['wall'] > 0
+
+  puts "fstat of #{files} files, median of #{iterations} runs" +
+       ( timed ? '' : ' (timers compiled out)' )
+  P4Bench.report( 'wall', median, 's' )
+  P4Bench.report( 'per record', median / stats['records'] * 1e6, 'us' )
+  if timed
+    %w( api callback conversion ).each do |k|
+      P4Bench.report( k, stats[k], 's' )
+    end
+  end
+  %w( records messages bytes_received bytes_sent peak_results ).each do |k|
+    P4Bench.report( k, stats[k] )
+  end
+end
@@ -0,0 +1,73 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Compares two sets of results written by bench/suite.rb, typically from
+# builds before and after a change:
+#
+#   ruby bench/compare.rb old.json new.json
+#
+# Throughput is compared as new/old, so higher is better; allocations
+# and RSS as new/old, so lower is better. With BENCH_THRESHOLD set to a
+# percentage, exits 1 if any throughput fell by more than that.
+#
+
+require 'json'
+
+if ARGV.length != 2
+  $stderr.puts "usage: #{$0} old.json new.json"
+  exit 2
+end
+
+old, new = ARGV.map { |f| JSON.parse( File.read( f ) ) }
+threshold = ENV['BENCH_THRESHOLD'] && ENV['BENCH_THRESHOLD'].to_f
+
+def ratio( a, b )
+  a && b && a > 0 ? format( '%.3f', b.fdiv( a ) ) : '-'
+end
+
+printf( "%-16s %14s %14s %8s %8s %8s\n",
+        'benchmark', 'old items/s', 'new items/s', 'speed', 'allocs', 'rss' )
+regressed = []
+( old[ 'results' ].keys | new[ 'results' ].keys ).each do |name|
+  o = old[ 'results' ][ name ] || {}
+  n = new[ 'results' ][ name ] || {}
+  printf( "%-16s %14s %14s %8s %8s %8s\n", name,
+          o[ 'items_per_second' ]&.round, n[ 'items_per_second' ]&.round,
+          ratio( o[ 'items_per_second' ], n[ 'items_per_second' ] ),
+          ratio( o[ 'allocations_per_item' ], n[ 'allocations_per_item' ] ),
+          ratio( o[ 'peak_rss_kb' ], n[ 'peak_rss_kb' ] ) )
+  next unless threshold && o[ 'items_per_second' ] && n[ 'items_per_second' ]
+  drop = ( 1 - n[ 'items_per_second' ] / o[ 'items_per_second' ] ) * 100
+  regressed << name if drop > threshold
+end
+
+unless regressed.empty?
+  puts "slower by more than #{threshold}%: #{regressed.join( ', ' )}"
+  exit 1
+end
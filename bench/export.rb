@@ -0,0 +1,63 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Compares dumping fstat output as JSON lines by building the result
+# hashes and generating JSON from them against P4#run_export, which
+# writes each record as it arrives:
+#
+#   ruby bench/export.rb
+#
+
+require_relative 'benchlib'
+require 'stringio'
+
+iterations = ( ENV['BENCH_ITERATIONS'] || 5 ).to_i
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+
+P4Bench.with_server( files: files ) do |p4|
+  puts "#{files} files, median of #{iterations} runs"
+
+  r = P4Bench.profile( iterations: iterations ) do
+    out = StringIO.new
+    p4.run_fstat( '//depot/data/...' ).each { |h| out.puts( JSON.generate( h ) ) }
+  end
+  P4Bench.report( 'run_fstat + JSON', r[ 'seconds' ] * 1000, 'ms' )
+  P4Bench.report( 'run_fstat + JSON', r[ 'allocations' ], 'objects' )
+
+  r = P4Bench.profile( iterations: iterations ) do
+    p4.run_export( StringIO.new, 'fstat', '//depot/data/...' )
+  end
+  P4Bench.report( 'run_export ndjson', r[ 'seconds' ] * 1000, 'ms' )
+  P4Bench.report( 'run_export ndjson', r[ 'allocations' ], 'objects' )
+
+  r = P4Bench.profile( iterations: iterations ) do
+    p4.run_export( StringIO.new, 'fstat', '//depot/data/...', format: :csv )
+  end
+  P4Bench.report( 'run_export csv', r[ 'seconds' ] * 1000, 'ms' )
+end
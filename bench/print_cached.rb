@@ -0,0 +1,59 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+#
+# Compares plain print with print_cached against a warm print store,
+# the case of many agents printing the same revisions.
+#
+
+require_relative 'benchlib'
+require 'tmpdir'
+
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+size = ( ENV['BENCH_SIZE'] || 4096 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+
+P4Bench.with_server( files: files, size: size ) do |p4|
+  bytes = files * ( size / 8 + 1 ) * 8
+
+  Dir.mktmpdir( 'p4ps' ) do |dir|
+    p4.print_store = dir
+    p4.print_cached( '//...' )
+
+    puts "#{files} files of #{size} bytes, median of #{iterations} runs"
+    print = P4Bench.measure( iterations: iterations ) do
+      p4.run_print( '//...' )
+    end
+    cached = P4Bench.measure( iterations: iterations ) do
+      p4.print_cached( '//...' )
+    end
+
+    P4Bench.report( 'print', bytes / print / 1e6, 'MB/s' )
+    P4Bench.report( 'print_cached (warm)', bytes / cached / 1e6, 'MB/s' )
+    P4Bench.report( 'store hits', p4.print_store_stats[ 'hits' ] )
+  end
+end
@@ -0,0 +1,62 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Runs wide tagged commands with and without a fields: projection and
+# reports the time, objects allocated and peak RSS of each. fstat also
+# gets the projection as -T; describe and changes -l are projected on
+# the client only.
+#
+
+require_relative 'benchlib'
+
+iterations = ( ENV['BENCH_ITERATIONS'] || 5 ).to_i
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+
+P4Bench.with_server( files: files ) do |p4|
+  p4.run_edit( '//depot/data/...' )
+  p4.run_submit( '-dEdit' )
+  puts "#{files} files, median of #{iterations} runs"
+
+  {
+    'fstat -Oa' => [ [ 'fstat', '-Oa', '//depot/data/...' ],
+                     %w{ depotFile headRev } ],
+    'describe' => [ [ 'describe', '-s', '2' ], %w{ change depotFile } ],
+    'changes -l' => [ [ 'changes', '-l', '//depot/...' ], %w{ change user } ]
+  }.each do |name, ( cmd, fields )|
+    [ nil, fields ].each do |f|
+      label = f ? "#{name} (projected)" : name
+      r = P4Bench.profile( iterations: iterations ) do
+        f ? p4.run( cmd, fields: f ) : p4.run( cmd )
+      end
+      P4Bench.report( label, r[ 'seconds' ] * 1000, 'ms' )
+      P4Bench.report( label, r[ 'allocations' ], 'objects' )
+      P4Bench.report( label, r[ 'peak_rss_kb' ], 'KB peak' )
+    end
+  end
+end
@@ -0,0 +1,80 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Runs fstat over the whole depot on BENCH_RACTORS connections, first one
+# after another in the main Ractor, then on threads, then with each
+# connection in a Ractor of its own, where converting the results to
+# Ruby objects can use more than one core.
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 5 ).to_i
+ractors = ( ENV['BENCH_RACTORS'] || 4 ).to_i
+
+Warning[ :experimental ] = false
+
+def fstat_all( port )
+  p4 = P4.new
+  p4.port = port
+  p4.client = 'bench'
+  p4.connect
+  p4.run_fstat( '//...' ).length
+ensure
+  p4.disconnect if p4.connected?
+end
+
+def join( r )
+  r.respond_to?( :value ) ? r.value : r.take
+end
+
+P4Bench.with_server( files: files ) do |p4|
+  port = p4.port.dup.freeze
+
+  puts "#{files} files, #{ractors} connections, median of #{iterations} runs"
+
+  serial = P4Bench.measure( iterations: iterations ) do
+    ractors.times { fstat_all( port ) }
+  end
+  threads = P4Bench.measure( iterations: iterations ) do
+    Array.new( ractors ) { Thread.new { fstat_all( port ) } }.each( &:join )
+  end
+  parallel = P4Bench.measure( iterations: iterations ) do
+    Array.new( ractors ) do
+      Ractor.new( port ) { |pt| fstat_all( pt ) }
+    end.each { |r| join( r ) }
+  end
+
+  total = files * ractors
+  P4Bench.report( 'fstat (serial)', total / serial, 'files/s' )
+  P4Bench.report( 'fstat (threads)', total / threads, 'files/s' )
+  P4Bench.report( "fstat (#{ractors} ractors)", total / parallel, 'files/s' )
+  P4Bench.report( 'speedup', serial / parallel, 'x' )
+end
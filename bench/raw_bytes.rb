@@ -0,0 +1,61 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Compares print and fstat throughput on a unicode-mode server with
+# charset translation and in raw bytes mode, where output is passed on
+# untranslated. Set BENCH_CHARSET to pick the client charset.
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 5000 ).to_i
+size = ( ENV['BENCH_SIZE'] || 4096 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+charset = ENV['BENCH_CHARSET'] || 'iso8859-1'
+
+P4Bench.with_server( files: files, size: size, unicode: charset ) do |p4|
+  bytes = files * ( size / 8 + 1 ) * 8
+
+  puts "#{files} files of #{size} bytes, charset #{charset}, " +
+       "median of #{iterations} runs"
+  [ false, true ].each do |raw|
+    p4.raw_bytes = raw
+    label = raw ? 'raw' : 'translated'
+
+    print = P4Bench.measure( iterations: iterations ) do
+      p4.run_print( '//...' )
+    end
+    fstat = P4Bench.measure( iterations: iterations ) do
+      p4.run_fstat( '//...' )
+    end
+
+    P4Bench.report( "print (#{label})", bytes / print / 1e6, 'MB/s' )
+    P4Bench.report( "fstat (#{label})", files / fstat, 'files/s' )
+  end
+end
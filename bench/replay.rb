@@ -0,0 +1,88 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Replays capture files through the conversion to Ruby objects, with no
+# server involved, and reports how fast it goes:
+#
+#   ruby bench/replay.rb [file.p4cap ...]
+#
+# Capture files come from P4#with_capture, typically run against a real
+# depot to get production-shaped data. With none given, fstat, filelog,
+# describe, print and client spec output are captured from the usual
+# fixture first. Set BENCH_OUT to also write the results as JSON for
+# bench/compare.rb.
+#
+
+require_relative 'benchlib'
+
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+files = ( ENV['BENCH_FILES'] || 2000 ).to_i
+
+def replay_all( paths, iterations )
+  p4 = P4.new
+  results = {}
+  puts "median of #{iterations} replays"
+  paths.each do |path|
+    items = p4.replay( path ).sum( &:length )
+    r = P4Bench.profile( iterations: iterations ) { p4.replay( path ) }
+    r[ 'items' ] = items
+    r[ 'items_per_second' ] = items / r[ 'seconds' ]
+    r[ 'allocations_per_item' ] = r[ 'allocations' ].fdiv( items )
+    name = File.basename( path, '.p4cap' )
+    results[ name ] = r
+    P4Bench.report( name, r[ 'items_per_second' ].round, 'items/s' )
+  end
+  if ENV['BENCH_OUT']
+    File.write( ENV['BENCH_OUT'], JSON.pretty_generate(
+      'ruby' => RUBY_VERSION, 'p4ruby' => P4::VERSION,
+      'p4api' => P4::P4API_VERSION, 'platform' => RUBY_PLATFORM,
+      'iterations' => iterations, 'results' => results ) + "\n" )
+  end
+end
+
+if ARGV.empty?
+  Dir.mktmpdir( 'p4cap' ) do |dir|
+    P4Bench.with_server( files: files ) do |p4|
+      p4.run_edit( '//depot/data/...' )
+      p4.run_submit( '-dEdit' )
+      {
+        'fstat' => [ 'fstat', '//depot/data/...' ],
+        'filelog' => [ 'filelog', '//depot/data/...' ],
+        'describe' => [ 'describe', '-s', '2' ],
+        'print' => [ 'print', '//depot/data/...' ],
+        'client' => [ 'client', '-o' ]
+      }.each do |name, cmd|
+        p4.with_capture( File.join( dir, "#{name}.p4cap" ) ) { p4.run( cmd ) }
+      end
+    end
+    replay_all( Dir.glob( File.join( dir, '*.p4cap' ) ).sort, iterations )
+  end
+else
+  replay_all( ARGV, iterations )
+end
@@ -0,0 +1,83 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Compares resolving a large integration through a Ruby block with
+# P4#run_resolve_with, where the same policy is expressed as rules and
+# settled without calling into Ruby.
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 50000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 3 ).to_i
+
+#
+# Opens every file under branch/ for integration from data/ with a
+# content resolve pending, then times the resolve.
+#
+def time_resolve( p4, iterations )
+  times = Array.new( iterations ) do
+    p4.run_revert( '-k', '//bench/branch/...' )
+    p4.run_integ( '//depot/data/...', '//depot/branch/...' )
+    t = Process.clock_gettime( Process::CLOCK_MONOTONIC )
+    yield
+    Process.clock_gettime( Process::CLOCK_MONOTONIC ) - t
+  end
+  times.sort[ times.length / 2 ]
+end
+
+P4Bench.with_server( files: files ) do |p4|
+  # Branch the data, then edit the source so that every file needs a
+  # content resolve when integrated again.
+  p4.run_integ( '//depot/data/...', '//depot/branch/...' )
+  p4.run_submit( '-dBranch' )
+  p4.run_edit( '//depot/data/...' )
+  Dir.glob( 'data/*' ).each { |f| File.write( f, "edited\n", mode: 'a' ) }
+  p4.run_submit( '-dEdit' )
+
+  puts "content resolve of #{files} files, median of #{iterations} runs"
+
+  block = time_resolve( p4, iterations ) do
+    p4.run_resolve { |md| md.merge_hint == 'at' ? 'at' : 's' }
+  end
+  P4Bench.report( 'block', block, 's' )
+
+  rules = time_resolve( p4, iterations ) do
+    p4.run_resolve_with( '//bench/branch/...' => 'at' )
+  end
+  P4Bench.report( 'rules', rules, 's' )
+  P4Bench.report( 'speedup', block / rules, 'x' )
+
+  auto = time_resolve( p4, iterations ) do
+    p4.run_resolve_with( '//bench/branch/...' => 'automerge' )
+  end
+  P4Bench.report( 'rules (automerge)', auto, 's' )
+
+  p4.run_revert( '-k', '//bench/branch/...' )
+end
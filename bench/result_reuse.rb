@@ -0,0 +1,56 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+#
+# Runs a tiny command many times, with and without P4#reuse_results,
+# and reports commands per second and Ruby objects allocated per
+# command.
+#
+
+require_relative 'benchlib'
+
+commands = ( ENV['BENCH_COMMANDS'] || 5000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+
+P4Bench.with_server( files: 1, size: 64 ) do |p4|
+  puts "#{commands} fstat commands of one file, median of #{iterations} runs"
+  [ false, true ].each do |reuse|
+    p4.reuse_results = reuse
+    label = reuse ? 'reused' : 'fresh'
+
+    before = GC.stat( :total_allocated_objects )
+    commands.times { p4.run_fstat( '//depot/data/file0.txt' ) }
+    allocated = GC.stat( :total_allocated_objects ) - before
+
+    time = P4Bench.measure( iterations: iterations ) do
+      commands.times { p4.run_fstat( '//depot/data/file0.txt' ) }
+    end
+
+    P4Bench.report( "fstat (#{label})", commands / time, 'cmds/s' )
+    P4Bench.report( "objects/cmd (#{label})", allocated.to_f / commands )
+  end
+end
@@ -0,0 +1,52 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Measures how quickly the extension turns server output into Ruby
+# strings on a unicode-mode server, where every string is tagged as
+# UTF-8. Run it against builds from before and after a change to
+# P4Utils::ruby_string and compare the strings/second figures.
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 20000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+
+P4Bench.with_server( files: files, unicode: true ) do |p4|
+  strings = p4.run_fstat( '//...' ).inject( 0 ) { |n, h| n + h.length * 2 }
+  median = P4Bench.measure( iterations: iterations ) do
+    p4.run_fstat( '//...' )
+  end
+
+  puts "fstat of #{files} files on a unicode server, " +
+       "median of #{iterations} runs"
+  P4Bench.report( 'wall', median, 's' )
+  P4Bench.report( 'strings', strings )
+  P4Bench.report( 'strings/second', ( strings / median ).round )
+end
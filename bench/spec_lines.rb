@@ -0,0 +1,58 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Times P4#format_spec and P4#parse_spec on a protections table with a
+# large number of lines, the worst case for per-line field lookups.
+#
+
+require_relative 'benchlib'
+
+lines = ( ENV['BENCH_LINES'] || 100000 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 10 ).to_i
+
+P4Bench.with_server( files: 0 ) do |p4|
+  protect = p4.fetch_protect
+  protect._protections = Array.new( lines ) do |i|
+    "write user user#{i} * //depot/area#{i}/..."
+  end
+
+  form = nil
+  format = P4Bench.measure( iterations: iterations ) do
+    form = p4.format_spec( 'protect', protect )
+  end
+  parse = P4Bench.measure( iterations: iterations ) do
+    p4.parse_spec( 'protect', form )
+  end
+
+  puts "protections table of #{lines} lines, median of #{iterations} runs"
+  P4Bench.report( 'format_spec', format, 's' )
+  P4Bench.report( 'format_spec per line', format / lines * 1e6, 'us' )
+  P4Bench.report( 'parse_spec', parse, 's' )
+  P4Bench.report( 'parse_spec per line', parse / lines * 1e6, 'us' )
+end
@@ -0,0 +1,130 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# The benchmark suite run by 'rake bench'. Seeds a private p4d with a
+# synthetic depot, then measures the main conversion paths: fstat,
+# files, filelog, describe, print, untagged sync, spec fetch and save,
+# map translate and resolve. For each it reports throughput, objects
+# allocated and peak RSS, and writes the lot as JSON for
+# bench/compare.rb. It only uses P4#run and friends, so it can also be
+# run against an older build to compare with:
+#
+#   ruby -I<old build>/lib bench/suite.rb && mv bench-results.json old.json
+#   rake bench && rake bench:compare[old.json,bench-results.json]
+#
+#   BENCH_FILES       files in the depot (default 2000)
+#   BENCH_SIZE        size of each file in bytes (default 1024)
+#   BENCH_CHANGES     edits submitted on top of the first add (default 5)
+#   BENCH_ITERATIONS  timed runs per benchmark (default 5)
+#   BENCH_OUT         where to write the results (default bench-results.json)
+#
+
+require_relative 'benchlib'
+
+files = ( ENV['BENCH_FILES'] || 2000 ).to_i
+size = ( ENV['BENCH_SIZE'] || 1024 ).to_i
+changes = ( ENV['BENCH_CHANGES'] || 5 ).to_i
+iterations = ( ENV['BENCH_ITERATIONS'] || 5 ).to_i
+out = File.expand_path( ENV['BENCH_OUT'] || 'bench-results.json' )
+
+results = {}
+bench = lambda do |name, items, setup = nil, &block|
+  r = P4Bench.profile( iterations: iterations, setup: setup, &block )
+  r[ 'items' ] = items
+  r[ 'items_per_second' ] = items / r[ 'seconds' ]
+  r[ 'allocations_per_item' ] = r[ 'allocations' ].fdiv( items )
+  results[ name ] = r
+  P4Bench.report( name, r[ 'items_per_second' ].round, 'items/s' )
+end
+
+P4Bench.with_server( files: files, size: size ) do |p4|
+  # Branch the data, then edit it so that there is history for filelog
+  # and describe, and a content resolve for every file in the branch.
+  p4.run_integ( '//depot/data/...', '//depot/branch/...' )
+  p4.run_submit( '-dBranch' )
+  changes.times do |c|
+    p4.run_edit( '//depot/data/...' )
+    Dir.glob( 'data/*' ).each { |f| File.write( f, "edit #{c}\n", mode: 'a' ) }
+    p4.run_submit( "-dEdit #{c}" )
+  end
+  last = p4.run_changes( '-m1', '//depot/data/...' )[ 0 ][ 'change' ]
+  revs = files * ( changes + 1 )
+
+  puts "#{files} files of #{size} bytes, #{changes} edits, " +
+       "median of #{iterations} runs"
+
+  bench.call( 'fstat', files ) { p4.run_fstat( '//depot/data/...' ) }
+  bench.call( 'files', files ) { p4.run_files( '//depot/data/...' ) }
+  bench.call( 'filelog', revs ) { p4.run_filelog( '//depot/data/...' ) }
+  bench.call( 'describe', files ) { p4.run_describe( '-s', last ) }
+  bench.call( 'print', files ) { p4.run_print( '//depot/data/...' ) }
+
+  # One info message per file, held marshalled until the command ends
+  p4.tagged = false
+  bench.call( 'sync', files ) { p4.run_sync( '-f', '//depot/data/...' ) }
+  p4.tagged = true
+
+  # A client with a long view, so there are plenty of spec lines
+  area = Array.new( 500 ) { |i| "//depot/area#{i}/... //bench/area#{i}/..." }
+  spec = p4.fetch_client
+  spec._view += area
+  p4.save_client( spec )
+  specs = 100
+  bench.call( 'spec fetch', specs ) { specs.times { p4.fetch_client } }
+  bench.call( 'spec save', specs ) { specs.times { p4.save_client( spec ) } }
+
+  map = P4::Map.new( area )
+  paths = Array.new( 10000 ) { |i| "//depot/area#{i % 500}/dir/file#{i}.txt" }
+  bench.call( 'map translate', paths.length ) do
+    paths.each { |path| map.translate( path ) }
+  end
+
+  reopen = lambda do
+    p4.run_revert( '-k', '//bench/branch/...' )
+    p4.run_integ( '//depot/data/...', '//depot/branch/...' )
+  end
+  bench.call( 'resolve', files, reopen ) do
+    p4.run_resolve { |md| md.merge_hint == 'at' ? 'at' : 's' }
+  end
+  p4.run_revert( '-k', '//bench/branch/...' )
+
+  File.write( out, JSON.pretty_generate(
+    'ruby' => RUBY_VERSION,
+    'p4ruby' => P4::VERSION,
+    'p4api' => P4::P4API_VERSION,
+    'platform' => RUBY_PLATFORM,
+    'time' => Time.now.utc.strftime( '%Y-%m-%dT%H:%M:%SZ' ),
+    'files' => files,
+    'size' => size,
+    'changes' => changes,
+    'iterations' => iterations,
+    'results' => results
+  ) + "\n" )
+  puts "results written to #{out}"
+end
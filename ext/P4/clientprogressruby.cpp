@@ -45,12 +45,84 @@
 
 extern VALUE eP4;
 
+static ID idInit		= 0;
+static ID idDescription	= 0;
+static ID idTotal	= 0;
+static ID idUpdate	= 0;
+static ID idDone	= 0;
+
+void ClientProgressTotals::Reset() {
+	bytes = 0;
+	files = 0;
+	updates = 0;
+	callbacks = 0;
+	started = Clock::now().time_since_epoch().count();
+}
+
+void ClientProgressTotals::Add(int units, long delta) {
+	updates++;
+	switch( units ) {
+	case CPU_FILES:
+		files += delta;
+		break;
+	case CPU_KBYTES:
+		bytes += (long long) delta * 1024;
+		break;
+	case CPU_MBYTES:
+		bytes += (long long) delta * 1024 * 1024;
+		break;
+	}
+}
+
+double ClientProgressTotals::Elapsed() const {
+	Clock::duration d = Clock::now().time_since_epoch()
+				- Clock::duration( started.load() );
+	return std::chrono::duration<double>( d ).count();
+}
+
 ClientProgressRuby::ClientProgressRuby(VALUE prog, int t) {
 	progress = prog;
-	ID method = rb_intern("init");
+	encoding = P4Utils::EncodingIndex(P4Utils::GetCharset() != 0, 0);
+	totals = 0;
+	interval = 0;
+	step = 0;
+	Init( t );
+}
+
+ClientProgressRuby::ClientProgressRuby(VALUE prog, int t,
+		ClientProgressTotals *tot, double i, int s, int enc) {
+	progress = prog;
+	encoding = enc;
+	totals = tot;
+	interval = i;
+	step = s;
+	Init( t );
+}
+
+void ClientProgressRuby::Init(int t) {
+	if( !idInit ) {
+		idInit = rb_intern("init");
+		idDescription = rb_intern("description");
+		idTotal = rb_intern("total");
+		idUpdate = rb_intern("update");
+		idDone = rb_intern("done");
+	}
+
+	units = CPU_UNSPECIFIED;
+	total = 0;
+	position = 0;
+	reported = 0;
+	pending = false;
+	lastFired = ClientProgressTotals::Clock::now();
+
+	hasDescription = rb_respond_to(progress, idDescription);
+	hasTotal = rb_respond_to(progress, idTotal);
+	hasUpdate = rb_respond_to(progress, idUpdate);
+	hasDone = rb_respond_to(progress, idDone);
+
 	VALUE type  = INT2NUM( t );
-	if (rb_respond_to(progress, method))
-		rb_funcall(progress, method, 1, type);
+	if (rb_respond_to(progress, idInit))
+		rb_funcall(progress, idInit, 1, type);
 	else
 		rb_raise(eP4, "P4::Progress#init not implemented");
 }
@@ -59,40 +131,69 @@ ClientProgressRuby::~ClientProgressRuby() {
 }
 
 void ClientProgressRuby::Description(const StrPtr *d, int u) {
-	ID method = rb_intern("description");
-	VALUE desc = P4Utils::ruby_string(d->Text());
-	VALUE units = INT2NUM( u );
-	if (rb_respond_to(progress, method))
-		rb_funcall(progress, method, 2, desc, units);
-	else
+	units = u;
+	if (!hasDescription)
 		rb_raise(eP4, "P4::Progress#description not implemented");
+
+	VALUE desc = P4Utils::ruby_string(encoding, *d);
+	VALUE units = INT2NUM( u );
+	rb_funcall(progress, idDescription, 2, desc, units);
 }
 
 void ClientProgressRuby::Total(long t) {
-	VALUE total = LONG2NUM( t );
-	ID method = rb_intern("total");
-	if (rb_respond_to(progress, method))
-		rb_funcall(progress, method, 1, total);
-	else
+	total = t;
+	if (!hasTotal)
 		rb_raise(eP4, "P4::Progress#total not implemented");
+
+	rb_funcall(progress, idTotal, 1, LONG2NUM( t ));
 }
 
 int ClientProgressRuby::Update(long pos) {
-	VALUE position = LONG2NUM( pos );
-	ID method = rb_intern( "update" );
-	if( rb_respond_to(progress, method))
-		rb_funcall( progress, method, 1, position );
-	else
+	if (!hasUpdate)
 		rb_raise(eP4, "P4::Progress#update not implemented");
 
+	if( totals ) totals->Add( units, pos - position );
+	position = pos;
+
+	if( !interval && !step ) {
+		Fire( pos );
+		return 0;
+	}
+
+	bool fire = total > 0 && pos >= total;
+
+	if( !fire && step && total > 0 )
+		fire = ( pos - reported ) * 100.0 >= (double) step * total;
+
+	if( !fire && interval ) {
+		std::chrono::duration<double> since =
+			ClientProgressTotals::Clock::now() - lastFired;
+		fire = since.count() >= interval;
+	}
+
+	if( fire )
+		Fire( pos );
+	else
+		pending = true;
+
 	return 0;
 }
 
+void ClientProgressRuby::Fire(long pos) {
+	pending = false;
+	reported = pos;
+	lastFired = ClientProgressTotals::Clock::now();
+	if( totals ) totals->callbacks++;
+	rb_funcall( progress, idUpdate, 1, LONG2NUM( pos ) );
+}
+
 void ClientProgressRuby::Done(int f) {
-	VALUE fail = INT2NUM( f );
-	ID method = rb_intern( "done" );
-	if( rb_respond_to(progress, method))
-		rb_funcall( progress, method, 1, fail );
-	else
+	// Make sure Ruby sees where we ended up
+	if( pending )
+		Fire( position );
+
+	if (!hasDone)
 		rb_raise(eP4, "P4::Progress#done not implemented");
+
+	rb_funcall( progress, idDone, 1, INT2NUM( f ) );
 }
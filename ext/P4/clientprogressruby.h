@@ -35,9 +35,37 @@
  *
  ******************************************************************************/
 
+#include <atomic>
+#include <chrono>
+
+/*
+ * Running totals for the progress indicators of the current command.
+ * Updated natively on every callback from the API, and safe to read
+ * from any thread without calling into Ruby.
+ */
+class ClientProgressTotals {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ClientProgressTotals() { Reset(); }
+
+	void	Reset();
+	void	Add( int units, long delta );
+
+	double	Elapsed() const;
+
+	std::atomic<long long>	bytes;
+	std::atomic<long long>	files;
+	std::atomic<long long>	updates;	// Updates from the API
+	std::atomic<long long>	callbacks;	// Updates passed to Ruby
+	std::atomic<long long>	started;	// Clock ticks at Reset()
+};
+
 class ClientProgressRuby : public ClientProgress {
 public:
 	ClientProgressRuby( VALUE prog, int t );
+	ClientProgressRuby( VALUE prog, int t, ClientProgressTotals *totals,
+			    double interval, int step, int enc );
 	virtual ~ClientProgressRuby();
 
 public:
@@ -48,5 +76,29 @@ public:
     void	Done( int f );
 
 private:
+    void	Init( int t );
+    void	Fire( long pos );
+
     VALUE	progress;
+    int		encoding;	// Of the strings passed to Ruby
+
+    // Methods implemented by the progress object, checked once up front
+    bool	hasDescription;
+    bool	hasTotal;
+    bool	hasUpdate;
+    bool	hasDone;
+
+    // Coalescing of updates: Ruby only sees an update once 'interval'
+    // seconds have passed, or the position has moved on 'step' percent
+    // of the total, since the last one it saw. Both zero means every
+    // update is passed on.
+    ClientProgressTotals *		totals;
+    double				interval;
+    int					step;
+    int					units;
+    long				total;
+    long				position;
+    long				reported;
+    bool				pending;
+    ClientProgressTotals::Clock::time_point	lastFired;
 };
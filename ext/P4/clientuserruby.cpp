@@ -44,18 +44,29 @@
 #include <p4/diff.h>
 #include "p4rubyconf.h"
 #include "gc_hack.h"
+#include "p4track.h"
 #include "p4result.h"
 #include "p4rubydebug.h"
 #include "p4mergedata.h"
 #include "p4error.h"
+#include "p4commandstats.h"
 #include "clientuserruby.h"
 #include "clientprogressruby.h"
 #include "specmgr.h"
 #include "p4utils.h"
+#include "p4trace.h"
+#include "p4resolverules.h"
+#include "p4querycache.h"
+#include "p4capture.h"
+#include "p4export.h"
 
 extern VALUE cP4;	// Base P4 class
 extern VALUE eP4;	// Exception class
 extern VALUE cP4Msg; // Message class
+extern VALUE cP4MD;	// MergeData class
+extern VALUE cP4Prog;	// Progress class
+extern VALUE cP4OH;	// OutputHandler class
+extern VALUE cP4SSO;	// SSOHandler class
 
 static const int REPORT = 0;
 static const int HANDLED = 1;
@@ -83,11 +94,21 @@ ClientUserRuby::ClientUserRuby(SpecMgr *s) {
 	specMgr = s;
 	debug = 0;
 	apiLevel = atoi(P4Tag::l_client);
+	encoding = P4Utils::EncodingIndex(0, 0);
+	owner = Qnil;
 	input = Qnil;
 	mergeData = Qnil;
 	mergeResult = Qnil;
 	handler = Qnil;
 	progress = Qnil;
+	progressTotals = new ClientProgressTotals;
+	progressInterval = 0;
+	progressStep = 0;
+	resolveRules = new P4ResolveRules;
+	recorder = 0;
+	capture = 0;
+	exporter = 0;
+	projection = 0;
 	rubyExcept = 0;
 	alive = 1;
 	track = false;
@@ -98,19 +119,19 @@ ClientUserRuby::ClientUserRuby(SpecMgr *s) {
 	ssoResult = Qnil;
 	ssoHandler = Qnil;
 
-	ID idP4 = rb_intern("P4");
-	ID idP4OH = rb_intern("OutputHandler");
-	ID idP4Progress = rb_intern("Progress");
-	ID idP4SSO = rb_intern("SSOHandler");
+	cOutputHandler = cP4OH;
+	cProgress = cP4Prog;
+	cSSOHandler = cP4SSO;
+}
 
-	VALUE cP4 = rb_const_get_at(rb_cObject, idP4);
-	cOutputHandler = rb_const_get_at(cP4, idP4OH);
-	cProgress = rb_const_get_at(cP4, idP4Progress );
-	cSSOHandler = rb_const_get_at(cP4, idP4SSO);
+ClientUserRuby::~ClientUserRuby() {
+	delete progressTotals;
+	delete resolveRules;
 }
 
 void ClientUserRuby::Reset() {
 	results.Reset();
+	progressTotals->Reset();
 	rubyExcept = 0;
 	// Leave input alone.
 
@@ -122,6 +143,11 @@ void ClientUserRuby::SetApiLevel(int l) {
 	results.SetApiLevel(l);
 }
 
+void ClientUserRuby::SetEncoding(int e) {
+	encoding = e;
+	results.SetEncoding(e);
+}
+
 void ClientUserRuby::Finished() {
 	// Reset input coz we should be done with it now. Keeping hold of
 	// it just prevents GC from sweeping it if possible
@@ -186,6 +212,16 @@ void ClientUserRuby::ProcessOutput(const char * method, VALUE data) {
 }
 
 void ClientUserRuby::ProcessMessage(Error * e) {
+	if (P4Trace::On()) {
+		ErrorId *id = e->GetId(0);
+		P4Trace::Record(P4Trace::MESSAGE, this, e->GetSeverity(),
+				id ? id->UniqueCode() : 0);
+	}
+
+	if (recorder) recorder->Abandon();
+	if (capture) capture->Message(e);
+	if (results.IsSuppressed(e)) return;
+
 	if (this->handler != Qnil) {
 		int s = e->GetSeverity();
 
@@ -194,14 +230,22 @@ void ClientUserRuby::ProcessMessage(Error * e) {
 			// not outputError, or untagged output looks
 			// very strange indeed
 
-			StrBuf m;
-			e->Fmt(&m, EF_PLAIN);
-			VALUE s = P4Utils::ruby_string(m.Text());
+			VALUE s;
+			{
+				P4CommandStats::Timer c(stats.convertTime);
+				StrBuf m;
+				e->Fmt(&m, EF_PLAIN);
+				s = P4Utils::ruby_string(encoding, m);
+			}
 
 			if (CallOutputMethod("outputInfo", s)) results.AddOutput(s);
 		} else {
-			P4Error *pe = new P4Error(*e);
-			VALUE ve = pe->Wrap(cP4Msg);
+			VALUE ve;
+			{
+				P4CommandStats::Timer c(stats.convertTime);
+				P4Error *pe = new P4Error(*e, encoding);
+				ve = pe->Wrap(cP4Msg);
+			}
 
 			if (CallOutputMethod("outputMessage", ve)) results.AddMessage(e);
 		}
@@ -217,26 +261,24 @@ void ClientUserRuby::ProcessMessage(Error * e) {
 void ClientUserRuby::OutputText(const char *data, int length) {
 	if (P4RDB_CALLS) fprintf(stderr, "[P4] OutputText()\n");
 	if (P4RDB_DATA) fprintf(stderr, "... [%d]%*s\n", length, length, data);
-	if (track && length > 4 && data[0] == '-' && data[1] == '-'
-			&& data[2] == '-' && data[3] == ' ') {
-		int p = 4;
-		for (int i = 4; i < length; ++i) {
-			if (data[i] == '\n') {
-				if (i > p) {
-					results.AddTrack(P4Utils::ruby_string(data + p, i - p));
-					p = i + 5;
-				} else {
-					// this was not track data after all,
-					// try to rollback the damage done
-					ProcessOutput("outputText",
-							P4Utils::ruby_string(data, length));
-					results.DeleteTrack();
-					return;
-				}
-			}
+
+	P4Trace::Record(P4Trace::OUTPUT_TEXT, this, length);
+	P4CommandStats::Timer t(stats.callbackTime);
+	stats.texts++;
+	stats.bytesReceived += length;
+	if (recorder) recorder->Text(data, length);
+	if (capture) capture->Text(data, length);
+
+	if (track && P4Track::IsTrack(data, length)) {
+		results.AddTrack(data, length);
+	} else {
+		VALUE s;
+		{
+			P4CommandStats::Timer c(stats.convertTime);
+			s = P4Utils::ruby_string(encoding, data, length);
 		}
-	} else
-		ProcessOutput("outputText", P4Utils::ruby_string(data, length));
+		ProcessOutput("outputText", s);
+	}
 }
 
 void ClientUserRuby::Message(Error *e) {
@@ -248,6 +290,8 @@ void ClientUserRuby::Message(Error *e) {
 		fprintf(stderr, "... [%s] %s\n", e->FmtSeverity(), t.Text());
 	}
 
+	P4CommandStats::Timer t(stats.callbackTime);
+	stats.messages++;
 	ProcessMessage(e);
 }
 
@@ -260,6 +304,8 @@ void ClientUserRuby::HandleError(Error *e) {
 		fprintf(stderr, "... [%s] %s\n", e->FmtSeverity(), t.Text());
 	}
 
+	P4CommandStats::Timer t(stats.callbackTime);
+	stats.messages++;
 	ProcessMessage(e);
 }
 
@@ -277,10 +323,39 @@ void ClientUserRuby::OutputBinary(const char *data, int length) {
 	// P4Result::AddOutput() assumes it can strlen() to find the length,
 	// we'll make the String object here.
 	//
-	ProcessOutput("outputBinary", P4Utils::ruby_string(data, length));
+	P4Trace::Record(P4Trace::OUTPUT_BINARY, this, length);
+	P4CommandStats::Timer t(stats.callbackTime);
+	stats.binaryBytes += length;
+	stats.bytesReceived += length;
+	if (recorder) recorder->Binary(data, length);
+	if (capture) capture->Binary(data, length);
+
+	VALUE s;
+	{
+		P4CommandStats::Timer c(stats.convertTime);
+		s = P4Utils::ruby_string(encoding, data, length);
+	}
+	ProcessOutput("outputBinary", s);
 }
 
 void ClientUserRuby::OutputStat(StrDict *values) {
+	P4CommandStats::Timer t(stats.callbackTime);
+	stats.records++;
+
+	StrRef var, val;
+	int fields = 0;
+	for (; values->GetVar(fields, var, val); fields++)
+		stats.bytesReceived += var.Length() + val.Length();
+	P4Trace::Record(P4Trace::OUTPUT_STAT, this, fields);
+	if (recorder) recorder->Stat(values);
+	if (capture) capture->Stat(values);
+
+	if (exporter) {
+		P4CommandStats::Timer c(stats.convertTime);
+		if (!exporter->Stat(values, rubyExcept)) alive = 0;
+		return;
+	}
+
 	StrPtr * spec = values->GetVar("specdef");
 	StrPtr * data = values->GetVar("data");
 	StrPtr * sf = values->GetVar("specFormatted");
@@ -324,7 +399,9 @@ void ClientUserRuby::OutputStat(StrDict *values) {
 #endif
 		if (!e.Test()) s.ParseNoValid(data->Text(), &specData, &e);
 		if (e.Test()) {
-			HandleError(&e);
+			// Already inside a timed callback, so skip HandleError()
+			stats.messages++;
+			ProcessMessage(&e);
 			return;
 		}
 		dict = specData.Dict();
@@ -338,11 +415,21 @@ void ClientUserRuby::OutputStat(StrDict *values) {
 		if (P4RDB_CALLS)
 			fprintf(stderr,
 					"[P4] OutputStat() - Converting to P4::Spec object\n");
-		ProcessOutput("outputStat", specMgr->StrDictToSpec(dict, spec));
+		VALUE r;
+		{
+			P4CommandStats::Timer c(stats.convertTime);
+			r = specMgr->StrDictToSpec(dict, spec);
+		}
+		ProcessOutput("outputStat", r);
 	} else {
 		if (P4RDB_CALLS)
 			fprintf(stderr, "[P4] OutputStat() - Converting to hash\n");
-		ProcessOutput("outputStat", specMgr->StrDictToHash(dict));
+		VALUE r;
+		{
+			P4CommandStats::Timer c(stats.convertTime);
+			r = specMgr->StrDictToHash(dict, Qnil, projection);
+		}
+		ProcessOutput("outputStat", r);
 	}
 }
 
@@ -364,7 +451,8 @@ void ClientUserRuby::Diff(FileSys *f1, FileSys *f2, int doPage, char *diffFlags,
 	//
 	if (!f1->IsTextual() || !f2->IsTextual()) {
 		if (f1->Compare(f2, e))
-			results.AddOutput(P4Utils::ruby_string("(... files differ ...)"));
+			results.AddOutput(P4Utils::ruby_string(encoding,
+					"(... files differ ...)"));
 		return;
 	}
 
@@ -400,7 +488,7 @@ void ClientUserRuby::Diff(FileSys *f1, FileSys *f2, int doPage, char *diffFlags,
 		if (!e->Test()) {
 			StrBuf b;
 			while (t->ReadLine(&b, e))
-				results.AddOutput(P4Utils::ruby_string(b.Text(), b.Length()));
+				results.AddOutput(P4Utils::ruby_string(encoding, b));
 		}
 	}
 
@@ -437,6 +525,8 @@ void ClientUserRuby::InputData(StrBuf *strbuf, Error *e) {
 
 		specMgr->AddSpecDef(cmd.Text(), specDef->Text());
 		specMgr->SpecToString(cmd.Text(), inval, *strbuf, e);
+		stats.bytesSent += strbuf->Length();
+		P4Trace::Record(P4Trace::INPUT, this, strbuf->Length());
 		return;
 	}
 
@@ -444,6 +534,8 @@ void ClientUserRuby::InputData(StrBuf *strbuf, Error *e) {
 	ID to_s = rb_intern("to_s");
 	VALUE str = rb_funcall(inval, to_s, 0);
 	strbuf->Set(StringValuePtr(str));
+	stats.bytesSent += strbuf->Length();
+	P4Trace::Record(P4Trace::INPUT, this, strbuf->Length());
 }
 
 /*
@@ -463,11 +555,25 @@ void ClientUserRuby::Prompt(const StrPtr &msg, StrBuf &rsp, int noEcho,
  */
 int ClientUserRuby::Resolve(ClientMerge *m, Error *e) {
 	if (P4RDB_CALLS) fprintf(stderr, "[P4] Resolve()\n");
+	P4Trace::Record(P4Trace::RESOLVE, this);
 	//
 	// If rubyExcept is non-zero, we should skip any further
 	//	resolves
 	//
 	if (rubyExcept) return CMS_QUIT;
+
+	//
+	// Files covered by a resolve rule are settled here, without
+	// building a MergeData object. With rules set, anything they
+	// don't cover is skipped unless there's a block to ask.
+	//
+	if (resolveRules->Count()) {
+		P4ResolveRules::Action a = resolveRules->Match(varList,
+				m->GetYourFile());
+		if (a != P4ResolveRules::NONE) return resolveRules->Apply(a, m);
+		if (!rb_block_given_p()) return CMS_SKIP;
+	}
+
 	//
 	// If no block has been passed, default to using the merger's resolve
 	//
@@ -501,7 +607,7 @@ int ClientUserRuby::Resolve(ClientMerge *m, Error *e) {
 		break;
 	}
 
-	mergeData = MkMergeInfo(m, t);
+	Set(mergeData, MkMergeInfo(m, t));
 
 	VALUE r;
 	StrBuf reply;
@@ -548,6 +654,7 @@ int ClientUserRuby::Resolve(ClientMerge *m, Error *e) {
 
 int ClientUserRuby::Resolve(ClientResolveA *m, int preview, Error *e) {
 	if (P4RDB_CALLS) fprintf(stderr, "[P4] Resolve(Action)\n");
+	P4Trace::Record(P4Trace::RESOLVE, this, 1);
 
 	//
 	// If rubyExcept is non-zero, we should skip any further
@@ -555,6 +662,12 @@ int ClientUserRuby::Resolve(ClientResolveA *m, int preview, Error *e) {
 	//
 	if (rubyExcept) return CMS_QUIT;
 
+	if (resolveRules->Count()) {
+		P4ResolveRules::Action a = resolveRules->Match(varList, 0);
+		if (a != P4ResolveRules::NONE) return resolveRules->Apply(a, m);
+		if (!rb_block_given_p()) return CMS_SKIP;
+	}
+
 	//
 	// If no block has been passed, default to using the merger's resolve
 	//
@@ -590,7 +703,7 @@ int ClientUserRuby::Resolve(ClientResolveA *m, int preview, Error *e) {
 		break;
 	}
 
-	mergeData = MkActionMergeInfo(m, t);
+	Set(mergeData, MkActionMergeInfo(m, t));
 
 	VALUE r;
 	StrBuf reply;
@@ -635,7 +748,9 @@ ClientProgress* ClientUserRuby::CreateProgress(int type) {
 	if( progress == Qnil ) {
 		return NULL;
 	} else {
-		return new ClientProgressRuby( progress, type );
+		return new ClientProgressRuby( progress, type, progressTotals,
+					progressInterval, progressStep,
+					encoding );
 	}
 }
 
@@ -657,7 +772,7 @@ int ClientUserRuby::ProgressIndicator() {
 VALUE ClientUserRuby::SetInput(VALUE i) {
 	if (P4RDB_CALLS) fprintf(stderr, "[P4] SetInput()\n");
 
-	input = i;
+	Set(input, i);
 	return Qtrue;
 }
 
@@ -674,7 +789,7 @@ VALUE ClientUserRuby::SetHandler(VALUE h) {
 		return Qfalse;
 	}
 
-	handler = h;
+	Set(handler, h);
 	alive = 1; // ensure that we don't drop out after the next call
 
 	return Qtrue;
@@ -694,15 +809,31 @@ VALUE ClientUserRuby::SetProgress(VALUE p) {
 		return Qfalse;
 	}
 
-	progress = p;
+	Set(progress, p);
 	alive = 1;
 	return Qtrue;
 }
 
-VALUE ClientUserRuby::MkMergeInfo(ClientMerge *m, StrPtr &hint) {
-	ID idP4 = rb_intern("P4");
-	ID idP4M = rb_intern("MergeData");
+/*
+ * Totals of the progress reported during the last command, gathered
+ * natively whether or not every update was passed on to Ruby.
+ */
+VALUE ClientUserRuby::GetProgressTotals() {
+	VALUE h = rb_hash_new();
+	rb_hash_aset( h, P4Utils::ruby_string( "bytes" ),
+			LL2NUM( progressTotals->bytes.load() ) );
+	rb_hash_aset( h, P4Utils::ruby_string( "files" ),
+			LL2NUM( progressTotals->files.load() ) );
+	rb_hash_aset( h, P4Utils::ruby_string( "updates" ),
+			LL2NUM( progressTotals->updates.load() ) );
+	rb_hash_aset( h, P4Utils::ruby_string( "callbacks" ),
+			LL2NUM( progressTotals->callbacks.load() ) );
+	rb_hash_aset( h, P4Utils::ruby_string( "elapsed" ),
+			rb_float_new( progressTotals->Elapsed() ) );
+	return h;
+}
 
+VALUE ClientUserRuby::MkMergeInfo(ClientMerge *m, StrPtr &hint) {
 	//
 	//	Get the last entry from the results array
 	//
@@ -714,17 +845,12 @@ VALUE ClientUserRuby::MkMergeInfo(ClientMerge *m, StrPtr &hint) {
 		rb_ary_push( info, rb_ary_entry(output, len - 1) );
 	}
 
-	VALUE cP4 = rb_const_get_at(rb_cObject, idP4);
-	VALUE cP4M = rb_const_get_at(cP4, idP4M);
-
 	P4MergeData *d = new P4MergeData(this, m, hint, info);
-	return d->Wrap(cP4M);
+	d->SetEncoding(encoding);
+	return d->Wrap(cP4MD);
 }
 
 VALUE ClientUserRuby::MkActionMergeInfo(ClientResolveA *m, StrPtr &hint) {
-	ID idP4 = rb_intern("P4");
-	ID idP4M = rb_intern("MergeData");
-
 	//
 	//	Get the last entry from the results array
 	//
@@ -733,11 +859,9 @@ VALUE ClientUserRuby::MkActionMergeInfo(ClientResolveA *m, StrPtr &hint) {
 	int len = RARRAY_LEN(output);
 	rb_ary_push( info, rb_ary_entry(output, len - 1) );
 
-	VALUE cP4 = rb_const_get_at(rb_cObject, idP4);
-	VALUE cP4M = rb_const_get_at(cP4, idP4M);
-
 	P4MergeData *d = new P4MergeData(this, m, hint, info);
-	return d->Wrap(cP4M);
+	d->SetEncoding(encoding);
+	return d->Wrap(cP4MD);
 }
 
 //
@@ -748,20 +872,58 @@ void ClientUserRuby::GCMark() {
 		fprintf(stderr,
 				"[P4] Marking results and errors for garbage collection\n");
 
-	if (input != Qnil) rb_gc_mark( input);
-	if (mergeData != Qnil) rb_gc_mark( mergeData);
-	if (mergeResult != Qnil) rb_gc_mark( mergeResult);
-	if (handler != Qnil) rb_gc_mark( handler);
+	rb_gc_mark_movable( input );
+	rb_gc_mark_movable( mergeData );
+	rb_gc_mark_movable( mergeResult );
+	rb_gc_mark_movable( handler );
+	rb_gc_mark_movable( ssoResult );
+	rb_gc_mark_movable( ssoHandler );
+
+	// The progress object is copied into each ClientProgressRuby, so
+	// it has to stay put
 	if (progress != Qnil) rb_gc_mark( progress );
-	if (ssoResult != Qnil) rb_gc_mark( ssoResult );
-	if (ssoHandler != Qnil) rb_gc_mark( ssoHandler );
+
 	rb_gc_mark( cOutputHandler );
 	rb_gc_mark( cProgress );
 	rb_gc_mark( cSSOHandler );
 
+	if (exporter) exporter->GCMark();
 	results.GCMark();
 }
 
+void ClientUserRuby::GCCompact() {
+	input = rb_gc_location( input );
+	mergeData = rb_gc_location( mergeData );
+	mergeResult = rb_gc_location( mergeResult );
+	handler = rb_gc_location( handler );
+	ssoResult = rb_gc_location( ssoResult );
+	ssoHandler = rb_gc_location( ssoHandler );
+
+	results.GCCompact();
+}
+
+size_t ClientUserRuby::MemSize() {
+	return results.MemSize() + sizeof(ClientProgressTotals) +
+		sizeof(P4ResolveRules);
+}
+
+void ClientUserRuby::SetOwner(VALUE o) {
+	owner = o;
+	results.SetOwner(o);
+
+	// Only the classes are set before we have an owner
+	RB_OBJ_WRITTEN(owner, Qundef, cOutputHandler);
+	RB_OBJ_WRITTEN(owner, Qundef, cProgress);
+	RB_OBJ_WRITTEN(owner, Qundef, cSSOHandler);
+}
+
+void ClientUserRuby::Set(VALUE &slot, VALUE v) {
+	if (owner != Qnil)
+		RB_OBJ_WRITE(owner, &slot, v);
+	else
+		slot = v;
+}
+
 
 /*
  * Set the Handler object. Double-check that it is either nil or
@@ -777,7 +939,7 @@ ClientUserRuby::SetRubySSOHandler(VALUE h) {
 		return Qfalse;
 	}
 
-	ssoHandler = h;
+	Set(ssoHandler, h);
 	alive = 1; // ensure that we don't drop out after the next call
 
 	return Qtrue;
@@ -980,7 +1142,7 @@ ClientUserRuby::SetSSOResult( VALUE i )
 {
 	if (P4RDB_CALLS) fprintf(stderr, "[P4] P4ClientSSO::SetResult()\n");
  
-	ssoResult = i;
+	Set(ssoResult, i);
 	return Qtrue;
 }
 
@@ -41,10 +41,16 @@
  ******************************************************************************/
 class SpecMgr;
 class ClientProgress;
+class ClientProgressTotals;
+class P4ResolveRules;
+class P4QueryCache;
+class P4Capture;
+class P4Export;
 
 class ClientUserRuby: public ClientUser, public ClientSSO, public KeepAlive {
 public:
 	ClientUserRuby(SpecMgr *s);
+	~ClientUserRuby();
 
 	// Client User methods overridden here
 	void OutputText(const char *data, int length);
@@ -70,6 +76,13 @@ public:
 		cmd = c;
 	}
 	void SetApiLevel(int l);
+
+	// Encoding index for strings made from this connection's output.
+	// See P4Utils::EncodingIndex().
+	void SetEncoding(int e);
+	int GetEncoding() {
+		return encoding;
+	}
 	void SetTrack(bool t) {
 		track = t;
 	}
@@ -77,13 +90,20 @@ public:
 	P4Result& GetResults() {
 		return results;
 	}
+	P4CommandStats& GetStats() {
+		return stats;
+	}
 	int ErrorCount();
 	void Reset();
 
 	void RaiseRubyException();
 
-	// GC support
+	// GC support. Once the owner, the P4 object, is set, stores into
+	// our VALUEs go through its write barrier.
+	void SetOwner(VALUE o);
 	void GCMark();
+	void GCCompact();
+	size_t MemSize();
 
 	// Debugging support
 	void SetDebug(int d) {
@@ -101,6 +121,46 @@ public:
 	VALUE GetProgress() {
 		return progress;
 	}
+	void SetProgressInterval( double i ) {
+		progressInterval = i;
+	}
+	double GetProgressInterval() {
+		return progressInterval;
+	}
+	void SetProgressStep( int s ) {
+		progressStep = s;
+	}
+	int GetProgressStep() {
+		return progressStep;
+	}
+	VALUE GetProgressTotals();
+
+	// Output is also passed to the recorder while one is set
+	void SetRecorder( P4QueryCache *r ) {
+		recorder = r;
+	}
+
+	// Output is written to the capture file while one is set
+	void SetCapture( P4Capture *c ) {
+		capture = c;
+	}
+
+	// Tagged output goes to the exporter instead of the results while
+	// one is set
+	void SetExport( P4Export *e ) {
+		exporter = e;
+	}
+
+	// Only the fields named are converted from tagged output while a
+	// projection is set
+	void SetFields( StrDict *f ) {
+		projection = f;
+	}
+
+	// Resolve rules, consulted before any resolve block
+	P4ResolveRules& GetResolveRules() {
+		return *resolveRules;
+	}
 
 	// SSO handler support
 
@@ -132,9 +192,13 @@ private:
 	ClientSSOStatus CallSSOMethod(VALUE vars, int maxLength, StrBuf &result);
 
 private:
+	void Set(VALUE &slot, VALUE v);
+
 	StrBuf cmd;
 	SpecMgr * specMgr;
+	VALUE owner;
 	P4Result results;
+	P4CommandStats stats;
 	VALUE input;
 	VALUE mergeData;
 	VALUE mergeResult;
@@ -142,9 +206,18 @@ private:
 	VALUE cOutputHandler;
 	VALUE progress;
 	VALUE cProgress;
+	ClientProgressTotals * progressTotals;
+	double progressInterval;
+	int progressStep;
+	P4ResolveRules * resolveRules;
+	P4QueryCache * recorder;
+	P4Capture * capture;
+	P4Export * exporter;
+	StrDict * projection;
 	VALUE cSSOHandler;
 	int debug;
 	int apiLevel;
+	int encoding;
 	int alive;
 	int rubyExcept;
 	bool track;
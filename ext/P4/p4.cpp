@@ -40,15 +40,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <p4/strtable.h>
 #include <p4/spec.h>
 #include <p4/ident.h>
+#include "p4track.h"
 #include "p4result.h"
 #include "specmgr.h"
+#include "p4commandstats.h"
 #include "clientuserruby.h"
 #include "p4rubyconf.h"
 #include "p4clientapi.h"
+#include "p4prepared.h"
 #include "p4mergedata.h"
 #include "p4mapmaker.h"
 #include "p4error.h"
 #include "p4utils.h"
+#include "p4metrics.h"
+#include "p4export.h"
+#include "p4trace.h"
 #include "extconf.h"
 
 
@@ -70,6 +76,10 @@ VALUE	cP4MD;	// P4::MergeData class
 VALUE	cP4Map;	// P4::Map class
 VALUE	cP4Msg; // P4::Message class
 VALUE	cP4Prog;	//	P4::Progress class
+VALUE	cP4Prepared;	// P4::PreparedCommand class
+VALUE	cP4Spec;	// P4::Spec class
+VALUE	cP4OH;	// P4::OutputHandler class
+VALUE	cP4SSO;	// P4::SSOHandler class
 
 
 extern "C"
@@ -79,23 +89,46 @@ extern "C"
 // Construction/destruction
 //
 
-static void p4_free( P4ClientApi *p4 )
+static void p4_free( void *p4 )
 {
-    delete p4;
+    delete (P4ClientApi *) p4;
 }
 
-static void p4_mark( P4ClientApi *p4 )
+static void p4_mark( void *p4 )
 {
-    p4->GCMark();
+    ( (P4ClientApi *) p4 )->GCMark();
 }
 
+static void p4_compact( void *p4 )
+{
+    ( (P4ClientApi *) p4 )->GCCompact();
+}
+
+static size_t p4_size( const void *p4 )
+{
+    return ( (P4ClientApi *) p4 )->MemSize();
+}
+
+//
+// All stores into the VALUEs held by a P4 object go through the write
+// barrier once SetOwner() has been called, and SetOwner() tells the GC
+// about the ones made before then.
+//
+static const rb_data_type_t p4_type = {
+    "P4",
+    { p4_mark, p4_free, p4_size, p4_compact, { 0 } },
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 static VALUE p4_new( VALUE pClass )
 {
     VALUE  	argv[ 1 ];
     P4ClientApi	*p4 = new P4ClientApi();
     VALUE	self;
 
-    self = Data_Wrap_Struct( pClass, p4_mark, p4_free, p4 );
+    self = TypedData_Wrap_Struct( pClass, &p4_type, p4 );
+    p4->SetOwner( self );
     rb_obj_call_init( self, 0, argv );
     return self;
 }
@@ -107,28 +140,28 @@ static VALUE p4_new( VALUE pClass )
 static VALUE p4_connect( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->Connect();
 }
 
 static VALUE p4_disconnect( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->Disconnect();
 }
 
 static VALUE p4_connected( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->Connected();
 }
 
 static VALUE p4_server_case_sensitive( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     if( p4->ServerCaseSensitive() )
 	return Qtrue;
     return Qfalse;
@@ -137,7 +170,7 @@ static VALUE p4_server_case_sensitive( VALUE self )
 static VALUE p4_server_unicode( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     if( p4->ServerUnicode() )
 	return Qtrue;
     return Qfalse;
@@ -146,7 +179,7 @@ static VALUE p4_server_unicode( VALUE self )
 static VALUE p4_run_tagged( VALUE self, VALUE tagged )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     if( ! rb_block_given_p() )
 	rb_raise( rb_eArgError, "P4#run_tagged requires a block" );
@@ -178,14 +211,14 @@ static VALUE p4_run_tagged( VALUE self, VALUE tagged )
 static VALUE p4_get_tagged( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->IsTagged() ? Qtrue : Qfalse;
 }
 
 static VALUE p4_set_tagged( VALUE self, VALUE toggle )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     // The user might have passed an integer, or it might be a boolean,
     // we convert to int for consistency.
@@ -204,14 +237,14 @@ static VALUE p4_set_tagged( VALUE self, VALUE toggle )
 static VALUE p4_get_api_level( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return INT2NUM( p4->GetApiLevel() );
 }
 
 static VALUE p4_set_api_level( VALUE self, VALUE level )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetApiLevel( NUM2INT( level ) );
     return self;
 }
@@ -222,15 +255,15 @@ static VALUE p4_set_api_level( VALUE self, VALUE level )
 static VALUE p4_get_charset( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr c = p4->GetCharset();
-    return P4Utils::ruby_string( c.Text() );
+    return P4Utils::ruby_string( c );
 }
 
 static VALUE p4_set_charset( VALUE self, VALUE c )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     // p4.charset = nil prior to connect can be used to
     // disable automatic charset detection
@@ -243,23 +276,23 @@ static VALUE p4_set_charset( VALUE self, VALUE c )
 static VALUE p4_get_p4config( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr c = p4->GetConfig();
-    return P4Utils::ruby_string( c.Text() );
+    return P4Utils::ruby_string( c );
 }
 
 static VALUE p4_get_cwd( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr cwd = p4->GetCwd();
-    return P4Utils::ruby_string( cwd.Text() );
+    return P4Utils::ruby_string( cwd );
 }
 
 static VALUE p4_set_cwd( VALUE self, VALUE cwd )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetCwd( StringValuePtr( cwd ) );
     return Qtrue;
 }
@@ -267,15 +300,15 @@ static VALUE p4_set_cwd( VALUE self, VALUE cwd )
 static VALUE p4_get_client( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr client = p4->GetClient();
-    return P4Utils::ruby_string( client.Text() );
+    return P4Utils::ruby_string( client );
 }
 
 static VALUE p4_set_client( VALUE self, VALUE client )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetClient( StringValuePtr( client ) );
     return Qtrue;
 }
@@ -284,7 +317,7 @@ static VALUE p4_get_env( VALUE self, VALUE var )
 {
     P4ClientApi	*p4;
     const char *val;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     val = p4->GetEnv( StringValuePtr( var ) );
     if( !val ) return Qnil;
 
@@ -294,22 +327,22 @@ static VALUE p4_get_env( VALUE self, VALUE var )
 static VALUE p4_set_env( VALUE self, VALUE var, VALUE val )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetEnv( StringValuePtr( var ), StringValuePtr( val ) );
 }
 
 static VALUE p4_get_enviro_file( VALUE self )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     const StrPtr *enviro_file = p4->GetEnviroFile();
-    return P4Utils::ruby_string( enviro_file->Text() );
+    return P4Utils::ruby_string( *enviro_file );
 }
 
 static VALUE p4_set_enviro_file( VALUE self, VALUE rbstr )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetEnviroFile( StringValuePtr(rbstr) );
     return Qtrue;
 }
@@ -318,17 +351,17 @@ static VALUE p4_get_evar( VALUE self, VALUE var )
 {
     P4ClientApi	*p4;
     const StrPtr *val;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     val = p4->GetEVar( StringValuePtr( var ) );
     if( !val ) return Qnil;
 
-    return P4Utils::ruby_string( val->Text() );
+    return P4Utils::ruby_string( *val );
 }
 
 static VALUE p4_set_evar( VALUE self, VALUE var, VALUE val )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetEVar( StringValuePtr( var ), StringValuePtr( val ) );
     return Qtrue;
 }
@@ -336,7 +369,7 @@ static VALUE p4_set_evar( VALUE self, VALUE var, VALUE val )
 static VALUE p4_set_var( VALUE self, VALUE var, VALUE val )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetVar( StringValuePtr( var ), StringValuePtr( val ) );
     return Qtrue;
 }
@@ -344,15 +377,15 @@ static VALUE p4_set_var( VALUE self, VALUE var, VALUE val )
 static VALUE p4_get_host( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr host = p4->GetHost();
-    return P4Utils::ruby_string( host.Text() );
+    return P4Utils::ruby_string( host );
 }
 
 static VALUE p4_set_host( VALUE self, VALUE host )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetHost( StringValuePtr( host ) );
     return Qtrue;
 }
@@ -360,15 +393,15 @@ static VALUE p4_set_host( VALUE self, VALUE host )
 static VALUE p4_get_ignore( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr ignore = p4->GetIgnoreFile();
-    return P4Utils::ruby_string( ignore.Text() );
+    return P4Utils::ruby_string( ignore );
 }
 
 static VALUE p4_set_ignore( VALUE self, VALUE file )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetIgnoreFile( StringValuePtr( file ) );
     return Qtrue;
 }
@@ -376,24 +409,40 @@ static VALUE p4_set_ignore( VALUE self, VALUE file )
 static VALUE p4_is_ignored( VALUE self, VALUE path )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     if( p4->IsIgnored( StringValuePtr( path ) ) )
 	return Qtrue;
     return Qfalse;
 }
 
+static VALUE p4_ignored_paths( VALUE self, VALUE paths )
+{
+    P4ClientApi	*p4;
+    Check_Type( paths, T_ARRAY );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->FilterIgnored( paths, 1 );
+}
+
+static VALUE p4_filter_ignored( VALUE self, VALUE paths )
+{
+    P4ClientApi	*p4;
+    Check_Type( paths, T_ARRAY );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->FilterIgnored( paths, 0 );
+}
+
 static VALUE p4_get_language( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr lang = p4->GetLanguage();
-    return P4Utils::ruby_string( lang.Text() );
+    return P4Utils::ruby_string( lang );
 }
 
 static VALUE p4_set_language( VALUE self, VALUE lang )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetLanguage( StringValuePtr( lang ) );
     return Qtrue;
 }
@@ -401,14 +450,14 @@ static VALUE p4_set_language( VALUE self, VALUE lang )
 static VALUE p4_get_maxresults( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return INT2NUM( p4->GetMaxResults() );
 }
 
 static VALUE p4_set_maxresults( VALUE self, VALUE val )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetMaxResults( NUM2INT( val ) );
     return Qtrue;
 }
@@ -416,14 +465,14 @@ static VALUE p4_set_maxresults( VALUE self, VALUE val )
 static VALUE p4_get_maxscanrows( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return INT2NUM( p4->GetMaxScanRows() );
 }
 
 static VALUE p4_set_maxscanrows( VALUE self, VALUE val )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetMaxScanRows( NUM2INT( val ) );
     return Qtrue;
 }
@@ -431,14 +480,14 @@ static VALUE p4_set_maxscanrows( VALUE self, VALUE val )
 static VALUE p4_get_maxlocktime( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return INT2NUM( p4->GetMaxLockTime() );
 }
 
 static VALUE p4_set_maxlocktime( VALUE self, VALUE val )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetMaxLockTime( NUM2INT( val ) );
     return Qtrue;
 }
@@ -446,15 +495,15 @@ static VALUE p4_set_maxlocktime( VALUE self, VALUE val )
 static VALUE p4_get_password( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr passwd = p4->GetPassword();
-    return P4Utils::ruby_string( passwd.Text() );
+    return P4Utils::ruby_string( passwd );
 }
 
 static VALUE p4_set_password( VALUE self, VALUE passwd )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetPassword( StringValuePtr( passwd ) );
     return Qtrue;
 }
@@ -462,15 +511,15 @@ static VALUE p4_set_password( VALUE self, VALUE passwd )
 static VALUE p4_get_port( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr port = p4->GetPort();
-    return P4Utils::ruby_string( port.Text() );
+    return P4Utils::ruby_string( port );
 }
 
 static VALUE p4_set_port( VALUE self, VALUE port )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     if( p4->Connected() )
 	rb_raise( eP4, "Can't change port once you've connected." );
 
@@ -481,14 +530,14 @@ static VALUE p4_set_port( VALUE self, VALUE port )
 static VALUE p4_get_prog( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
-    return P4Utils::ruby_string( p4->GetProg().Text() );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return P4Utils::ruby_string( p4->GetProg() );
 }
 
 static VALUE p4_set_prog( VALUE self, VALUE prog )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetProg( StringValuePtr( prog ) );
     return Qtrue;
 }
@@ -496,7 +545,7 @@ static VALUE p4_set_prog( VALUE self, VALUE prog )
 static VALUE p4_set_protocol( VALUE self, VALUE var, VALUE val )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetProtocol( StringValuePtr( var ), StringValuePtr( val ) );
     return Qtrue;
 }
@@ -504,14 +553,14 @@ static VALUE p4_set_protocol( VALUE self, VALUE var, VALUE val )
 static VALUE p4_get_ticket_file( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
-    return P4Utils::ruby_string( p4->GetTicketFile().Text() );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return P4Utils::ruby_string( p4->GetTicketFile() );
 }
 
 static VALUE p4_set_ticket_file( VALUE self, VALUE path )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetTicketFile( StringValuePtr( path ) );
     return Qtrue;
 }
@@ -519,14 +568,14 @@ static VALUE p4_set_ticket_file( VALUE self, VALUE path )
 static VALUE p4_get_trust_file( VALUE self )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
-    return P4Utils::ruby_string( p4->GetTrustFile().Text() );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return P4Utils::ruby_string( p4->GetTrustFile() );
 }
 
 static VALUE p4_set_trust_file( VALUE self, VALUE path )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetTrustFile( StringValuePtr( path ) );
     return Qtrue;
 }
@@ -534,15 +583,15 @@ static VALUE p4_set_trust_file( VALUE self, VALUE path )
 static VALUE p4_get_user( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     StrPtr user = p4->GetUser();
-    return P4Utils::ruby_string( user.Text() );
+    return P4Utils::ruby_string( user );
 }
 
 static VALUE p4_set_user( VALUE self, VALUE user )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetUser( StringValuePtr( user ) );
     return Qtrue;
 }
@@ -550,14 +599,14 @@ static VALUE p4_set_user( VALUE self, VALUE user )
 static VALUE p4_get_version( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
-    return P4Utils::ruby_string( p4->GetVersion().Text() );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return P4Utils::ruby_string( p4->GetVersion() );
 }
 
 static VALUE p4_set_version( VALUE self, VALUE version )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetVersion( StringValuePtr( version ) );
     return Qtrue;
 }
@@ -565,14 +614,14 @@ static VALUE p4_set_version( VALUE self, VALUE version )
 static VALUE p4_get_track( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetTrack() ? Qtrue : Qfalse;
 }
 
 static VALUE p4_set_track( VALUE self, VALUE toggle )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     // The user might have passed an integer, or it might be a boolean,
     // we convert to int for consistency.
@@ -591,14 +640,14 @@ static VALUE p4_set_track( VALUE self, VALUE toggle )
 static VALUE p4_get_streams( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->IsStreams() ? Qtrue : Qfalse;
 }
 
 static VALUE p4_set_streams( VALUE self, VALUE toggle )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     // The user might have passed an integer, or it might be a boolean,
     // we convert to int for consistency.
@@ -614,17 +663,32 @@ static VALUE p4_set_streams( VALUE self, VALUE toggle )
     return flag ? Qtrue : Qfalse;	// Seems to be ignored...
 }
 
+static VALUE p4_get_raw_bytes( VALUE self )
+{
+    P4ClientApi *p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->IsRawBytes() ? Qtrue : Qfalse;
+}
+
+static VALUE p4_set_raw_bytes( VALUE self, VALUE toggle )
+{
+    P4ClientApi *p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetRawBytes( RTEST( toggle ) );
+    return toggle;
+}
+
 static VALUE p4_get_graph( VALUE self )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->IsGraph() ? Qtrue : Qfalse;
 }
 
 static VALUE p4_set_graph( VALUE self, VALUE toggle )
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
     // The user might have passed an integer, or it might be a boolean,
     // we convert to int for consistency.
@@ -643,7 +707,7 @@ static VALUE p4_set_graph( VALUE self, VALUE toggle )
 static VALUE p4_set_array_conversion( VALUE self, VALUE toggle )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     int	flag = 1;
 
     if( toggle == Qtrue )
@@ -664,76 +728,379 @@ static VALUE p4_set_array_conversion( VALUE self, VALUE toggle )
 
 static VALUE p4_run( VALUE self, VALUE args )
 {
-    int 	i;
+    long 	i;
     int		argc = 0;
-    ID		idFlatten = rb_intern( "flatten" );
-    ID		idLength = rb_intern( "length" );
-    ID		idTo_S	 = rb_intern( "to_s" );
 
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
 
-    // Flatten the args array, and extract the Perforce command leaving
-    // the remaining args in the array.
-    VALUE flatArgs = rb_funcall( args, idFlatten, 0 );
+    // Flatten the args array, and extract the Perforce command from the
+    // front of it.
+    VALUE flatArgs = P4Utils::flatten( args );
+
+    // A trailing plain hash holds the options. The only one is fields:,
+    // the projection applied to tagged output.
+    VALUE fields = Qnil;
+    long n = RARRAY_LEN( flatArgs );
+    if ( n && rb_obj_class( RARRAY_AREF( flatArgs, n - 1 ) ) == rb_cHash )
+    {
+	VALUE opts = RARRAY_AREF( flatArgs, --n );
+	VALUE key = ID2SYM( rb_intern( "fields" ) );
+	fields = rb_hash_lookup2( opts, key, Qundef );
+	if ( fields == Qundef || RHASH_SIZE( opts ) != 1 )
+	    rb_raise( rb_eArgError, "P4#run only takes the fields: option" );
+	if ( !NIL_P( fields ) )
+	    Check_Type( fields, T_ARRAY );
+    }
 
-    if ( ! NUM2INT( rb_funcall( flatArgs, idLength, 0 ) ) )
+    if ( ! n )
 	rb_raise( eP4, "P4#run requires an argument" );
 
-    VALUE v = rb_funcall( flatArgs, rb_intern( "shift" ), 0 );
+    VALUE v = RARRAY_AREF( flatArgs, 0 );
     char *cmd = StringValuePtr( v );
-    argc = NUM2INT( rb_funcall( flatArgs, idLength, 0 ) );
+    argc = (int)n - 1;
+
+    //
+    // fstat can do the projection itself, so unless a field list is
+    // there already, as -T or -Tfield,..., it's passed on to shrink what
+    // the server sends.
+    //
+    int skip = 0;
+    if ( !NIL_P( fields ) && !strcmp( cmd, "fstat" ) )
+    {
+	skip = 2;
+	for ( i = 1; i < n; i++ )
+	{
+	    VALUE a = RARRAY_AREF( flatArgs, i );
+	    if ( RB_TYPE_P( a, T_STRING ) && RSTRING_LEN( a ) >= 2 &&
+		 !memcmp( RSTRING_PTR( a ), "-T", 2 ) )
+		skip = 0;
+	}
+    }
 
-    // Allocate storage on the stack so it's automatically reclaimed
-    // when we exit.
-    char **p4args = RB_ALLOC_N( char *, argc + 1 );
+    // The argument vector is on the stack, or a Ruby-owned buffer if
+    // it's large, so it's reclaimed however we leave. The converted
+    // strings are kept in an array so the GC sees them until Run is done.
+    VALUE argsBuf;
+    char **p4args = ALLOCV_N( char *, argsBuf, argc + skip + 1 );
+    VALUE strs = rb_ary_new_capa( argc + skip );
+
+    if ( skip )
+    {
+	rb_ary_push( strs, rb_str_new_cstr( "-T" ) );
+	rb_ary_push( strs, rb_ary_join( fields, rb_str_new_cstr( "," ) ) );
+    }
 
     // Copy the args across
     for ( i = 0; i < argc; i++ )
+	rb_ary_push( strs, rb_obj_as_string( RARRAY_AREF( flatArgs, i + 1 ) ) );
+
+    for ( i = 0; i < argc + skip; i++ )
     {
-	VALUE	entry = rb_ary_entry( flatArgs, i );
-	VALUE	v = rb_funcall( entry, idTo_S, 0 );
-	p4args[ i ] = StringValuePtr( v );
+	VALUE s = RARRAY_AREF( strs, i );
+	p4args[ i ] = StringValuePtr( s );
     }
     p4args[ i ] = 0;
 
     // Run the command
-    VALUE res =  p4->Run( cmd, argc, p4args );
+    VALUE res =  p4->Run( cmd, argc + skip, p4args, 0, fields );
+    ALLOCV_END( argsBuf );
+    RB_GC_GUARD( strs );
+    RB_GC_GUARD( v );
     return res;
 }
 
+/*******************************************************************************
+ * Prepared commands
+ ******************************************************************************/
+static void p4prep_free( void *p )
+{
+    delete (P4Prepared *) p;
+}
+
+static void p4prep_mark( void *p )
+{
+    ( (P4Prepared *) p )->GCMark();
+}
+
+static void p4prep_compact( void *p )
+{
+    ( (P4Prepared *) p )->GCCompact();
+}
+
+static size_t p4prep_size( const void *p )
+{
+    return ( (P4Prepared *) p )->MemSize();
+}
+
+static const rb_data_type_t p4prep_type = {
+    "P4::PreparedCommand",
+    { p4prep_mark, p4prep_free, p4prep_size, p4prep_compact, { 0 } },
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
+static VALUE p4_prepare( VALUE self, VALUE args )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+
+    if ( ! RARRAY_LEN( args ) )
+	rb_raise( eP4, "P4#prepare requires a command" );
+
+    VALUE cmd = rb_ary_entry( args, 0 );
+    VALUE rest = rb_ary_subseq( args, 1, RARRAY_LEN( args ) - 1 );
+
+    P4Prepared *p = new P4Prepared( self, p4, cmd, rest );
+    VALUE prep = TypedData_Wrap_Struct( cP4Prepared, &p4prep_type, p );
+    p->SetSelf( prep );
+    return prep;
+}
+
+static VALUE p4prep_call( VALUE self, VALUE args )
+{
+    P4Prepared	*p;
+    TypedData_Get_Struct( self, P4Prepared, &p4prep_type, p );
+    return p->Call( args );
+}
+
+static VALUE p4prep_stream( int argc, VALUE *argv, VALUE self )
+{
+    P4Prepared	*p;
+    VALUE	source, count, bytes;
+    TypedData_Get_Struct( self, P4Prepared, &p4prep_type, p );
+
+    rb_scan_args( argc, argv, "12", &source, &count, &bytes );
+    return p->Stream( source,
+	NIL_P( count ) ? P4Prepared::BATCH_COUNT : NUM2LONG( count ),
+	NIL_P( bytes ) ? P4Prepared::BATCH_BYTES : NUM2LONG( bytes ) );
+}
+
+static VALUE p4prep_command( VALUE self )
+{
+    P4Prepared	*p;
+    TypedData_Get_Struct( self, P4Prepared, &p4prep_type, p );
+    return p->GetCommand();
+}
+
+static VALUE p4prep_args( VALUE self )
+{
+    P4Prepared	*p;
+    TypedData_Get_Struct( self, P4Prepared, &p4prep_type, p );
+    return p->GetArgs();
+}
+
 static VALUE p4_set_input( VALUE self, VALUE input )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetInput( input );
 }
 
+static VALUE p4_get_query_cache( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetQueryCache();
+}
+
+static VALUE p4_set_query_cache( VALUE self, VALUE dir )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetQueryCache( NIL_P( dir ) ? 0 : StringValueCStr( dir ) );
+    return dir;
+}
+
+static VALUE p4_get_query_cache_limit( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return LL2NUM( p4->GetQueryCacheLimit() );
+}
+
+static VALUE p4_set_query_cache_limit( VALUE self, VALUE bytes )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetQueryCacheLimit( NUM2LL( bytes ) );
+    return bytes;
+}
+
+static VALUE p4_query_cache_stats( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetQueryCacheStats();
+}
+
+static VALUE p4_get_print_store( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetPrintStore();
+}
+
+static VALUE p4_set_print_store( VALUE self, VALUE dir )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetPrintStore( NIL_P( dir ) ? 0 : StringValueCStr( dir ) );
+    return dir;
+}
+
+static VALUE p4_print_store_stats( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetPrintStoreStats();
+}
+
+static VALUE p4_get_capture( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetCapture();
+}
+
+static VALUE p4_set_capture( VALUE self, VALUE path )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    const char *p = NIL_P( path ) ? 0 : StringValueCStr( path );
+    if( !p4->SetCapture( p ) )
+	rb_sys_fail( p );
+    return path;
+}
+
+static VALUE p4_replay( VALUE self, VALUE path )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->Replay( StringValueCStr( path ) );
+}
+
+static VALUE p4_export_start( VALUE self, VALUE io, VALUE format, VALUE fields,
+		VALUE raw )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+
+    int f;
+    if( format == ID2SYM( rb_intern( "ndjson" ) ) )
+	f = P4Export::NDJSON;
+    else if( format == ID2SYM( rb_intern( "csv" ) ) )
+	f = P4Export::CSV;
+    else
+	rb_raise( rb_eArgError, "Unknown export format: %" PRIsVALUE,
+		rb_inspect( format ) );
+
+    if( !NIL_P( fields ) )
+	Check_Type( fields, T_ARRAY );
+
+    p4->StartExport( io, f, fields, RTEST( raw ) );
+    return Qnil;
+}
+
+static VALUE p4_export_finish( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return LL2NUM( p4->FinishExport() );
+}
+
+static VALUE p4_print_cached( VALUE self, VALUE args )
+{
+    long	i;
+    int		argc;
+
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+
+    VALUE flatArgs = P4Utils::flatten( args );
+    argc = (int)RARRAY_LEN( flatArgs );
+
+    // As for P4#run
+    VALUE argsBuf;
+    char **p4args = ALLOCV_N( char *, argsBuf, argc + 1 );
+    VALUE strs = rb_ary_new_capa( argc );
+
+    for ( i = 0; i < argc; i++ )
+    {
+	VALUE s = rb_obj_as_string( RARRAY_AREF( flatArgs, i ) );
+	rb_ary_push( strs, s );
+	p4args[ i ] = StringValuePtr( s );
+    }
+    p4args[ i ] = 0;
+
+    VALUE res = p4->PrintCached( argc, p4args );
+    ALLOCV_END( argsBuf );
+    RB_GC_GUARD( strs );
+    return res;
+}
+
+static VALUE p4_set_resolve_rules( VALUE self, VALUE rules )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->SetResolveRules( rules );
+}
+
 static VALUE p4_get_errors( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetErrors();
 }
 
 static VALUE p4_get_messages( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetMessages();
 }
 
 static VALUE p4_get_warnings( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetWarnings();
 }
 
+static VALUE p4_get_suppressed_messages( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetSuppressedMessages();
+}
+
+static VALUE p4_set_suppressed_messages( VALUE self, VALUE ids )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetSuppressedMessages( ids );
+    return ids;
+}
+
+static VALUE p4_get_reuse_results( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetReuseResults() ? Qtrue : Qfalse;
+}
+
+static VALUE p4_set_reuse_results( VALUE self, VALUE reuse )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    p4->SetReuseResults( RTEST( reuse ) );
+    return reuse;
+}
+
 static VALUE p4_set_except_level( VALUE self, VALUE level )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->ExceptionLevel( NUM2INT(level) );
     return level;
 }
@@ -741,14 +1108,14 @@ static VALUE p4_set_except_level( VALUE self, VALUE level )
 static VALUE p4_get_except_level( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return INT2NUM( p4->ExceptionLevel() );
 }
 
 static VALUE p4_get_server_level( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     int level = p4->GetServerLevel();
     return INT2NUM( level );
 }
@@ -760,7 +1127,7 @@ static VALUE p4_parse_spec( VALUE self, VALUE type, VALUE form )
     Check_Type( form, T_STRING );
     Check_Type( type, T_STRING );
 
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->ParseSpec( StringValuePtr(type), StringValuePtr(form) );
 }
 
@@ -771,17 +1138,107 @@ static VALUE p4_format_spec( VALUE self, VALUE type, VALUE hash )
     Check_Type( type, T_STRING );
     Check_Type( hash, T_HASH );
 
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->FormatSpec( StringValuePtr(type), hash );
 }
 
+static VALUE p4_parse_specs( VALUE self, VALUE type, VALUE forms )
+{
+    P4ClientApi	*p4;
+
+    Check_Type( type, T_STRING );
+    Check_Type( forms, T_ARRAY );
+
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->ParseSpecs( StringValuePtr(type), forms );
+}
+
+static VALUE p4_format_specs( VALUE self, VALUE type, VALUE hashes )
+{
+    P4ClientApi	*p4;
+
+    Check_Type( type, T_STRING );
+    Check_Type( hashes, T_ARRAY );
+
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->FormatSpecs( StringValuePtr(type), hashes );
+}
+
 static VALUE p4_track_output( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetTrackOutput();
 }
 
+static VALUE p4_track_data( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetTrackData();
+}
+
+/*******************************************************************************
+ * Process-wide metrics
+ ******************************************************************************/
+static VALUE p4_metrics( VALUE self )
+{
+    return P4Metrics::Snapshot();
+}
+
+static VALUE p4_metrics_text( VALUE self )
+{
+    return P4Metrics::Prometheus();
+}
+
+static VALUE p4_reset_metrics( VALUE self )
+{
+    P4Metrics::Reset();
+    return Qtrue;
+}
+
+/*******************************************************************************
+ * Event tracing
+ ******************************************************************************/
+static VALUE p4_trace_start( int argc, VALUE *argv, VALUE self )
+{
+    VALUE capacity;
+    rb_scan_args( argc, argv, "01", &capacity );
+    P4Trace::Start( NIL_P( capacity ) ? 65536 : NUM2LONG( capacity ) );
+    return Qtrue;
+}
+
+static VALUE p4_trace_stop( VALUE self )
+{
+    P4Trace::Stop();
+    return Qtrue;
+}
+
+static VALUE p4_trace_p( VALUE self )
+{
+    return P4Trace::On() ? Qtrue : Qfalse;
+}
+
+static VALUE p4_trace_dump( VALUE self, VALUE path )
+{
+    long n = P4Trace::Dump( StringValuePtr( path ) );
+    if( n < 0 )
+	rb_raise( eP4, "Unable to write trace to %s", StringValuePtr( path ) );
+    return LONG2NUM( n );
+}
+
+static VALUE p4_get_trace_file( VALUE self )
+{
+    const char *f = P4Trace::GetDumpFile();
+    return f ? P4Utils::ruby_string( f ) : Qnil;
+}
+
+static VALUE p4_set_trace_file( VALUE self, VALUE path )
+{
+    P4Trace::SetDumpFile( NIL_P( path ) ? 0 : StringValuePtr( path ) );
+    return Qtrue;
+}
+
 /*******************************************************************************
  * Self identification
  ******************************************************************************/
@@ -796,7 +1253,7 @@ static VALUE p4_identify( VALUE self )
     s.Append(P4API_PATCHLEVEL_STRING);
     s.Append(" WITH_LIBS ");
     s.Append(WITH_LIBS);
-    return P4Utils::ruby_string( s.Text() );
+    return P4Utils::ruby_string( s );
 }
 
 /*******************************************************************************
@@ -805,14 +1262,14 @@ static VALUE p4_identify( VALUE self )
 static VALUE p4_get_debug( VALUE self)
 {
     P4ClientApi *p4;
-    Data_Get_Struct( self, P4ClientApi, p4);
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4);
     return INT2NUM( p4->GetDebug() );
 }
 
 static VALUE p4_set_debug( VALUE self, VALUE debug )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetDebug( NUM2INT(debug) );
     return Qtrue;
 }
@@ -823,97 +1280,147 @@ static VALUE p4_set_debug( VALUE self, VALUE debug )
 static VALUE p4_get_handler( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetHandler();
 }
 
 static VALUE p4_set_handler( VALUE self, VALUE handler )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetHandler( handler );
     return Qtrue;
 }
 
+static VALUE p4_last_command_stats( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetLastCommandStats();
+}
+
 /*******************************************************************************
  * Progress support
  ******************************************************************************/
 static VALUE p4_get_progress( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetProgress();
 }
 
 static VALUE p4_set_progress( VALUE self, VALUE progress )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetProgress( progress );
 }
 
+static VALUE p4_get_progress_interval( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return rb_float_new( p4->GetProgressInterval() );
+}
+
+static VALUE p4_set_progress_interval( VALUE self, VALUE interval )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    double i = NUM2DBL( interval );
+    if( i < 0 )
+	rb_raise( eP4, "Progress interval must not be negative" );
+    p4->SetProgressInterval( i );
+    return Qtrue;
+}
+
+static VALUE p4_get_progress_step( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return INT2NUM( p4->GetProgressStep() );
+}
+
+static VALUE p4_set_progress_step( VALUE self, VALUE step )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    int s = NUM2INT( step );
+    if( s < 0 || s > 100 )
+	rb_raise( eP4, "Progress step must be a percentage from 0 to 100" );
+    p4->SetProgressStep( s );
+    return Qtrue;
+}
+
+static VALUE p4_get_progress_totals( VALUE self )
+{
+    P4ClientApi	*p4;
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
+    return p4->GetProgressTotals();
+}
+
 /*******************************************************************************
  * SSO handler support
  ******************************************************************************/
 static VALUE p4_get_enabled_sso( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetEnableSSO();
 }
 
 static VALUE p4_set_enable_sso( VALUE self, VALUE enable )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetEnableSSO( enable );
 }
 
 static VALUE p4_get_sso_vars( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetSSOVars();
 }
 
 static VALUE p4_get_sso_passresult( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetSSOPassResult();
 }
 
 static VALUE p4_set_sso_passresult( VALUE self, VALUE result )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetSSOPassResult( result );
 }
 
 static VALUE p4_get_sso_failresult( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetSSOFailResult();
 }
 
 static VALUE p4_set_sso_failresult( VALUE self, VALUE result )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->SetSSOFailResult( result );
 }
 static VALUE p4_get_ssohandler( VALUE self )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     return p4->GetSSOHandler();
 }
 
 static VALUE p4_set_ssohandler( VALUE self, VALUE handler )
 {
     P4ClientApi	*p4;
-    Data_Get_Struct( self, P4ClientApi, p4 );
+    TypedData_Get_Struct( self, P4ClientApi, &p4_type, p4 );
     p4->SetSSOHandler( handler );
     return Qtrue;
 }
@@ -925,70 +1432,70 @@ static VALUE p4_set_ssohandler( VALUE self, VALUE handler )
 static VALUE p4md_getyourname( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetYourName();
 }
 
 static VALUE p4md_gettheirname( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetTheirName();
 }
 
 static VALUE p4md_getbasename( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetBaseName();
 }
 
 static VALUE p4md_getyourpath( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetYourPath();
 }
 
 static VALUE p4md_gettheirpath( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetTheirPath();
 }
 
 static VALUE p4md_getbasepath( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetBasePath();
 }
 
 static VALUE p4md_getresultpath( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetResultPath();
 }
 
 static VALUE p4md_getmergehint( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->GetMergeHint();
 }
 
 static VALUE p4md_runmerge( VALUE self )
 {
     P4MergeData	*md = 0;
-    Data_Get_Struct( self, P4MergeData, md );
+    TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
     return md->RunMergeTool();
 }
 
 static VALUE p4md_getcontentresolve( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetContentResolveStatus();
 }
 
@@ -998,49 +1505,49 @@ static VALUE p4md_getcontentresolve( VALUE self )
 static VALUE p4md_getactionresolve( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetActionResolveStatus();
 }
 
 static VALUE p4md_getyoursaction( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetYoursAction();
 }
 
 static VALUE p4md_gettheiraction( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetTheirAction();
 }
 
 static VALUE p4md_getmergeaction( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetMergeAction();
 }
 
 static VALUE p4md_getactiontype( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetType();
 }
 
 static VALUE p4md_getinfo( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetMergeInfo();
 }
 
 static VALUE p4md_invalidate( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	md->Invalidate();
 	return self;
 }
@@ -1048,17 +1555,31 @@ static VALUE p4md_invalidate( VALUE self )
 static VALUE p4md_tos( VALUE self )
 {
 	P4MergeData *md = 0;
-	Data_Get_Struct( self, P4MergeData, md );
+	TypedData_Get_Struct( self, P4MergeData, &P4MergeData::dataType, md );
 	return md->GetString();
 }
 /******************************************************************************
  * P4::Map class
  ******************************************************************************/
-static void p4map_free( P4MapMaker *m )
+static void p4map_free( void *m )
+{
+    delete (P4MapMaker *) m;
+}
+
+static size_t p4map_size( const void *m )
 {
-    delete m;
+    return ( (P4MapMaker *) m )->MemSize();
 }
 
+// Maps hold no Ruby objects, so they're trivially write barrier
+// protected and have nothing to mark or move
+static const rb_data_type_t p4map_type = {
+    "P4::Map",
+    { 0, p4map_free, p4map_size, 0, { 0 } },
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 static VALUE p4map_new( int argc, VALUE *argv, VALUE pClass )
 {
     //VALUE 	pClass;
@@ -1070,7 +1591,7 @@ static VALUE p4map_new( int argc, VALUE *argv, VALUE pClass )
     // pClass = argv[ 0 ];
 
     // Now instantiate the new object.
-    self = Data_Wrap_Struct( pClass, 0, p4map_free, m );
+    self = TypedData_Wrap_Struct( pClass, &p4map_type, m );
     rb_obj_call_init( self, 0, argv );
 
     if( argc )
@@ -1108,13 +1629,13 @@ static VALUE p4map_join( VALUE pClass, VALUE left, VALUE right )
     VALUE 	m;
     VALUE  	argv[ 1 ];
 
-    Data_Get_Struct( left,  P4MapMaker, l );
-    Data_Get_Struct( right, P4MapMaker, r );
+    TypedData_Get_Struct( left,  P4MapMaker, &p4map_type, l );
+    TypedData_Get_Struct( right, P4MapMaker, &p4map_type, r );
 
     j = P4MapMaker::Join( l, r );
     if( !j ) return Qnil;
 
-    m = Data_Wrap_Struct( pClass, 0, p4map_free, j );
+    m = TypedData_Wrap_Struct( pClass, &p4map_type, j );
     rb_obj_call_init( m, 0, argv );
     return m;
 }
@@ -1132,12 +1653,12 @@ static VALUE p4map_inspect( VALUE self )
     sprintf( tb.Text(), "%p", (void*) self );
     tb.SetLength();
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
 
     b << "#<P4::Map:" << tb << "> ";
 
     m->Inspect( b );
-    return P4Utils::ruby_string( b.Text(), b.Length() );
+    return P4Utils::ruby_string( b );
 }
 
 //
@@ -1150,7 +1671,7 @@ static VALUE p4map_insert( int argc, VALUE *argv, VALUE self )
     P4MapMaker *	m = 0;
     StrBuf	t;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
 
     if( argc < 1 || argc > 2 )
 	rb_raise( rb_eArgError, "P4::Map#insert takes 1, or 2 arguments" );
@@ -1180,7 +1701,7 @@ static VALUE p4map_clear( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     m->Clear();
     return Qtrue;
 }
@@ -1189,7 +1710,7 @@ static VALUE p4map_count( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return INT2NUM( m->Count() );
 }
 
@@ -1197,7 +1718,7 @@ static VALUE p4map_empty( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return m->Count() ? Qfalse : Qtrue;
 }
 
@@ -1208,11 +1729,11 @@ static VALUE p4map_reverse( VALUE self )
     VALUE		rval;
     VALUE  		argv[ 1 ];
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     m2 = new P4MapMaker( *m );
     m2->Reverse();
 
-    rval = Data_Wrap_Struct( cP4Map, 0, p4map_free, m2 );
+    rval = TypedData_Wrap_Struct( cP4Map, &p4map_type, m2 );
     rb_obj_call_init( rval, 0, argv );
     return rval;
 }
@@ -1239,7 +1760,7 @@ static VALUE p4map_trans( int argc, VALUE *argv, VALUE self )
     if( argc && *argv == Qfalse )
 	fwd = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return m->Translate( string, fwd );
 }
 
@@ -1247,7 +1768,7 @@ static VALUE p4map_includes( VALUE self, VALUE string )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     if( m->Translate( string, 1 ) != Qnil )
 	return Qtrue;
     if( m->Translate( string, 0 ) != Qnil )
@@ -1259,7 +1780,7 @@ static VALUE p4map_lhs( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return m->Lhs();
 }
 
@@ -1267,7 +1788,7 @@ static VALUE p4map_rhs( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return m->Rhs();
 }
 
@@ -1275,7 +1796,7 @@ static VALUE p4map_to_a( VALUE self )
 {
     P4MapMaker *	m = 0;
 
-    Data_Get_Struct( self, P4MapMaker, m );
+    TypedData_Get_Struct( self, P4MapMaker, &p4map_type, m );
     return m->ToA();
 }
 
@@ -1286,7 +1807,7 @@ static VALUE p4msg_get_severity( VALUE self )
 {
     P4Error *	e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->GetSeverity();
 }
 
@@ -1294,7 +1815,7 @@ static VALUE p4msg_get_generic( VALUE self )
 {
     P4Error *	e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->GetGeneric();
 }
 
@@ -1302,7 +1823,7 @@ static VALUE p4msg_get_text( VALUE self )
 {
     P4Error *	e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->GetText();
 }
 
@@ -1310,7 +1831,7 @@ static VALUE p4msg_get_dict( VALUE self )
 {
     P4Error *   e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->GetDict();
 }
 
@@ -1318,14 +1839,14 @@ static VALUE p4msg_get_id( VALUE self )
 {
     P4Error *	e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->GetId();
 }
 static VALUE p4msg_inspect( VALUE self )
 {
     P4Error *	e = 0;
 
-    Data_Get_Struct( self, P4Error, e );
+    TypedData_Get_Struct( self, P4Error, &P4Error::dataType, e );
     return e->Inspect();
 }
 
@@ -1336,6 +1857,12 @@ static VALUE p4msg_inspect( VALUE self )
 
 void	Init_P4()
 {
+    // Safe to use from any Ractor. The string settings P4Utils keeps are
+    // per Ractor, and the one shared result is frozen.
+    rb_ext_ractor_safe( true );
+    P4Utils::Init();
+    P4Result::Init();
+
     // Ruby instantiation
     eP4 = rb_define_class( "P4Exception", rb_eRuntimeError );
 
@@ -1358,6 +1885,8 @@ void	Init_P4()
     rb_define_method( cP4, "track=", 	RUBY_METHOD_FUNC(p4_set_track)   , 1 );
     rb_define_method( cP4, "graph?",  RUBY_METHOD_FUNC(p4_get_graph) , 0 );
     rb_define_method( cP4, "graph=",  RUBY_METHOD_FUNC(p4_set_graph) , 1 );
+    rb_define_method( cP4, "raw_bytes?", RUBY_METHOD_FUNC(p4_get_raw_bytes), 0 );
+    rb_define_method( cP4, "raw_bytes=", RUBY_METHOD_FUNC(p4_set_raw_bytes), 1 );
 
 
     // Perforce client settings.
@@ -1380,6 +1909,8 @@ void	Init_P4()
     rb_define_method( cP4, "ignore_file",RUBY_METHOD_FUNC(p4_get_ignore) , 0 );
     rb_define_method( cP4, "ignore_file=",RUBY_METHOD_FUNC(p4_set_ignore), 1 );
     rb_define_method( cP4, "ignored?",  RUBY_METHOD_FUNC(p4_is_ignored)  , 1 );
+    rb_define_method( cP4, "ignored_paths", RUBY_METHOD_FUNC(p4_ignored_paths), 1 );
+    rb_define_method( cP4, "filter_ignored", RUBY_METHOD_FUNC(p4_filter_ignored), 1 );
     rb_define_method( cP4, "language",  RUBY_METHOD_FUNC(p4_get_language), 0 );
     rb_define_method( cP4, "language=", RUBY_METHOD_FUNC(p4_set_language), 1 );
     rb_define_method( cP4, "p4config_file",RUBY_METHOD_FUNC(p4_get_p4config),0);
@@ -1415,28 +1946,67 @@ void	Init_P4()
     // Running commands - general purpose commands
     rb_define_method( cP4, "run", 	RUBY_METHOD_FUNC(p4_run)         ,-2 );
     rb_define_method( cP4, "input=", 	RUBY_METHOD_FUNC(p4_set_input)   , 1 );
+    rb_define_method( cP4, "resolve_rules=", RUBY_METHOD_FUNC(p4_set_resolve_rules), 1 );
+    rb_define_method( cP4, "query_cache", RUBY_METHOD_FUNC(p4_get_query_cache), 0 );
+    rb_define_method( cP4, "query_cache=", RUBY_METHOD_FUNC(p4_set_query_cache), 1 );
+    rb_define_method( cP4, "query_cache_limit", RUBY_METHOD_FUNC(p4_get_query_cache_limit), 0 );
+    rb_define_method( cP4, "query_cache_limit=", RUBY_METHOD_FUNC(p4_set_query_cache_limit), 1 );
+    rb_define_method( cP4, "query_cache_stats", RUBY_METHOD_FUNC(p4_query_cache_stats), 0 );
+    rb_define_method( cP4, "print_store", RUBY_METHOD_FUNC(p4_get_print_store), 0 );
+    rb_define_method( cP4, "print_store=", RUBY_METHOD_FUNC(p4_set_print_store), 1 );
+    rb_define_method( cP4, "print_store_stats", RUBY_METHOD_FUNC(p4_print_store_stats), 0 );
+    rb_define_method( cP4, "print_cached", RUBY_METHOD_FUNC(p4_print_cached), -2 );
+    rb_define_method( cP4, "capture", RUBY_METHOD_FUNC(p4_get_capture), 0 );
+    rb_define_method( cP4, "capture=", RUBY_METHOD_FUNC(p4_set_capture), 1 );
+    rb_define_method( cP4, "replay", RUBY_METHOD_FUNC(p4_replay), 1 );
+    rb_define_private_method( cP4, "export_start", RUBY_METHOD_FUNC(p4_export_start), 4 );
+    rb_define_private_method( cP4, "export_finish", RUBY_METHOD_FUNC(p4_export_finish), 0 );
+    rb_define_method( cP4, "prepare",	RUBY_METHOD_FUNC(p4_prepare)     ,-2 );
     rb_define_method( cP4, "errors", 	RUBY_METHOD_FUNC(p4_get_errors)  , 0 );
     rb_define_method( cP4, "messages",	RUBY_METHOD_FUNC(p4_get_messages), 0 );
     rb_define_method( cP4, "warnings",	RUBY_METHOD_FUNC(p4_get_warnings), 0 );
+    rb_define_method( cP4, "suppressed_messages", RUBY_METHOD_FUNC(p4_get_suppressed_messages), 0 );
+    rb_define_method( cP4, "suppressed_messages=", RUBY_METHOD_FUNC(p4_set_suppressed_messages), 1 );
+    rb_define_method( cP4, "reuse_results?", RUBY_METHOD_FUNC(p4_get_reuse_results), 0 );
+    rb_define_method( cP4, "reuse_results=", RUBY_METHOD_FUNC(p4_set_reuse_results), 1 );
     rb_define_method( cP4, "exception_level", RUBY_METHOD_FUNC(p4_get_except_level), 0 );
     rb_define_method( cP4, "exception_level=", RUBY_METHOD_FUNC(p4_set_except_level), 1 );
     rb_define_method( cP4, "server_level", RUBY_METHOD_FUNC(p4_get_server_level), 0 );
     rb_define_method( cP4, "server_case_sensitive?", RUBY_METHOD_FUNC(p4_server_case_sensitive), 0 );
     rb_define_method( cP4, "track_output",	RUBY_METHOD_FUNC(p4_track_output), 0 );
+    rb_define_method( cP4, "track_data",	RUBY_METHOD_FUNC(p4_track_data), 0 );
+    rb_define_method( cP4, "last_command_stats", RUBY_METHOD_FUNC(p4_last_command_stats), 0 );
 
     rb_define_method( cP4, "server_unicode?", RUBY_METHOD_FUNC(p4_server_unicode), 0 );
 
     // Spec parsing
     rb_define_method( cP4, "parse_spec", RUBY_METHOD_FUNC(p4_parse_spec), 2 );
     rb_define_method( cP4, "format_spec", RUBY_METHOD_FUNC(p4_format_spec), 2 );
+    rb_define_method( cP4, "parse_specs", RUBY_METHOD_FUNC(p4_parse_specs), 2 );
+    rb_define_method( cP4, "format_specs", RUBY_METHOD_FUNC(p4_format_specs), 2 );
     rb_define_method( cP4, "set_array_conversion=", RUBY_METHOD_FUNC(p4_set_array_conversion), 1 );
 
-    // Identification
-    rb_define_const( cP4, "P4API_VERSION", P4Utils::ruby_string(P4APIVER_STRING));
+    // Identification. Frozen, so other Ractors can read them.
+    rb_define_const( cP4, "P4API_VERSION",
+		rb_obj_freeze( P4Utils::ruby_string(P4APIVER_STRING) ) );
     rb_define_const( cP4, "P4API_PATCHLEVEL", INT2NUM(P4API_PATCHLEVEL));
-    rb_define_const( cP4, "P4RUBY_VERSION", P4Utils::ruby_string(P4RUBY_VERSION) );
+    rb_define_const( cP4, "P4RUBY_VERSION",
+		rb_obj_freeze( P4Utils::ruby_string(P4RUBY_VERSION) ) );
     rb_define_singleton_method( cP4, "identify", RUBY_METHOD_FUNC(p4_identify), 0 );
 
+    // Process-wide metrics
+    rb_define_singleton_method( cP4, "metrics", RUBY_METHOD_FUNC(p4_metrics), 0 );
+    rb_define_singleton_method( cP4, "metrics_text", RUBY_METHOD_FUNC(p4_metrics_text), 0 );
+    rb_define_singleton_method( cP4, "reset_metrics", RUBY_METHOD_FUNC(p4_reset_metrics), 0 );
+
+    // Event tracing
+    rb_define_singleton_method( cP4, "trace_start", RUBY_METHOD_FUNC(p4_trace_start), -1 );
+    rb_define_singleton_method( cP4, "trace_stop", RUBY_METHOD_FUNC(p4_trace_stop), 0 );
+    rb_define_singleton_method( cP4, "trace?", RUBY_METHOD_FUNC(p4_trace_p), 0 );
+    rb_define_singleton_method( cP4, "trace_dump", RUBY_METHOD_FUNC(p4_trace_dump), 1 );
+    rb_define_singleton_method( cP4, "trace_file", RUBY_METHOD_FUNC(p4_get_trace_file), 0 );
+    rb_define_singleton_method( cP4, "trace_file=", RUBY_METHOD_FUNC(p4_set_trace_file), 1 );
+
     // Debugging support
     rb_define_method( cP4, "debug", RUBY_METHOD_FUNC(p4_get_debug), 0);
     rb_define_method( cP4, "debug=", RUBY_METHOD_FUNC(p4_set_debug), 1 );
@@ -1448,6 +2018,11 @@ void	Init_P4()
     // Support for Progress API
     rb_define_method( cP4, "progress", RUBY_METHOD_FUNC(p4_get_progress), 0);
     rb_define_method( cP4, "progress=", RUBY_METHOD_FUNC(p4_set_progress), 1);
+    rb_define_method( cP4, "progress_interval", RUBY_METHOD_FUNC(p4_get_progress_interval), 0);
+    rb_define_method( cP4, "progress_interval=", RUBY_METHOD_FUNC(p4_set_progress_interval), 1);
+    rb_define_method( cP4, "progress_step", RUBY_METHOD_FUNC(p4_get_progress_step), 0);
+    rb_define_method( cP4, "progress_step=", RUBY_METHOD_FUNC(p4_set_progress_step), 1);
+    rb_define_method( cP4, "progress_totals", RUBY_METHOD_FUNC(p4_get_progress_totals), 0);
 
     // SSO handling
     rb_define_method( cP4, "loginsso", RUBY_METHOD_FUNC(p4_get_enabled_sso), 0);
@@ -1509,8 +2084,22 @@ void	Init_P4()
     rb_define_method( cP4Msg, "dictionary", RUBY_METHOD_FUNC(p4msg_get_dict), 0);
     rb_define_method( cP4Msg, "to_s", RUBY_METHOD_FUNC(p4msg_get_text), 0);
 
+    // P4::PreparedCommand class. Only made by P4#prepare.
+    cP4Prepared = rb_define_class_under( cP4, "PreparedCommand", rb_cObject );
+    rb_undef_alloc_func( cP4Prepared );
+    rb_define_method( cP4Prepared, "call", RUBY_METHOD_FUNC(p4prep_call), -2 );
+    rb_define_method( cP4Prepared, "stream", RUBY_METHOD_FUNC(p4prep_stream), -1 );
+    rb_define_method( cP4Prepared, "command", RUBY_METHOD_FUNC(p4prep_command), 0 );
+    rb_define_method( cP4Prepared, "args", RUBY_METHOD_FUNC(p4prep_args), 0 );
+
     //	P4::Progress class.
     cP4Prog = rb_define_class_under( cP4, "Progress", rb_cObject );
+
+    // Classes lib/P4.rb fills in. Defined here so we hold them from the
+    // start rather than looking them up by name for every command.
+    cP4Spec = rb_define_class_under( cP4, "Spec", rb_cHash );
+    cP4OH = rb_define_class_under( cP4, "OutputHandler", rb_cObject );
+    cP4SSO = rb_define_class_under( cP4, "SSOHandler", rb_cObject );
     
     rb_undef_alloc_func(cP4);
     rb_undef_alloc_func(cP4MD);
@@ -0,0 +1,294 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4capture.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Capture of the output callbacks of commands to a file,
+ * 		  for replay without a server.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "p4capture.h"
+
+static const char	MAGIC[ 8 ] = { 'P','4','C','A','P','T','R', 0 };
+
+// Record types
+enum {
+    R_COMMAND	= 'C',
+    R_STAT	= 'S',
+    R_TEXT	= 'T',
+    R_BINARY	= 'B',
+    R_MESSAGE	= 'M',
+    R_END	= 'E'
+};
+
+P4Capture::P4Capture()
+{
+    fp = 0;
+}
+
+P4Capture::~P4Capture()
+{
+    Close();
+}
+
+int
+P4Capture::Open( const char *path )
+{
+    Close();
+    fp = fopen( path, "wb" );
+    if( !fp )
+	return 0;
+
+    file.Set( path );
+    fwrite( MAGIC, 1, sizeof( MAGIC ), fp );
+    Put32( VERSION );
+    return 1;
+}
+
+void
+P4Capture::Close()
+{
+    if( fp )
+	fclose( fp );
+    fp = 0;
+    file.Clear();
+}
+
+void
+P4Capture::Put32( unsigned int v )
+{
+    fwrite( &v, 4, 1, fp );
+}
+
+void
+P4Capture::Put( const char *data, int length )
+{
+    Put32( length );
+    fwrite( data, 1, length, fp );
+}
+
+void
+P4Capture::Begin( const char *cmd, int argc, char * const *argv )
+{
+    putc( R_COMMAND, fp );
+    Put32( argc + 1 );
+    Put( cmd, strlen( cmd ) );
+    for( int i = 0; i < argc; i++ )
+	Put( argv[ i ], strlen( argv[ i ] ) );
+}
+
+void
+P4Capture::Stat( StrDict *values )
+{
+    StrRef var, val;
+    int n = 0;
+    while( values->GetVar( n, var, val ) )
+	n++;
+
+    putc( R_STAT, fp );
+    Put32( n );
+    for( int i = 0; i < n; i++ )
+    {
+	values->GetVar( i, var, val );
+	Put( var.Text(), var.Length() );
+	Put( val.Text(), val.Length() );
+    }
+}
+
+void
+P4Capture::Text( const char *data, int length )
+{
+    putc( R_TEXT, fp );
+    Put( data, length );
+}
+
+void
+P4Capture::Binary( const char *data, int length )
+{
+    putc( R_BINARY, fp );
+    Put( data, length );
+}
+
+void
+P4Capture::Message( Error *e )
+{
+    StrBuf m;
+    e->Marshall2( m );
+    putc( R_MESSAGE, fp );
+    Put( m.Text(), m.Length() );
+}
+
+void
+P4Capture::End()
+{
+    putc( R_END, fp );
+    fflush( fp );
+}
+
+P4CaptureReader::P4CaptureReader()
+{
+    p = end = 0;
+    pending = 0;
+}
+
+int
+P4CaptureReader::Load( const char *path )
+{
+    FILE *f = fopen( path, "rb" );
+    if( !f )
+	return 0;
+
+    char buf[ 65536 ];
+    size_t n;
+    data.clear();
+    while( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
+	data.append( buf, n );
+    fclose( f );
+
+    p = data.data();
+    end = p + data.size();
+    pending = 0;
+
+    unsigned int v;
+    if( end - p < (long)( sizeof( MAGIC ) + 4 ) ||
+	memcmp( p, MAGIC, sizeof( MAGIC ) ) )
+	return 0;
+    memcpy( &v, p + sizeof( MAGIC ), 4 );
+    p += sizeof( MAGIC ) + 4;
+    return v == P4Capture::VERSION;
+}
+
+static int
+Get32( const char *&p, const char *end, unsigned int &v )
+{
+    if( end - p < 4 ) return 0;
+    memcpy( &v, p, 4 );
+    p += 4;
+    return 1;
+}
+
+static int
+GetStr( const char *&p, const char *end, StrRef &s )
+{
+    unsigned int n;
+    if( !Get32( p, end, n ) || (unsigned int)( end - p ) < n ) return 0;
+    s.Set( p, n );
+    p += n;
+    return 1;
+}
+
+int
+P4CaptureReader::Next( StrBuf &cmd )
+{
+    // Skip the output of the current command if it wasn't replayed
+    if( pending && !Replay( 0 ) )
+	return 0;
+
+    if( p >= end || *p != R_COMMAND )
+	return 0;
+    p++;
+
+    unsigned int argc;
+    StrRef s;
+    if( !Get32( p, end, argc ) || !argc || !GetStr( p, end, s ) )
+	return 0;
+    cmd.Set( s );
+
+    for( unsigned int i = 1; i < argc; i++ )
+	if( !GetStr( p, end, s ) )
+	    return 0;
+
+    pending = 1;
+    return 1;
+}
+
+int
+P4CaptureReader::Replay( ClientUser *ui )
+{
+    StrRef s, var, val;
+    unsigned int n;
+
+    pending = 0;
+    while( p < end )
+    {
+	char t = *p++;
+	if( t == R_END )
+	    return 1;
+
+	switch( t )
+	{
+	case R_STAT:
+	    {
+		if( !Get32( p, end, n ) ) return 0;
+		StrBufDict dict;
+		for( unsigned int i = 0; i < n; i++ )
+		{
+		    if( !GetStr( p, end, var ) || !GetStr( p, end, val ) )
+			return 0;
+		    if( ui ) dict.SetVar( var, val );
+		}
+		if( ui ) ui->OutputStat( &dict );
+	    }
+	    break;
+
+	case R_TEXT:
+	case R_BINARY:
+	    if( !GetStr( p, end, s ) ) return 0;
+	    if( !ui )
+		break;
+	    if( t == R_TEXT )
+		ui->OutputText( s.Text(), s.Length() );
+	    else
+		ui->OutputBinary( s.Text(), s.Length() );
+	    break;
+
+	case R_MESSAGE:
+	    {
+		if( !GetStr( p, end, s ) ) return 0;
+		if( !ui )
+		    break;
+		Error e;
+		e.UnMarshall2( s );
+		ui->Message( &e );
+	    }
+	    break;
+
+	default:
+	    return 0;
+	}
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4capture.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Capture of the output callbacks of commands to a file,
+ * 		  for replay without a server.
+ *
+ ******************************************************************************/
+
+#include <string>
+
+//
+// A capture file starts with a magic number and version, followed by one
+// section per command: the command and its arguments, then the output
+// callbacks in the order they arrived (tagged dictionaries, text, binary
+// and messages), then an end marker. Replaying a section calls the same
+// ClientUser methods with the same data, so the conversion to Ruby
+// objects can be measured and profiled without a server. Integers are
+// stored in the byte order of the machine that wrote the file.
+//
+class P4Capture
+{
+    public:
+	P4Capture();
+	~P4Capture();
+
+	// Starts a new capture file, replacing any that's there. Returns
+	// 0, with errno set, if it can't be created.
+	int		Open( const char *path );
+	void		Close();
+	const StrPtr &	GetFile()		{ return file;		}
+	int		IsOn()			{ return fp != 0;	}
+
+	// Recording one command
+	void		Begin( const char *cmd, int argc,
+				char * const *argv );
+	void		Stat( StrDict *values );
+	void		Text( const char *data, int length );
+	void		Binary( const char *data, int length );
+	void		Message( Error *e );
+	void		End();
+
+	enum {
+	    VERSION	= 1
+	};
+
+    private:
+	void		Put32( unsigned int v );
+	void		Put( const char *data, int length );
+
+	FILE *		fp;
+	StrBuf		file;
+};
+
+//
+// A capture file read back, one command at a time
+//
+class P4CaptureReader
+{
+    public:
+	P4CaptureReader();
+
+	// Returns 0 if the file can't be read or isn't a capture
+	int		Load( const char *path );
+
+	// Moves to the next command. Returns 0 at the end of the file.
+	int		Next( StrBuf &cmd );
+
+	// Replays the output of the current command into ui, or skips it
+	// if ui is null. Returns 0 if the file is truncated or damaged.
+	int		Replay( ClientUser *ui );
+
+    private:
+	std::string	data;
+	const char *	p;
+	const char *	end;
+	int		pending;	// Output of the current command unread
+};
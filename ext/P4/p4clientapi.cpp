@@ -35,6 +35,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  ******************************************************************************/
 #include <ruby.h>
+#include <ruby/thread.h>
 #include "undefdups.h"
 #include <p4/clientapi.h>
 #include <p4/strtable.h>
@@ -44,11 +45,32 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <p4/spec.h>
 #include <p4/ignore.h>
 #include <p4/debug.h>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef OS_NT
+#include <process.h>
+#else
+#include <unistd.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "p4track.h"
 #include "p4result.h"
 #include "p4rubydebug.h"
+#include "p4commandstats.h"
 #include "clientuserruby.h"
 #include "specmgr.h"
 #include "p4clientapi.h"
+#include "p4ignorecache.h"
+#include "p4resolverules.h"
+#include "p4querycache.h"
+#include "p4printstore.h"
+#include "p4capture.h"
+#include "p4export.h"
+#include "p4metrics.h"
+#include "p4trace.h"
 #include "p4utils.h"
 
 
@@ -62,8 +84,12 @@ extern VALUE 	eP4;	// Exception class
 
 P4ClientApi::P4ClientApi() : ui( &specMgr )
 {
+    client = new ClientApi;
+    connPid = 0;
+    connFdCount = 0;
     debug = 0;
     server2 = 0;
+    unicode = 0;
     depth = 0;
     exceptionLevel = 2;
     maxResults = 0;
@@ -72,9 +98,16 @@ P4ClientApi::P4ClientApi() : ui( &specMgr )
     InitFlags();
     apiLevel = atoi( P4Tag::l_client );
     enviro = new Enviro;
+    ignoreCache = new P4IgnoreCache;
+    queryCache = new P4QueryCache;
+    printStore = new P4PrintStore;
+    capture = new P4Capture;
+    exporter = new P4Export;
+    knownChange = 0;
     prog = "unnamed p4ruby script";
+    UpdateEncoding();
 
-    client.SetProtocol( "specstring", "" );
+    SetProtocol( "specstring", "" );
 
     //
     // Load any P4CONFIG file
@@ -110,18 +143,32 @@ P4ClientApi::P4ClientApi() : ui( &specMgr )
     //
     // Load the current P4CHARSET if set.
     //
-    if( client.GetCharset().Length() )
-	SetCharset( client.GetCharset().Text() );
+    if( client->GetCharset().Length() )
+	SetCharset( client->GetCharset().Text() );
 }
 
 P4ClientApi::~P4ClientApi()
 {
-    if ( IsConnected() )
+    if ( Forked() )
+    {
+	// Leave the parent's connection alone. See AfterFork(). We may be
+	// run by the GC at any time, by when the descriptor numbers could
+	// belong to something else, so the child's copies are left open
+	// until it exits or execs.
+	client = 0;
+    }
+    else if ( IsConnected() )
     {
 	Error e;
-	client.Final( &e );
+	client->Final( &e );
 	// Ignore errors
     }
+    delete client;
+    delete ignoreCache;
+    delete queryCache;
+    delete printStore;
+    delete capture;
+    delete exporter;
     delete enviro;
 }
 
@@ -148,7 +195,8 @@ P4ClientApi::SetEVar( const char *var, const char *val )
 {
     StrRef sVar( var );
     StrRef sVal( val );
-    client.SetEVar( sVar, sVal );
+    client->SetEVar( sVar, sVal );
+    evars.SetVar( sVar, sVal );
 }
 
 void
@@ -156,14 +204,14 @@ P4ClientApi::SetVar( const char *var, const char *val )
 {
     StrRef sVar( var );
     StrRef sVal( val );
-    client.SetVar( sVar, sVal );
+    client->SetVar( sVar, sVal );
 }
 
 const StrPtr *
 P4ClientApi::GetEVar( const char *var )
 {
     StrRef sVar( var );
-    return client.GetEVar( sVar );
+    return client->GetEVar( sVar );
 }
 
 void
@@ -172,7 +220,7 @@ P4ClientApi::SetApiLevel( int level )
     StrBuf	b;
     b << level;
     apiLevel = level;
-    client.SetProtocol( "api", b.Text() );
+    SetProtocol( "api", b.Text() );
     ui.SetApiLevel( level );
 }
 
@@ -196,40 +244,57 @@ P4ClientApi::SetCharset( const char *c )
 	}
 #ifdef HAVE_RUBY_ENCODING_H
 	CharSetApi::CharSet utf8 = CharSetApi::Lookup( "utf8" );
-	client.SetTrans( utf8, cs, utf8, utf8 );
+	client->SetTrans( utf8, IsRawMode() ? utf8 : cs, utf8, utf8 );
 #else
-	client.SetTrans( cs, cs, cs, cs );
+	client->SetTrans( cs, cs, cs, cs );
 #endif
-	client.SetCharset( c );
+	client->SetCharset( c );
 	P4Utils::SetCharset( c );
+	unicode = 1;
     }
     else
     {
 	// Disables automatic unicode detection if called
 	// prior to init (2014.2)
-	client.SetTrans( 0 );
+	client->SetTrans( 0 );
+	unicode = 0;
     }
+    UpdateEncoding();
     return 1;
 }
 
+//
+// Strings from a connection are tagged per connection, never through
+// shared state, as commands on different P4 objects can interleave
+// whenever one of them calls back into Ruby.
+//
+void
+P4ClientApi::UpdateEncoding()
+{
+    encoding = P4Utils::EncodingIndex( unicode, IsRawMode() );
+    ui.SetEncoding( encoding );
+    specMgr.SetEncoding( encoding );
+    exporter->SetEncoding( encoding );
+}
+
 void
 P4ClientApi::SetCwd( const char *c )
 {
-    client.SetCwd( c );
+    client->SetCwd( c );
     enviro->Config( StrRef( c ) );
 }
 
 void
 P4ClientApi::SetTicketFile( const char *p )
 {
-    client.SetTicketFile( p );
+    client->SetTicketFile( p );
     ticketFile = p;
 }
 
 void
 P4ClientApi::SetTrustFile( const char *p )
 {
-    client.SetTrustFile( p );
+    client->SetTrustFile( p );
     trustFile = p;
 }
 
@@ -239,6 +304,9 @@ P4ClientApi::SetDebug( int d )
     debug = d;
     ui.SetDebug( d );
     specMgr.SetDebug( d );
+    ignoreCache->SetDebug( d );
+    queryCache->SetDebug( d );
+    printStore->SetDebug( d );
 
     if( P4RDB_RPC )
         p4debug.SetLevel( "rpc=5" );
@@ -255,12 +323,14 @@ void
 P4ClientApi::SetArrayConversion( int i )
 {
     specMgr.SetArrayConversion( i );
+    exporter->SetArrayConversion( i );
 }
 
 void
 P4ClientApi::SetProtocol( const char *var, const char *val )
 {
-   client.SetProtocol( var, val );
+   client->SetProtocol( var, val );
+   protocols.SetVar( var, val );
 }
 
 VALUE
@@ -303,34 +373,181 @@ P4ClientApi::Connect()
     return ConnectOrReconnect();
 }
 
+//
+// The sockets and pipes open in this process, so we can tell which ones
+// the connection adds.
+//
+static void
+OpenChannels( std::vector<P4Channel> &fds )
+{
+#ifndef OS_NT
+    DIR *d = opendir( "/dev/fd" );
+    if( !d )
+	return;
+
+    struct dirent *e;
+    while( ( e = readdir( d ) ) )
+    {
+	if( !isdigit( (unsigned char) e->d_name[ 0 ] ) )
+	    continue;
+
+	P4Channel c;
+	c.fd = atoi( e->d_name );
+	struct stat st;
+	if( c.fd != dirfd( d ) && !fstat( c.fd, &st ) &&
+	    ( S_ISSOCK( st.st_mode ) || S_ISFIFO( st.st_mode ) ) )
+	{
+	    c.dev = st.st_dev;
+	    c.ino = st.st_ino;
+	    fds.push_back( c );
+	}
+    }
+    closedir( d );
+#endif
+}
+
 VALUE
 P4ClientApi::ConnectOrReconnect()
 {
     if ( IsTrackMode() )
-	client.SetProtocol( "track", "" );
+	client->SetProtocol( "track", "" );
 
     Error	e;
 
     ResetFlags();
-    client.Init( &e );
+
+    std::vector<P4Channel> before, after;
+    OpenChannels( before );
+    client->Init( &e );
+    OpenChannels( after );
+
+    //
+    // Remember the connection's own descriptors for a forked child: the
+    // ones that are new since Init started. The API doesn't tell us, so
+    // this is a guess; a socket another native thread or Ractor opens
+    // in the same window is recorded too, and a child that drops its
+    // inherited connection would close its copy of that as well.
+    //
+    connFdCount = 0;
+    for( size_t i = 0; i < after.size() && connFdCount < 4; i++ )
+    {
+	size_t j = 0;
+	while( j < before.size() && ( before[ j ].fd != after[ i ].fd ||
+		before[ j ].dev != after[ i ].dev ||
+		before[ j ].ino != after[ i ].ino ) )
+	    j++;
+	if( j == before.size() )
+	    connFds[ connFdCount++ ] = after[ i ];
+    }
+    P4Trace::Record( P4Trace::CONNECT, &ui, !e.Test() );
+    if ( e.Test() )
+	P4Metrics::ConnectFailed();
+
     if ( e.Test() && exceptionLevel )
 	Except( "P4#connect", &e );
 
     if ( e.Test() )
 	return Qfalse;
 
+    P4Metrics::Connected();
+
     // If a handler is defined, reset the break functionality
     // for the KeepAlive function
 
     if( ui.GetHandler() != Qnil )
     {
-	client.SetBreak( &ui );
+	client->SetBreak( &ui );
     }
 
     SetConnected();
+    connPid = getpid();
+    ui.GetResolveRules().SetCaseSource( client );
+
+    // Learnt again from whichever server this is
+    serverId.Clear();
+    knownChange = 0;
     return Qtrue;
 }
 
+int
+P4ClientApi::Forked()
+{
+    return IsConnected() && connPid != getpid();
+}
+
+//
+// A forked child shares its parent's socket, so it must neither use the
+// connection nor end it: Final(), a shutdown or a TLS close_notify would
+// end the parent's session too. The child just closes its own copy of
+// the descriptors, so the server doesn't keep a connection open for every
+// child, and a fresh ClientApi with the same settings takes the place of
+// the inherited one. A descriptor is only closed while it's still open
+// on the same socket or pipe; if the child closed it and the number was
+// reused, it's left alone.
+//
+void
+P4ClientApi::CloseInherited()
+{
+#ifndef OS_NT
+    for( int i = 0; i < connFdCount; i++ )
+    {
+	struct stat st;
+	if( !fstat( connFds[ i ].fd, &st ) &&
+	    ( S_ISSOCK( st.st_mode ) || S_ISFIFO( st.st_mode ) ) &&
+	    (unsigned long long) st.st_dev == connFds[ i ].dev &&
+	    (unsigned long long) st.st_ino == connFds[ i ].ino )
+	    close( connFds[ i ].fd );
+    }
+#endif
+    connFdCount = 0;
+}
+
+void
+P4ClientApi::AfterFork()
+{
+    if ( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Dropping connection inherited over fork\n" );
+
+    CloseInherited();
+
+    // Never deleted: its destructor would try to end the session
+    ClientApi *old = client;
+    client = new ClientApi;
+
+    StrRef var, val;
+    for( int i = 0; protocols.GetVar( i, var, val ); i++ )
+	client->SetProtocol( var.Text(), val.Text() );
+    for( int i = 0; evars.GetVar( i, var, val ); i++ )
+	client->SetEVar( var, val );
+
+    if( old->GetPort().Length() )
+	client->SetPort( old->GetPort().Text() );
+    if( old->GetUser().Length() )
+	client->SetUser( old->GetUser().Text() );
+    if( old->GetClient().Length() )
+	client->SetClient( old->GetClient().Text() );
+    if( old->GetHost().Length() )
+	client->SetHost( old->GetHost().Text() );
+    if( old->GetPassword().Length() )
+	client->SetPassword( old->GetPassword().Text() );
+    if( old->GetLanguage().Length() )
+	client->SetLanguage( old->GetLanguage().Text() );
+    if( old->GetIgnoreFile().Length() )
+	client->SetIgnoreFile( old->GetIgnoreFile().Text() );
+    if( old->GetCwd().Length() )
+	client->SetCwd( old->GetCwd().Text() );
+    if( ticketFile.Length() )
+	client->SetTicketFile( ticketFile.Text() );
+    if( trustFile.Length() )
+	client->SetTrustFile( trustFile.Text() );
+    if( old->GetCharset().Length() )
+	SetCharset( old->GetCharset().Text() );
+
+    ResetFlags();
+    specMgr.Reset();
+    ui.Reset();
+}
+
 
 //
 // Disconnect session
@@ -346,8 +563,16 @@ P4ClientApi::Disconnect()
 	rb_warn( "P4#disconnect - not connected" );
 	return Qtrue;
     }
+    if ( Forked() )
+    {
+	AfterFork();
+	return Qtrue;
+    }
+    P4Trace::Record( P4Trace::DISCONNECT, &ui );
+
     Error	e;
-    client.Final( &e );
+    client->Final( &e );
+    connFdCount = 0;
     ResetFlags();
 
     // Clear the specdef cache.
@@ -365,7 +590,10 @@ P4ClientApi::Disconnect()
 VALUE
 P4ClientApi::Connected()
 {
-    if( IsConnected() && !client.Dropped() )
+    // After a fork the next command connects again on its own
+    if( Forked() )
+	return Qtrue;
+    if( IsConnected() && !client->Dropped() )
 	return Qtrue;
     else if( IsConnected() )
 	Disconnect();
@@ -409,6 +637,34 @@ void P4ClientApi::SetStreams( int enable )
        ClearStreamsMode();
 }
 
+//
+// In raw bytes mode, the only translation is to UTF-8, which is what a
+// unicode server sends anyway, so the data passes through untouched.
+// Converting it is left to the caller.
+//
+void P4ClientApi::SetRawBytes( int enable )
+{
+    if( !enable == !IsRawMode() )
+	return;
+
+    if ( enable )
+       SetRawMode();
+    else
+       ClearRawMode();
+    UpdateEncoding();
+
+#ifdef HAVE_RUBY_ENCODING_H
+    const StrPtr &cs = client->GetCharset();
+    if( !cs.Length() || cs == "none" )
+	return;
+
+    CharSetApi::CharSet utf8 = CharSetApi::Lookup( "utf8" );
+    CharSetApi::CharSet content = CharSetApi::Lookup( cs.Text() );
+    if( content >= 0 )
+	client->SetTrans( utf8, enable ? utf8 : content, utf8, utf8 );
+#endif
+}
+
 void P4ClientApi::SetGraph( int enable )
 {
     if ( enable )
@@ -452,11 +708,125 @@ P4ClientApi::ServerUnicode()
 int
 P4ClientApi::IsIgnored( const char *path )
 {
-    Ignore *ignore = client.GetIgnore();
+    Ignore *ignore = client->GetIgnore();
     if( !ignore ) return 0;
 
     StrRef p( path );
-    return ignore->Reject( p, client.GetIgnoreFile() );
+    return ignore->Reject( p, client->GetIgnoreFile() );
+}
+
+//
+// A batch has its own copy of the ignore file setting, since another
+// thread may change it while this one runs without the GVL.
+//
+struct IgnoreBatch
+{
+    P4IgnoreCache *	cache;
+    const char *	name;
+    int			count;
+    const char **	paths;
+    char *		rejected;
+    std::atomic<int>	stop;
+    int			done;
+};
+
+static void *
+CheckIgnoreBatch( void *arg )
+{
+    IgnoreBatch *b = (IgnoreBatch *) arg;
+    StrRef name( b->name );
+    b->done = b->cache->Check( name, b->count, b->paths, b->rejected,
+				&b->stop );
+    return 0;
+}
+
+// Called by Ruby to interrupt a batch, for Ctrl-C or Thread#raise
+static void
+StopIgnoreBatch( void *arg )
+{
+    ( (IgnoreBatch *) arg )->stop = 1;
+}
+
+//
+// Check a whole list of paths against the ignore rules in one go. Returns
+// the paths that are ignored if 'ignored' is set, and the paths that are
+// not ignored otherwise. The rules are evaluated on native copies of the
+// paths with the GVL released, and an interrupt stops the workers.
+//
+VALUE
+P4ClientApi::FilterIgnored( VALUE paths, int ignored )
+{
+    long	count = RARRAY_LEN( paths );
+    long	size = 0;
+    long	i;
+
+    if( !client->GetIgnore() || !client->GetIgnoreFile().Length() || !count )
+	return ignored ? rb_ary_new() : rb_ary_dup( paths );
+
+    // Type-check everything before we allocate anything. The converted
+    // strings are kept in an array of their own so the GC sees them.
+    VALUE strs = rb_ary_new_capa( count );
+    for( i = 0; i < count; i++ )
+    {
+	VALUE v = rb_ary_entry( paths, i );
+	StringValue( v );
+	rb_ary_push( strs, v );
+	size += RSTRING_LEN( v ) + 1;
+    }
+
+    // Ruby owns the buffers, so nothing leaks if we're interrupted
+    const StrPtr &	ignoreFile = client->GetIgnoreFile();
+    VALUE		arenaBuf, ptrsBuf, rejectedBuf;
+    char *		arena = ALLOCV_N( char, arenaBuf,
+					size + ignoreFile.Length() + 1 );
+    const char **	ptrs = ALLOCV_N( const char *, ptrsBuf, count );
+    char *		rejected = ALLOCV_N( char, rejectedBuf, count );
+    char *		p = arena;
+
+    for( i = 0; i < count; i++ )
+    {
+	VALUE v = RARRAY_AREF( strs, i );
+	long  l = RSTRING_LEN( v );
+
+	memcpy( p, RSTRING_PTR( v ), l );
+	p[ l ] = 0;
+	ptrs[ i ] = p;
+	p += l + 1;
+    }
+
+    memcpy( p, ignoreFile.Text(), ignoreFile.Length() + 1 );
+
+    IgnoreBatch b;
+    b.cache = ignoreCache;
+    b.name = p;
+    b.count = (int) count;
+    b.paths = ptrs;
+    b.rejected = rejected;
+    b.done = 0;
+
+    // Handle any interrupt that stopped the batch, which may raise, and
+    // start again if it didn't
+    for( ;; )
+    {
+	b.stop = 0;
+	rb_thread_call_without_gvl( CheckIgnoreBatch, &b,
+				    StopIgnoreBatch, &b );
+	if( b.done )
+	    break;
+	rb_thread_check_ints();
+    }
+
+    VALUE result = rb_ary_new();
+    for( i = 0; i < count; i++ )
+	if( !rejected[ i ] == !ignored )
+	    rb_ary_push( result, rb_ary_entry( paths, i ) );
+
+    ALLOCV_END( rejectedBuf );
+    ALLOCV_END( ptrsBuf );
+    ALLOCV_END( arenaBuf );
+
+    RB_GC_GUARD( strs );
+    return result;
 }
 
 //
@@ -468,19 +838,127 @@ P4ClientApi::IsIgnored( const char *path )
 // is raised.
 //
 
-VALUE
-P4ClientApi::Run( const char *cmd, int argc, char * const *argv )
+//
+// The entire command string, for error messages. Makes it easy to see
+// where a script has gone wrong. Only built when it's needed.
+//
+static void
+CmdString( StrBuf &s, const char *cmd, int argc, char * const *argv )
 {
-    // Save the entire command string for our error messages. Makes it
-    // easy to see where a script has gone wrong.
-    StrBuf	cmdString;
-    cmdString << "\"p4 " << cmd;
+    s << "\"p4 " << cmd;
     for( int i = 0; i < argc; i++ )
-        cmdString << " " << argv[ i ];
-    cmdString << "\"";
+        s << " " << argv[ i ];
+    s << "\"";
+}
+
+//
+// Everything Run and Replay change for the length of a command. RunDone
+// puts it back however the command ends, since an Interrupt or a
+// Thread#raise can arrive in any of the callbacks.
+//
+struct P4ClientApi::RunFrame
+{
+    P4ClientApi *	p4;
+    const char *	cmd;
+    int			argc;
+    char * const *	argv;
+    const P4RunVars *	vars;
+    int			cached;
+    StrBuf *		cacheKey;
+    int			recording;	// Query cache entry being written
+    P4CaptureReader *	capture;	// Replay only
+    VALUE		all;
+    int			ok;
+    int			reuse;		// Replay only
+};
 
+VALUE
+P4ClientApi::RunBody( VALUE frame )
+{
+    RunFrame *f = (RunFrame *) frame;
+    P4ClientApi *p4 = f->p4;
+    P4CommandStats::Timer t( p4->ui.GetStats().wallTime );
+
+    if( f->cached && p4->queryCache->Replay( *f->cacheKey, &p4->ui ) )
+	return Qnil;
+
+    if( f->cached )
+    {
+	p4->queryCache->Begin( *f->cacheKey, f->cmd );
+	p4->ui.SetRecorder( p4->queryCache );
+	f->recording = 1;
+    }
+    p4->RunCmd( f->cmd, &p4->ui, f->argc, f->argv, *f->vars );
+    if( f->cached )
+    {
+	f->recording = 0;
+	p4->ui.SetRecorder( 0 );
+	p4->queryCache->Commit();
+    }
+    return Qnil;
+}
+
+VALUE
+P4ClientApi::ReplayBody( VALUE frame )
+{
+    RunFrame *f = (RunFrame *) frame;
+    P4ClientApi *p4 = f->p4;
+    StrBuf cmd;
+
+    while( f->ok && f->capture->Next( cmd ) )
+    {
+	p4->ui.Reset();
+	p4->ui.SetCommand( cmd.Text() );
+
+	P4CommandStats &stats = p4->ui.GetStats();
+	stats.Reset();
+	{
+	    P4CommandStats::Timer t( stats.wallTime );
+	    f->ok = f->capture->Replay( &p4->ui );
+	}
+	stats.peakResults = p4->ui.GetResults().Size();
+	rb_ary_push( f->all, p4->ui.GetResults().GetOutput() );
+    }
+    return Qnil;
+}
+
+VALUE
+P4ClientApi::RunDone( VALUE frame )
+{
+    RunFrame *f = (RunFrame *) frame;
+    P4ClientApi *p4 = f->p4;
+
+    p4->depth--;
+    p4->ui.SetFields( 0 );
+
+    // A query cut short isn't cached
+    if( f->recording )
+    {
+	p4->ui.SetRecorder( 0 );
+	p4->queryCache->Abandon();
+    }
+
+    if( f->capture )
+    {
+	p4->SetReuseResults( f->reuse );
+	delete f->capture;
+	f->capture = 0;
+    }
+    else if( p4->capture->IsOn() )
+	p4->capture->End();
+    return Qnil;
+}
+
+VALUE
+P4ClientApi::Run( const char *cmd, int argc, char * const *argv,
+		const P4RunVars *vars, VALUE fields )
+{
     if ( P4RDB_COMMANDS )
+    {
+	StrBuf	cmdString;
+	CmdString( cmdString, cmd, argc, argv );
 	fprintf( stderr, "[P4] Executing %s\n", cmdString.Text()  );
+    }
 
     if ( depth )
     {
@@ -491,6 +969,19 @@ P4ClientApi::Run( const char *cmd, int argc, char * const *argv )
     // Clear out any results from the previous command
     ui.Reset();
 
+    P4CommandStats &stats = ui.GetStats();
+    stats.Reset();
+    stats.bytesSent = strlen( cmd );
+    for( int i = 0; i < argc; i++ )
+	stats.bytesSent += strlen( argv[ i ] );
+
+    // A child of a fork gets a connection of its own on first use
+    if ( Forked() )
+    {
+	AfterFork();
+	ConnectOrReconnect();
+    }
+
     if ( !IsConnected() && exceptionLevel )
 	Except( "P4#run", "not connected." );
 
@@ -500,13 +991,91 @@ P4ClientApi::Run( const char *cmd, int argc, char * const *argv )
     // Tell the UI which command we're running.
     ui.SetCommand( cmd );
 
+    P4Trace::Record( P4Trace::CMD_START, &ui, argc, 0, cmd );
+
+    P4RunVars current;
+    if( !vars )
+    {
+	GetRunVars( current );
+	vars = &current;
+    }
+
+    //
+    // Queries that can't change may be answered from the query cache.
+    // Output handlers and progress can stop a command part way, so
+    // nothing is cached while either is set.
+    //
+    // Changes count as pinned once the server has submitted them, and
+    // entries are keyed on the server's own idea of who it is.
+    //
+    StrBuf cacheKey;
+    P4INT64 change = 0;
+    int cached = queryCache->IsOn() && !IsTrackMode() &&
+		 ui.GetHandler() == Qnil && ui.GetProgress() == Qnil &&
+		 P4QueryCache::Cacheable( cmd, argc, argv, change );
+    if( cached && !serverId.Length() )
+	P4QueryCache::ServerId( client, serverId );
+    if( cached && change > knownChange )
+	knownChange = P4QueryCache::SubmittedChange( client );
+    if( change > knownChange || !serverId.Length() )
+	cached = 0;
+    if( cached )
+    {
+	cacheKey << serverId << "\n" << GetUser() << "\n" << GetClient()
+		 << "\n" << GetCharset() << "\n" << apiLevel << "\n"
+		 << ( IsRawMode() ? "raw\n" : "\n" );
+	vars->Key( cacheKey );
+	cacheKey << cmd;
+	for( int i = 0; i < argc; i++ )
+	    cacheKey << "\n" << argv[ i ];
+    }
+
+    // The projection lasts for this command only
+    projection.Clear();
+    if( fields != Qnil )
+    {
+	for( long i = 0; i < RARRAY_LEN( fields ); i++ )
+	{
+	    VALUE f = rb_obj_as_string( RARRAY_AREF( fields, i ) );
+	    projection.SetVar( StringValueCStr( f ), "1" );
+	}
+	ui.SetFields( &projection );
+    }
+
+    if( capture->IsOn() )
+	capture->Begin( cmd, argc, argv );
+
+    RunFrame f;
+    f.p4 = this;
+    f.cmd = cmd;
+    f.argc = argc;
+    f.argv = argv;
+    f.vars = vars;
+    f.cached = cached;
+    f.cacheKey = &cacheKey;
+    f.recording = 0;
+    f.capture = 0;
+    f.all = Qnil;
+    f.ok = 1;
+    f.reuse = 0;
+
     depth++;
-    RunCmd( cmd, &ui, argc, argv );
-    depth--;
+    rb_ensure( RunBody, (VALUE) &f, RunDone, (VALUE) &f );
+
+    P4Trace::Record( P4Trace::CMD_END, &ui, ui.GetResults().ErrorCount(),
+			(uint32_t)stats.records, cmd );
+
+    // Results only ever grow during a command, so the final size is
+    // also the peak.
+    stats.peakResults = ui.GetResults().Size();
 
-    if( ui.GetHandler() != Qnil) {
-	if( client.Dropped() && ! ui.IsAlive() ) {
+    P4Metrics::Command( cmd, stats.wallTime, ui.GetResults().ErrorCount(),
+			stats.records, stats.bytesSent + stats.bytesReceived );
+
+    if( ui.GetHandler() != Qnil || exporter->IsOn() ) {
+	if( client->Dropped() && ! ui.IsAlive() ) {
 	    Disconnect();
+	    P4Metrics::Reconnected();
 	    ConnectOrReconnect();
 	}
     }
@@ -516,55 +1085,73 @@ P4ClientApi::Run( const char *cmd, int argc, char * const *argv )
     P4Result &results = ui.GetResults();
 
     if ( results.ErrorCount() && exceptionLevel )
+    {
+	StrBuf	cmdString;
+	CmdString( cmdString, cmd, argc, argv );
 	Except( "P4#run", "Errors during command execution", cmdString.Text() );
+    }
 
     if ( results.WarningCount() && exceptionLevel > 1 )
+    {
+	StrBuf	cmdString;
+	CmdString( cmdString, cmd, argc, argv );
 	Except( "P4#run", "Warnings during command execution",cmdString.Text());
+    }
 
     return results.GetOutput();
 }
 
 
+//
+// Work out the protocol variables the current settings call for
+//
 void
-P4ClientApi::RunCmd( const char *cmd, ClientUser *ui, int argc, char * const *argv )
+P4ClientApi::GetRunVars( P4RunVars &vars )
 {
-    client.SetProg( &prog );
-    if( version.Length() )
-	client.SetVersion( &version );
-
     if( IsTag() )
-	client.SetVar( "tag" );
+	vars.Add( "tag" );
 
     if ( IsStreams() && apiLevel > 69 )
-	client.SetVar( "enableStreams", "" );
+	vars.Add( "enableStreams", "" );
 
     if ( IsGraph() && apiLevel > 81 )
-    client.SetVar( "enableGraph", "" );
+	vars.Add( "enableGraph", "" );
 
     // If maxresults or maxscanrows is set, enforce them now
-    if( maxResults  )	client.SetVar( "maxResults",  maxResults  );
-    if( maxScanRows )	client.SetVar( "maxScanRows", maxScanRows );
-    if( maxLockTime )	client.SetVar( "maxLockTime", maxLockTime );
+    if( maxResults  )	vars.Add( "maxResults",  maxResults  );
+    if( maxScanRows )	vars.Add( "maxScanRows", maxScanRows );
+    if( maxLockTime )	vars.Add( "maxLockTime", maxLockTime );
 
     //	If progress is set, set progress var.
-    if( ( (ClientUserRuby*)ui)->GetProgress() != Qnil ) client.SetVar( P4Tag::v_progress, 1 );
+    if( ui.GetProgress() != Qnil ) vars.Add( P4Tag::v_progress, 1 );
+}
+
+void
+P4ClientApi::RunCmd( const char *cmd, ClientUser *ui, int argc, char * const *argv,
+		const P4RunVars &vars )
+{
+    client->SetProg( &prog );
+    if( version.Length() )
+	client->SetVersion( &version );
+
+    vars.Apply( *client );
 
-    client.SetArgv( argc, argv );
-    client.Run( cmd, ui );
+    client->SetArgv( argc, argv );
+    client->Run( cmd, ui );
 
     // Can only read the protocol block *after* a command has been run.
     // Do this once only.
     if( !IsCmdRun() )
     {
 	StrPtr *s = 0;
-	if ( (s = client.GetProtocol(P4Tag::v_server2)) )
+	if ( (s = client->GetProtocol(P4Tag::v_server2)) )
 	    server2 = s->Atoi();
 
-	if( (s = client.GetProtocol(P4Tag::v_unicode)) )
+	if( (s = client->GetProtocol(P4Tag::v_unicode)) )
 	    if( s->Atoi() )
 		SetUnicode();
 
-	if( (s = client.GetProtocol(P4Tag::v_nocase)) )
+	if( (s = client->GetProtocol(P4Tag::v_nocase)) )
 	    SetCaseFold();
     }
     SetCmdRun();
@@ -644,7 +1231,7 @@ P4ClientApi::FormatSpec( const char * type, VALUE hash )
 
     specMgr.SpecToString( type, hash, buf, &e );
     if( !e.Test() )
-	return P4Utils::ruby_string( buf.Text() );
+	return P4Utils::ruby_string( encoding, buf );
 
     if( exceptionLevel )
     {
@@ -656,6 +1243,66 @@ P4ClientApi::FormatSpec( const char * type, VALUE hash )
     return Qnil;
 }
 
+//
+// Bulk parsing and formatting. The forms are handled on a pool of threads;
+// if any of them fails, the error reports which one.
+//
+
+VALUE
+P4ClientApi::ParseSpecs( const char * type, VALUE forms )
+{
+    return BatchSpecs( "P4#parse_specs", type, forms, 0 );
+}
+
+VALUE
+P4ClientApi::FormatSpecs( const char * type, VALUE hashes )
+{
+    return BatchSpecs( "P4#format_specs", type, hashes, 1 );
+}
+
+VALUE
+P4ClientApi::BatchSpecs( const char *func, const char *type, VALUE list,
+			int format )
+{
+    if ( !specMgr.HaveSpecDef( type ) )
+    {
+	if( exceptionLevel )
+	{
+	    StrBuf m;
+	    m = "No spec definition for ";
+	    m.Append( type );
+	    m.Append( " objects." );
+	    Except( func, m.Text() );
+	}
+	else
+	{
+	    return Qfalse;
+	}
+    }
+
+    Error	e;
+    int		failed;
+    VALUE	v;
+
+    if( format )
+	v = specMgr.SpecsToStrings( type, list, failed, &e );
+    else
+	v = specMgr.StringsToSpecs( type, list, failed, &e );
+
+    if( !e.Test() )
+	return v;
+
+    if( exceptionLevel )
+    {
+	StrBuf m;
+	if( failed >= 0 )
+	    m << "Error in form " << failed << ". ";
+	e.Fmt( m, EF_PLAIN );
+	Except( func, m.Text() );
+    }
+    return Qfalse;
+}
+
 //
 // Returns a hash whose keys contain the names of the fields in a spec of the
 // specified type. Not yet exposed to Ruby clients, but may be in future.
@@ -702,6 +1349,440 @@ P4ClientApi::SetInput( VALUE input )
     return Qtrue;
 }
 
+void
+P4ClientApi::SetQueryCache( const char *dir )
+{
+    queryCache->SetDir( dir );
+}
+
+VALUE
+P4ClientApi::GetQueryCache()
+{
+    if( !queryCache->IsOn() )
+	return Qnil;
+    return P4Utils::ruby_string( queryCache->GetDir() );
+}
+
+void
+P4ClientApi::SetQueryCacheLimit( P4INT64 bytes )
+{
+    queryCache->SetLimit( bytes );
+}
+
+P4INT64
+P4ClientApi::GetQueryCacheLimit()
+{
+    return queryCache->GetLimit();
+}
+
+VALUE
+P4ClientApi::GetQueryCacheStats()
+{
+    return queryCache->GetStats();
+}
+
+void
+P4ClientApi::SetPrintStore( const char *dir )
+{
+    printStore->SetDir( dir );
+}
+
+VALUE
+P4ClientApi::GetPrintStore()
+{
+    if( !printStore->IsOn() )
+	return Qnil;
+    return P4Utils::ruby_string( printStore->GetDir() );
+}
+
+VALUE
+P4ClientApi::GetPrintStoreStats()
+{
+    return printStore->GetStats();
+}
+
+int
+P4ClientApi::SetCapture( const char *path )
+{
+    ui.SetCapture( 0 );
+    capture->Close();
+    if( !path || !*path )
+	return 1;
+
+    if( !capture->Open( path ) )
+	return 0;
+    ui.SetCapture( capture );
+    return 1;
+}
+
+VALUE
+P4ClientApi::GetCapture()
+{
+    if( !capture->IsOn() )
+	return Qnil;
+    return P4Utils::ruby_string( capture->GetFile() );
+}
+
+//
+// Feeds each command in a capture file through the same callbacks as
+// live output and returns an array with the result of each. Messages
+// end up in errors, warnings and messages as they would after a run,
+// but don't raise. Reuse mode is off for the duration, as every result
+// is kept.
+//
+VALUE
+P4ClientApi::Replay( const char *path )
+{
+    if ( depth )
+    {
+	rb_warn( "Can't execute nested Perforce commands." );
+	return Qfalse;
+    }
+
+    // On the heap, so that RunDone frees it however the replay ends
+    P4CaptureReader *reader = new P4CaptureReader;
+    if( !reader->Load( path ) )
+    {
+	delete reader;
+	StrBuf m;
+	m << "Not a capture file: " << path;
+	Except( "P4#replay", m.Text() );
+    }
+
+    RunFrame f;
+    f.p4 = this;
+    f.capture = reader;
+    f.all = rb_ary_new();
+    f.ok = 1;
+    f.recording = 0;
+    f.reuse = GetReuseResults();
+    SetReuseResults( 0 );
+
+    depth++;
+    rb_ensure( ReplayBody, (VALUE) &f, RunDone, (VALUE) &f );
+
+    ui.RaiseRubyException();
+
+    VALUE all = f.all;
+    if( !f.ok )
+    {
+	StrBuf m;
+	m << "Capture file is truncated: " << path;
+	Except( "P4#replay", m.Text() );
+    }
+    return all;
+}
+
+//
+// While exporting, the UI is also the break handler, so that a failed
+// write stops the command rather than letting it run to the end.
+//
+void
+P4ClientApi::StartExport( VALUE io, int format, VALUE fields, int raw )
+{
+    exporter->Start( io, format, fields, raw );
+    ui.SetExport( exporter );
+    client->SetBreak( &ui );
+}
+
+P4INT64
+P4ClientApi::FinishExport()
+{
+    ui.SetExport( 0 );
+    if( ui.GetHandler() == Qnil )
+	client->SetBreak( NULL );
+
+    int state = 0;
+    if( !exporter->Finish( state ) && state )
+	rb_jump_tag( state );
+    return exporter->GetCount();
+}
+
+static VALUE
+HashString( VALUE h, const char *key, int enc )
+{
+    VALUE v = rb_hash_aref( h, P4Utils::ruby_string( enc, key ) );
+    return RB_TYPE_P( v, T_STRING ) ? v : Qnil;
+}
+
+static std::string
+StdString( VALUE s )
+{
+    return std::string( RSTRING_PTR( s ), RSTRING_LEN( s ) );
+}
+
+//
+// A revision that wasn't in the print store, and the places in the
+// results its content belongs.
+//
+struct PrintMiss
+{
+    std::string		spec;		// depotFile#rev
+    std::string		digest;		// from fstat -Ol, if any
+    std::string		revName;
+    std::vector<long>	slots;
+};
+
+//
+// The print header fields, and the fstat fields they're built from
+//
+static const char * const printFields[][ 2 ] = {
+    { "depotFile",	"depotFile"	},
+    { "rev",		"headRev"	},
+    { "change",		"headChange"	},
+    { "action",		"headAction"	},
+    { "type",		"headType"	},
+    { "time",		"headTime"	},
+    { "fileSize",	"fileSize"	},
+    { 0, 0 }
+};
+
+//
+// Whether print sends a revision of the type exactly as stored, so the
+// content matches the digest fstat reports. Keyword expansion (ktext,
+// +k, +ko) changes it, as does translation into the client's charset:
+// always for utf16, and for unicode and utf8 when a charset is set.
+//
+static int
+PrintsAsStored( const char *type, const StrPtr &charset )
+{
+    const char *mods = strchr( type, '+' );
+    std::string base( type, mods ? mods - type : strlen( type ) );
+
+    if( base[ 0 ] == 'k' || ( mods && strchr( mods, 'k' ) ) )
+	return 0;
+
+    if( base.find( "utf16" ) != std::string::npos )
+	return 0;
+
+    int translated = charset.Length() && strcmp( charset.Text(), "none" );
+    if( translated && ( base.find( "unicode" ) != std::string::npos ||
+			base.find( "utf8" ) != std::string::npos ) )
+	return 0;
+
+    return 1;
+}
+
+//
+// Like print, but content that's already in the print store is served
+// from there and the rest is fetched from the server with a single
+// print. fstat -Ol supplies the revisions and their digests, and the
+// headers in the results are built from it so they look the same
+// wherever the content came from. Content is stored under its digest
+// when its type is printed as stored and it matches the one the server
+// reports, so every revision with the same content shares an entry;
+// anything else, such as a file with expanded keywords or translated
+// into the client's charset, is stored and looked up only under the
+// port, charset and revision.
+//
+VALUE
+P4ClientApi::PrintCached( int argc, char * const *argv )
+{
+    if( !printStore->IsOn() )
+	Except( "P4#print_cached", "no print store set." );
+
+    if( ui.GetHandler() != Qnil )
+	Except( "P4#print_cached", "can't be used with an output handler." );
+
+    P4RunVars vars;
+    GetRunVars( vars );
+    if( !IsTag() )
+	vars.Add( "tag" );
+
+    std::vector<char *> fargv;
+    fargv.push_back( (char *) "-Ol" );
+    fargv.insert( fargv.end(), argv, argv + argc );
+
+    VALUE files = Run( "fstat", (int) fargv.size(), fargv.data(), &vars );
+    if( !RB_TYPE_P( files, T_ARRAY ) )
+	return files;
+
+    // Names for revisions whose content doesn't match the digest depend
+    // on how the server translated it.
+    StrBuf prefix;
+    prefix << GetPort() << "\n" << GetCharset() << "\n"
+	   << ( IsRawMode() ? "raw\n" : "\n" );
+
+    VALUE results = rb_ary_new();
+    std::vector<PrintMiss> misses;
+    std::map<std::string, size_t> missIndex;
+
+    for( long i = 0; i < RARRAY_LEN( files ); i++ )
+    {
+	VALUE f = RARRAY_AREF( files, i );
+	if( !RB_TYPE_P( f, T_HASH ) )
+	    continue;
+
+	VALUE depotFile = HashString( f, "depotFile", encoding );
+	VALUE rev = HashString( f, "headRev", encoding );
+	VALUE action = HashString( f, "headAction", encoding );
+	if( depotFile == Qnil || rev == Qnil )
+	    continue;
+
+	// Deleted, purged and archived revisions have nothing to print
+	if( action != Qnil )
+	{
+	    const char *a = StringValueCStr( action );
+	    if( strstr( a, "delete" ) || !strcmp( a, "purge" ) ||
+		!strcmp( a, "archive" ) )
+		continue;
+	}
+
+	VALUE header = rb_hash_new();
+	for( int j = 0; printFields[ j ][ 0 ]; j++ )
+	{
+	    VALUE v = HashString( f, printFields[ j ][ 1 ], encoding );
+	    if( v != Qnil )
+		rb_hash_aset( header,
+			P4Utils::ruby_string( encoding, printFields[ j ][ 0 ] ),
+			v );
+	}
+
+	std::string spec = StdString( depotFile ) + "#" + StdString( rev );
+
+	StrBuf revKey, revName, digest;
+	revKey << prefix;
+	revKey.Append( spec.data(), (int) spec.size() );
+	P4PrintStore::Digest( revKey.Text(), revKey.Length(), revName );
+
+	// The digest is only good for content printed as stored
+	VALUE d = HashString( f, "digest", encoding );
+	VALUE type = HashString( f, "headType", encoding );
+	if( type == Qnil || !PrintsAsStored( StringValueCStr( type ),
+						GetCharset() ) )
+	    d = Qnil;
+	if( d != Qnil )
+	    digest.Set( RSTRING_PTR( d ), (int) RSTRING_LEN( d ) );
+
+	VALUE content = printStore->Fetch( d != Qnil ? &digest : 0, revName,
+						  encoding );
+
+	rb_ary_push( results, header );
+	rb_ary_push( results, content );
+	if( content != Qnil )
+	    continue;
+
+	std::map<std::string, size_t>::iterator m = missIndex.find( spec );
+	if( m == missIndex.end() )
+	{
+	    PrintMiss miss;
+	    miss.spec = spec;
+	    miss.digest = d != Qnil ? StdString( d ) : "";
+	    miss.revName = revName.Text();
+	    m = missIndex.insert( std::make_pair( spec, misses.size() ) ).first;
+	    misses.push_back( miss );
+	}
+	misses[ m->second ].slots.push_back( RARRAY_LEN( results ) - 1 );
+    }
+
+    if( misses.size() )
+    {
+	std::vector<char *> pargv;
+	for( size_t i = 0; i < misses.size(); i++ )
+	    pargv.push_back( (char *) misses[ i ].spec.c_str() );
+
+	VALUE printed = Run( "print", (int) pargv.size(), pargv.data(), &vars );
+	if( !RB_TYPE_P( printed, T_ARRAY ) )
+	    printed = rb_ary_new();
+
+	// Content arrives in chunks after each header
+	long slot = -1;
+	for( long i = 0; i < RARRAY_LEN( printed ); i++ )
+	{
+	    VALUE v = RARRAY_AREF( printed, i );
+	    if( RB_TYPE_P( v, T_HASH ) )
+	    {
+		slot = -1;
+		VALUE d = HashString( v, "depotFile", encoding );
+		VALUE r = HashString( v, "rev", encoding );
+		if( d == Qnil || r == Qnil )
+		    continue;
+
+		std::map<std::string, size_t>::iterator m =
+		    missIndex.find( StdString( d ) + "#" + StdString( r ) );
+		if( m == missIndex.end() )
+		    continue;
+
+		slot = misses[ m->second ].slots[ 0 ];
+		rb_ary_store( results, slot,
+			      P4Utils::ruby_string( encoding, "", 0 ) );
+	    }
+	    else if( slot >= 0 && RB_TYPE_P( v, T_STRING ) )
+		rb_str_buf_append( RARRAY_AREF( results, slot ), v );
+	}
+
+	for( size_t i = 0; i < misses.size(); i++ )
+	{
+	    PrintMiss &m = misses[ i ];
+	    VALUE content = RARRAY_AREF( results, m.slots[ 0 ] );
+	    if( content == Qnil )
+		continue;
+
+	    StrBuf digest;
+	    P4PrintStore::Digest( RSTRING_PTR( content ), RSTRING_LEN( content ),
+				digest );
+	    if( m.digest != digest.Text() )
+		digest.Set( m.revName.c_str() );
+	    printStore->Store( digest, RSTRING_PTR( content ),
+				RSTRING_LEN( content ) );
+
+	    for( size_t j = 1; j < m.slots.size(); j++ )
+		rb_ary_store( results, m.slots[ j ], content );
+	}
+    }
+
+    // Leave out anything the server wouldn't print
+    VALUE output = rb_ary_new();
+    for( long i = 0; i + 1 < RARRAY_LEN( results ); i += 2 )
+    {
+	if( RARRAY_AREF( results, i + 1 ) == Qnil )
+	    continue;
+	rb_ary_push( output, RARRAY_AREF( results, i ) );
+	rb_ary_push( output, RARRAY_AREF( results, i + 1 ) );
+    }
+    return output;
+}
+
+//
+// Install the rules consulted by resolves: a Hash of pattern => action,
+// or an Array of [ pattern, action ] pairs. nil clears them.
+//
+
+VALUE
+P4ClientApi::SetResolveRules( VALUE rules )
+{
+    P4ResolveRules &r = ui.GetResolveRules();
+    r.Clear();
+    if( NIL_P( rules ) )
+	return Qnil;
+
+    VALUE list = rb_funcall( rules, rb_intern( "to_a" ), 0 );
+    Check_Type( list, T_ARRAY );
+    for( long i = 0; i < RARRAY_LEN( list ); i++ )
+    {
+	VALUE pair = rb_ary_entry( list, i );
+	Check_Type( pair, T_ARRAY );
+
+	VALUE pattern = rb_ary_entry( pair, 0 );
+	VALUE action = rb_ary_entry( pair, 1 );
+	if( SYMBOL_P( action ) )
+	    action = rb_sym2str( action );
+
+	StrBuf p, a;
+	p.Set( StringValueCStr( pattern ) );
+	a.Set( StringValueCStr( action ) );
+	if( !r.Add( p, a ) )
+	{
+	    r.Clear();
+	    rb_raise( rb_eArgError, "Unknown resolve action '%s'", a.Text() );
+	}
+    }
+
+    if ( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] %d resolve rules set\n", r.Count() );
+    return Qtrue;
+}
+
 //
 // Sets the handler and connects the SetBreak feature
 //
@@ -714,9 +1795,9 @@ P4ClientApi::SetHandler( VALUE handler )
     ui.SetHandler( handler );
 
     if( handler == Qnil)
-	client.SetBreak(NULL);
+	client->SetBreak(NULL);
     else
-	client.SetBreak(&ui);
+	client->SetBreak(&ui);
 
     return Qtrue;
 }
@@ -741,6 +1822,13 @@ P4ClientApi::SetSSOHandler( VALUE h )
 }
 
 
+void
+P4ClientApi::SetOwner( VALUE self )
+{
+    ui.SetOwner( self );
+    exporter->SetOwner( self );
+}
+
 void
 P4ClientApi::GCMark()
 {
@@ -751,6 +1839,19 @@ P4ClientApi::GCMark()
     ui.GCMark();
 }
 
+//
+// Native memory held, for ObjectSpace.memsize_of. Caches are counted at
+// their fixed size only.
+//
+size_t
+P4ClientApi::MemSize()
+{
+    return sizeof( *this ) + ui.MemSize() + sizeof( ClientApi ) +
+	   sizeof( Enviro ) + sizeof( P4IgnoreCache ) +
+	   sizeof( P4QueryCache ) + sizeof( P4PrintStore ) +
+	   sizeof( P4Capture ) + sizeof( P4Export );
+}
+
 void
 P4ClientApi::Except( const char *func, const char *msg )
 {
@@ -780,6 +1881,9 @@ P4ClientApi::Except( const char *func, const char *msg )
     if( terminate )
 	m << "\n\n";
 
+    P4Trace::Record( P4Trace::EXCEPTION, &ui, m.Length(), 0, func );
+    P4Trace::DumpOnException();
+
     rb_raise( eP4, "%s", m.Text() );
 }
 
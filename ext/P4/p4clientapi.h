@@ -42,6 +42,74 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 
 class Enviro;
+class P4IgnoreCache;
+class P4QueryCache;
+class P4PrintStore;
+class P4Capture;
+class P4Export;
+
+//
+// The protocol variables sent with a command. Normally worked out from
+// the current settings just before each run; a prepared command works
+// them out once and reuses them.
+//
+class P4RunVars
+{
+public:
+    P4RunVars() : count( 0 ) {}
+
+    void Add( const char *var )			{ Add( var, 0 );	}
+    void Add( const char *var, int val )
+    {
+	StrBuf v;
+	v << val;
+	Add( var, v.Text() );
+    }
+    void Add( const char *var, const char *val )
+    {
+	if( count == MAX_VARS ) return;
+	names[ count ] = var;
+	bare[ count ] = !val;
+	values[ count ] = val ? val : "";
+	count++;
+    }
+
+    // Append the variables to a cache key
+    void Key( StrBuf &key ) const
+    {
+	for( int i = 0; i < count; i++ )
+	    key << names[ i ] << "=" << values[ i ] << "\n";
+    }
+
+    void Apply( ClientApi &client ) const
+    {
+	for( int i = 0; i < count; i++ )
+	    if( bare[ i ] )
+		client.SetVar( names[ i ] );
+	    else
+		client.SetVar( names[ i ], values[ i ].Text() );
+    }
+
+private:
+    enum { MAX_VARS = 8 };
+
+    int		count;
+    const char *names[ MAX_VARS ];
+    int		bare[ MAX_VARS ];
+    StrBuf	values[ MAX_VARS ];
+};
+
+//
+// A socket or pipe descriptor, with the device and inode of what it was
+// open on, so that we can tell if the number has since been reused.
+//
+struct P4Channel
+{
+    int			fd;
+    unsigned long long	dev;
+    unsigned long long	ino;
+};
+
 class P4ClientApi
 {
 public:
@@ -67,51 +135,57 @@ public:
     // Returns bool, but may raise exception
     int  SetCharset( const char *c );
 
+    // Raw bytes mode - output is left as the server sent it, and
+    // returned as ASCII-8BIT strings
+    void SetRawBytes( int enable );
+    int  IsRawBytes()			{ return IsRawMode() != 0;	}
+
     // Set API level for backwards compatibility
     void SetApiLevel( int level );
 
-    void SetClient( const char *c )	{ client.SetClient( c );	}
+    void SetClient( const char *c )	{ client->SetClient( c );	}
     void SetCwd( const char *c );
     void SetEnviroFile( const char *c );
     void SetEVar( const char *var, const char *val );
     void SetVar( const char *var, const char *val );
-    void SetHost( const char *h )	{ client.SetHost( h );		}
-    void SetIgnoreFile( const char *f )	{ client.SetIgnoreFile( f );	}
+    void SetHost( const char *h )	{ client->SetHost( h );		}
+    void SetIgnoreFile( const char *f )	{ client->SetIgnoreFile( f );	}
     void SetMaxResults( int v )		{ maxResults = v;		}
     void SetMaxScanRows( int v )	{ maxScanRows = v;		}
     void SetMaxLockTime( int v )	{ maxLockTime = v;		}
     VALUE SetEnv( const char *var, const char *val );
-    void SetLanguage( const char *l )	{ client.SetLanguage( l );	}
-    void SetPassword( const char *p )	{ client.SetPassword( p );	}
-    void SetPort( const char *p )	{ client.SetPort( p );		}
+    void SetLanguage( const char *l )	{ client->SetLanguage( l );	}
+    void SetPassword( const char *p )	{ client->SetPassword( p );	}
+    void SetPort( const char *p )	{ client->SetPort( p );		}
     void SetProg( const char *p )	{ prog = p;			}
     void SetProtocol( const char *var, const char *val );
     void SetTicketFile( const char *p );
     void SetTrustFile( const char *p );
-    void SetUser( const char *u )	{ client.SetUser( u );		}
+    void SetUser( const char *u )	{ client->SetUser( u );		}
     void SetVersion( const char *v )	{ version = v;			}
     void SetArrayConversion ( int i );
 
     int	 GetApiLevel()			{ return apiLevel;		}
-    const StrPtr &GetCharset()		{ return client.GetCharset();	}
-    const StrPtr &GetClient()		{ return client.GetClient();	}
-    const StrPtr &GetConfig()		{ return client.GetConfig();	}
-    const StrPtr &GetCwd()		{ return client.GetCwd();	}
+    const StrPtr &GetCharset()		{ return client->GetCharset();	}
+    const StrPtr &GetClient()		{ return client->GetClient();	}
+    const StrPtr &GetConfig()		{ return client->GetConfig();	}
+    const StrPtr &GetCwd()		{ return client->GetCwd();	}
     const char * GetEnv( const char *v);
     const StrPtr *GetEnviroFile();
     const StrPtr *GetEVar(const char *v);
-    const StrPtr &GetHost()		{ return client.GetHost();	}
-    const StrPtr &GetIgnoreFile()	{ return client.GetIgnoreFile();}
-    const StrPtr &GetLanguage()		{ return client.GetLanguage();	}
-    const StrPtr &GetPassword()		{ return client.GetPassword();	}
-    const StrPtr &GetPort()		{ return client.GetPort();	}
+    const StrPtr &GetHost()		{ return client->GetHost();	}
+    const StrPtr &GetIgnoreFile()	{ return client->GetIgnoreFile();}
+    const StrPtr &GetLanguage()		{ return client->GetLanguage();	}
+    const StrPtr &GetPassword()		{ return client->GetPassword();	}
+    const StrPtr &GetPort()		{ return client->GetPort();	}
     const StrPtr &GetProg()		{ return prog;			}
     const StrPtr &GetTicketFile()	{ return ticketFile;		}
     const StrPtr &GetTrustFile()   { return trustFile;        }
-    const StrPtr &GetUser()		{ return client.GetUser();	}
+    const StrPtr &GetUser()		{ return client->GetUser();	}
     const StrPtr &GetVersion()		{ return version;		}
 
     int		  IsIgnored( const char *path );
+    VALUE	  FilterIgnored( VALUE paths, int ignored );
 
     int		  GetMaxResults()	{ return maxResults;		}
     int		  GetMaxScanRows()	{ return maxScanRows;		}
@@ -126,19 +200,66 @@ public:
     VALUE Connected();		// Return true if connected and not dropped.
     VALUE Disconnect();
 
-    // Executing commands.
-    VALUE Run( const char *cmd, int argc, char * const *argv );
+    // Executing commands. If vars is given it's used in place of the
+    // protocol variables from the current settings. If fields is an
+    // array, only the fields it names are kept from tagged output.
+    VALUE Run( const char *cmd, int argc, char * const *argv,
+		const P4RunVars *vars = 0, VALUE fields = Qnil );
+    void  GetRunVars( P4RunVars &vars );
     VALUE SetInput( VALUE input );
+    VALUE SetResolveRules( VALUE rules );
+
+    // Query cache - results of queries that can't change are kept in
+    // the given directory and replayed from there
+    void  SetQueryCache( const char *dir );
+    VALUE GetQueryCache();
+    void  SetQueryCacheLimit( P4INT64 bytes );
+    P4INT64 GetQueryCacheLimit();
+    VALUE GetQueryCacheStats();
+
+    // Print store - printed content is kept in the given directory and
+    // print_cached only fetches what isn't already there
+    void  SetPrintStore( const char *dir );
+    VALUE GetPrintStore();
+    VALUE GetPrintStoreStats();
+    VALUE PrintCached( int argc, char * const *argv );
+
+    // Capture - the output of each command is also written to the
+    // given file, which Replay() feeds back through the conversion to
+    // Ruby objects without a server
+    int   SetCapture( const char *path );
+    VALUE GetCapture();
+    VALUE Replay( const char *path );
+
+    // Export - tagged output is written to an IO as JSON lines or CSV
+    // rather than collected. Finishing flushes it and returns the
+    // number of records written.
+    void  StartExport( VALUE io, int format, VALUE fields, int raw );
+    P4INT64 FinishExport();
 
     // Result handling
     VALUE GetErrors()		{ return ui.GetResults().GetErrors();}
     VALUE GetWarnings()		{ return ui.GetResults().GetWarnings();}
     VALUE GetMessages()		{ return ui.GetResults().GetMessages();}
     VALUE GetTrackOutput()	{ return ui.GetResults().GetTrack();}
+    VALUE GetTrackData()	{ return ui.GetResults().GetTrackData();}
+
+    // Messages dropped on arrival, by P4::Message#msgid
+    void  SetSuppressedMessages( VALUE ids )
+				{ ui.GetResults().SetSuppressed( ids );	}
+    VALUE GetSuppressedMessages()
+				{ return ui.GetResults().GetSuppressed();}
+
+    // Reuse one output array across commands
+    void  SetReuseResults( int r )
+				{ ui.GetResults().SetReuse( r );	}
+    int   GetReuseResults()	{ return ui.GetResults().GetReuse();	}
 
     // Spec parsing
     VALUE ParseSpec( const char * type, const char *form );
     VALUE FormatSpec( const char *type, VALUE hash );
+    VALUE ParseSpecs( const char * type, VALUE forms );
+    VALUE FormatSpecs( const char *type, VALUE hashes );
     VALUE SpecFields( const char * type );
 
     // Exception levels:
@@ -164,6 +285,9 @@ public:
     int   GetDebug() { return debug; }
     void  SetDebug( int d );
 
+    // Timings and counts for the last command run
+    VALUE GetLastCommandStats() { return ui.GetStats().ToHash( encoding ); }
+
     // Handler support
 
     VALUE SetHandler( VALUE handler );
@@ -172,6 +296,11 @@ public:
     //	Progress API support
     VALUE SetProgress( VALUE progress );
     VALUE GetProgress() { return ui.GetProgress(); }
+    void  SetProgressInterval( double i ) { ui.SetProgressInterval( i ); }
+    double GetProgressInterval() { return ui.GetProgressInterval(); }
+    void  SetProgressStep( int s ) { ui.SetProgressStep( s ); }
+    int   GetProgressStep() { return ui.GetProgressStep(); }
+    VALUE GetProgressTotals() { return ui.GetProgressTotals(); }
 
     // SSO handler
     VALUE SetEnableSSO( VALUE e );
@@ -184,16 +313,41 @@ public:
     VALUE SetSSOHandler( VALUE handler );
     VALUE GetSSOHandler() { return ui.GetRubySSOHandler(); }
 
-    // Ruby garbage collection
+    // Ruby garbage collection. SetOwner() is given the wrapping P4
+    // object, for the write barrier.
+    void  SetOwner( VALUE self );
     void  GCMark();
+    void  GCCompact()			{ ui.GCCompact();	}
+    size_t MemSize();
 
 
 private:
 
-    void RunCmd(const char *cmd, ClientUser *ui, int argc, char * const *argv);
+    void RunCmd(const char *cmd, ClientUser *ui, int argc, char * const *argv,
+		const P4RunVars &vars);
+
+    // The parts of Run and Replay that call back into Ruby, and so can
+    // be left by an exception, and their clean up, run by rb_ensure.
+    struct RunFrame;
+    static VALUE RunBody( VALUE frame );
+    static VALUE ReplayBody( VALUE frame );
+    static VALUE RunDone( VALUE frame );
 
     VALUE ConnectOrReconnect();	// internal connect method
 
+    // Works out the encoding for strings from this connection, from its
+    // charset and raw bytes mode, and hands it to what makes them.
+    void UpdateEncoding();
+
+    // True if this process was forked since we connected, so the
+    // connection belongs to our parent.
+    int  Forked();
+    void AfterFork();
+    void CloseInherited();
+
+    VALUE BatchSpecs( const char *func, const char *type, VALUE list,
+			int format );
+
     enum {
 	S_TAGGED 	= 0x0001,
 	S_CONNECTED	= 0x0002,
@@ -203,6 +357,7 @@ private:
 	S_TRACK		= 0x0020,
 	S_STREAMS	= 0x0040,
     S_GRAPH     = 0x0080,
+	S_RAW		= 0x0100,
 
 	S_INITIAL_STATE	= 0x00C1,   // Streams, Graph, and Tagged enabled by default
 	S_RESET_MASK	= 0x001E,
@@ -243,20 +398,39 @@ private:
     void    ClearGraphMode()  { flags &= ~S_GRAPH;      }
     int     IsGraphMode()     { return flags & S_GRAPH; }
 
+    void	SetRawMode()		{ flags |= S_RAW;		}
+    void	ClearRawMode()		{ flags &= ~S_RAW;		}
+    int		IsRawMode()		{ return flags & S_RAW;		}
+
     private:
-    ClientApi		client;
+    ClientApi *		client;
     ClientUserRuby	ui;
     Enviro *		enviro;
+    P4IgnoreCache *	ignoreCache;
+    P4QueryCache *	queryCache;
+    P4PrintStore *	printStore;
+    P4Capture *		capture;
+    P4Export *		exporter;
     SpecMgr		specMgr;
     StrBuf		prog;
     StrBuf		version;
     StrBuf		ticketFile;
     StrBuf      trustFile;
+    StrBufDict		protocols;	// Replayed on a ClientApi after fork
+    StrBufDict		evars;
+    StrBufDict		projection;	// Fields wanted by the current run
+    int			connPid;	// Process that made the connection
+    P4Channel		connFds[ 4 ];	// Its sockets or pipes, closed by
+    int			connFdCount;	// a forked child
+    StrBuf		serverId;	// As the server reports it, for
+    P4INT64		knownChange;	// the query cache
     int			depth;
     int			debug;
     int			exceptionLevel;
     int			apiLevel;
     int			server2;
+    int			unicode;	// Has a charset other than none
+    int			encoding;	// See P4Utils::EncodingIndex()
     int			flags;
     int			maxResults;
     int			maxScanRows;
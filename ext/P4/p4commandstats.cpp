@@ -0,0 +1,95 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4commandstats.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Cheap, always-on counters describing where the time
+ * 		  went in the last command run.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include "p4utils.h"
+#include "p4commandstats.h"
+
+void
+P4CommandStats::Reset()
+{
+    wallTime = 0;
+    callbackTime = 0;
+    convertTime = 0;
+    records = 0;
+    messages = 0;
+    texts = 0;
+    binaryBytes = 0;
+    bytesSent = 0;
+    bytesReceived = 0;
+    peakResults = 0;
+}
+
+static void
+SetTime( VALUE h, const char *key, long long ns, int enc )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( enc, key ), rb_float_new( ns / 1e9 ) );
+}
+
+static void
+SetCount( VALUE h, const char *key, long long n, int enc )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( enc, key ), LL2NUM( n ) );
+}
+
+VALUE
+P4CommandStats::ToHash( int enc )
+{
+    //
+    // Time not spent in our callbacks is time spent inside the API. That
+    // covers waiting on and talking to the server, and also the API's
+    // own work on the client: writing files for sync and print,
+    // computing digests and translating charsets.
+    //
+    long long api = wallTime - callbackTime;
+    if( api < 0 ) api = 0;
+
+    VALUE h = rb_hash_new();
+    SetTime( h, "wall", wallTime, enc );
+    SetTime( h, "api", api, enc );
+    SetTime( h, "callback", callbackTime, enc );
+    SetTime( h, "conversion", convertTime, enc );
+    SetCount( h, "records", records, enc );
+    SetCount( h, "messages", messages, enc );
+    SetCount( h, "texts", texts, enc );
+    SetCount( h, "binary_bytes", binaryBytes, enc );
+    SetCount( h, "bytes_sent", bytesSent, enc );
+    SetCount( h, "bytes_received", bytesReceived, enc );
+    SetCount( h, "peak_results", peakResults, enc );
+    return h;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4commandstats.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Cheap, always-on counters describing where the time
+ * 		  went in the last command run.
+ *
+ ******************************************************************************/
+
+#include <chrono>
+
+class P4CommandStats
+{
+    public:
+	typedef std::chrono::steady_clock Clock;
+
+	P4CommandStats()	{ Reset(); }
+
+	void	Reset();
+
+	// Convert to a Hash for P4#last_command_stats, with keys in
+	// encoding enc
+	VALUE	ToHash( int enc );
+
+	//
+	// Adds the time between construction and destruction to a counter.
+	// Timers may nest as long as they add to different counters.
+	// Building with -DP4RUBY_NO_COMMAND_STATS compiles the timers out,
+	// leaving only the counts, so their cost can be measured.
+	//
+#ifndef P4RUBY_NO_COMMAND_STATS
+	class Timer
+	{
+	    public:
+		Timer( long long &c ) : counter( c ), start( Clock::now() ) {}
+		~Timer()
+		{
+		    counter += std::chrono::duration_cast<
+			std::chrono::nanoseconds>( Clock::now() - start ).count();
+		}
+
+	    private:
+		long long &		counter;
+		Clock::time_point	start;
+	};
+#else
+	class Timer
+	{
+	    public:
+		Timer( long long & ) {}
+	};
+#endif
+
+	// All times in nanoseconds. ToHash reports the difference between
+	// the first two as "api": time in the API outside our callbacks,
+	// network and client-side work alike.
+	long long	wallTime;	// Whole of ClientApi::Run()
+	long long	callbackTime;	// Inside ClientUser callbacks
+	long long	convertTime;	// Building Ruby objects from the data
+
+	long long	records;	// Tagged output
+	long long	messages;	// Errors, warnings and info
+	long long	texts;		// Untagged text output
+	long long	binaryBytes;	// Binary output
+
+	// Bytes crossing the ClientUser boundary. The API doesn't expose
+	// its socket counters, so these count the payload rather than the
+	// RPC framing around it.
+	long long	bytesSent;
+	long long	bytesReceived;
+
+	long		peakResults;
+};
@@ -41,20 +41,34 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "p4error.h"
 
 
-static void error_free( P4Error *e )
+static void error_free( void *e )
 {
-    delete e;
+    delete (P4Error *) e;
 }
 
-static void error_mark( P4Error *e )
+static void error_mark( void *e )
 {
-    e->GCMark();
+    ( (P4Error *) e )->GCMark();
 }
 
+static size_t error_size( const void *e )
+{
+    return ( (P4Error *) e )->MemSize();
+}
+
+// Holds no Ruby objects, so trivially write barrier protected
+const rb_data_type_t P4Error::dataType = {
+    "P4::Message",
+    { error_mark, error_free, error_size, 0, { 0 } },
+    0, 0,
+    RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 
-P4Error::P4Error( const Error &other )
+P4Error::P4Error( const Error &other, int enc )
 {
     this->debug = 0;
+    this->encoding = enc;
 
     error = other;
 }
@@ -85,7 +99,7 @@ P4Error::GetText()
 {
     StrBuf t;
     error.Fmt( t, EF_PLAIN );
-    return P4Utils::ruby_string( t.Text(), t.Length() );
+    return P4Utils::ruby_string( encoding, t );
 }
 
 VALUE
@@ -97,8 +111,8 @@ P4Error::GetDict()
     // suppress -Wpointer-arith
     for (int i=0;pDict->GetVar(i,key,val) != 0;i++) {
       rb_hash_aset( dictHash,
-        P4Utils::ruby_string(key.Text(), key.Length()),
-        P4Utils::ruby_string(val.Text(), val.Length()));
+        P4Utils::ruby_string( encoding, key ),
+        P4Utils::ruby_string( encoding, val ));
     }
     return dictHash;
 }
@@ -115,7 +129,7 @@ P4Error::Inspect()
     b << "/Sev:" << error.GetSeverity();
     b << "]: ";
     b << a;
-    return P4Utils::ruby_string( b.Text(), b.Length() );
+    return P4Utils::ruby_string( encoding, b );
 }
 
 VALUE
@@ -124,7 +138,7 @@ P4Error::Wrap( VALUE pClass )
     VALUE e;
     VALUE argv[ 1 ];
 
-    e = Data_Wrap_Struct( pClass, error_mark, error_free, this );
+    e = TypedData_Wrap_Struct( pClass, &dataType, this );
     rb_obj_call_init( e, 0, argv );
     return e;
 }
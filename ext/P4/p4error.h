@@ -37,8 +37,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 class P4Error
 {
     public:
-    // Construct by copying another error object
-    P4Error( const Error &other );
+    // Construct by copying another error object. Strings are made in
+    // encoding enc.
+    P4Error( const Error &other, int enc );
 
     void  SetDebug( int d )	{ debug = d;	}
 
@@ -54,9 +55,13 @@ class P4Error
 
     // Ruby garbage collection
     void  GCMark();
+    size_t MemSize()		{ return sizeof( *this );	}
+
+    static const rb_data_type_t dataType;
 
     private:
     Error		error;
+    int			encoding;
     int			debug;
 };
 
@@ -0,0 +1,482 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4export.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Serializes tagged output straight to an IO as JSON lines
+ * 		  or CSV, without building Ruby objects per record.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "p4utils.h"
+#include "p4export.h"
+
+static const char hex[] = "0123456789abcdef";
+
+P4Export::P4Export()
+{
+    owner = Qnil;
+    io = Qnil;
+    format = NDJSON;
+    encoding = P4Utils::EncodingIndex( 0, 0 );
+    raw = 0;
+    convertArray = 1;
+    failed = 0;
+    header = 0;
+    count = 0;
+}
+
+void
+P4Export::Start( VALUE i, int f, VALUE names, int r )
+{
+    Set( io, i );
+    format = f;
+    raw = r;
+    failed = 0;
+    header = 0;
+    count = 0;
+    buf.clear();
+    fields.clear();
+
+    if( names == Qnil )
+	return;
+
+    for( long n = 0; n < RARRAY_LEN( names ); n++ )
+    {
+	VALUE s = rb_obj_as_string( RARRAY_AREF( names, n ) );
+	fields.push_back( std::string( RSTRING_PTR( s ), RSTRING_LEN( s ) ) );
+    }
+}
+
+void
+P4Export::Set( VALUE &slot, VALUE v )
+{
+    if( owner != Qnil )
+	RB_OBJ_WRITE( owner, &slot, v );
+    else
+	slot = v;
+}
+
+int
+P4Export::Finish( int &state )
+{
+    int ok = failed ? 0 : Flush( state );
+    io = Qnil;
+    buf.clear();
+    return ok;
+}
+
+static VALUE
+Write( VALUE data )
+{
+    VALUE *args = reinterpret_cast<VALUE *>( data );
+    return rb_funcall( args[ 0 ], rb_intern( "write" ), 1, args[ 1 ] );
+}
+
+int
+P4Export::Flush( int &state )
+{
+    if( buf.empty() )
+	return 1;
+
+    VALUE args[ 2 ];
+    args[ 0 ] = io;
+    if( raw )
+	args[ 1 ] = P4Utils::ruby_string( P4Utils::EncodingIndex( 0, 1 ),
+					  buf.data(), buf.size() );
+    else if( format == NDJSON )
+	args[ 1 ] = rb_utf8_str_new( buf.data(), buf.size() );
+    else
+	args[ 1 ] = P4Utils::ruby_string( encoding, buf.data(), buf.size() );
+    buf.clear();
+
+    rb_protect( Write, (VALUE) args, &state );
+    if( state )
+	failed = 1;
+    return !failed;
+}
+
+int
+P4Export::Stat( StrDict *values, int &state )
+{
+    if( failed )
+	return 0;
+
+    Group( values );
+
+    if( format == NDJSON )
+    {
+	int first = 1;
+	buf += '{';
+	if( fields.empty() )
+	{
+	    for( size_t i = 0; i < record.size(); i++ )
+	    {
+		if( !first ) buf += ',';
+		first = 0;
+		Json( record[ i ].name.data(), (int) record[ i ].name.size() );
+		buf += ':';
+		JsonNode( record[ i ].node );
+	    }
+	}
+	else
+	{
+	    for( size_t i = 0; i < fields.size(); i++ )
+	    {
+		int f = Find( fields[ i ].data(), fields[ i ].size() );
+		StrPtr *v = f < 0 ? values->GetVar( fields[ i ].c_str() ) : 0;
+		if( f < 0 && !v ) continue;
+		if( !first ) buf += ',';
+		first = 0;
+		Json( fields[ i ].data(), (int) fields[ i ].size() );
+		buf += ':';
+		if( f >= 0 )
+		    JsonNode( record[ f ].node );
+		else
+		    Json( v->Text(), v->Length() );
+	    }
+	}
+	buf += "}\n";
+    }
+    else
+    {
+	if( !header )
+	{
+	    if( fields.empty() )
+		for( size_t i = 0; i < record.size(); i++ )
+		    fields.push_back( record[ i ].name );
+
+	    for( size_t i = 0; i < fields.size(); i++ )
+	    {
+		if( i ) buf += ',';
+		Csv( fields[ i ].data(), (int) fields[ i ].size() );
+	    }
+	    buf += '\n';
+	    header = 1;
+	}
+
+	for( size_t i = 0; i < fields.size(); i++ )
+	{
+	    if( i ) buf += ',';
+	    int f = Find( fields[ i ].data(), fields[ i ].size() );
+	    if( f >= 0 )
+	    {
+		int leaves = 0;
+		cell.clear();
+		CsvNode( record[ f ].node, cell, leaves );
+		Csv( cell.data(), (int) cell.size() );
+	    }
+	    else if( StrPtr *v = values->GetVar( fields[ i ].c_str() ) )
+		Csv( v->Text(), v->Length() );
+	}
+	buf += '\n';
+    }
+
+    count++;
+    if( buf.size() >= BUFFER_SIZE )
+	return Flush( state );
+    return 1;
+}
+
+void
+P4Export::Group( StrDict *values )
+{
+    record.clear();
+    nodes.clear();
+
+    StrRef var, val;
+    for( int i = 0; values->GetVar( i, var, val ); i++ )
+	Insert( var, val );
+}
+
+//
+// Files a key under its base name the way SpecMgr::InsertItem does:
+// depotFile0 becomes item 0 of depotFile, how0,1 item 1 of item 0 of how.
+//
+void
+P4Export::Insert( const StrPtr &var, const StrPtr &val )
+{
+    const char *key = var.Text();
+    int len = var.Length();
+    int i = len;
+
+    if( convertArray )
+	while( i && ( isdigit( (unsigned char) key[ i - 1 ] ) || key[ i - 1 ] == ',' ) )
+	    i--;
+    if( !i )
+	i = len;
+
+    if( i == len )
+    {
+	// A plain key that's the base name of an array already, such as
+	// otherOpen, gets an 's' appended like InsertItem's
+	Field f;
+	f.name.assign( key, len );
+	if( Find( key, len ) >= 0 )
+	    f.name += 's';
+	f.node = NewNode( &val );
+	record.push_back( f );
+	return;
+    }
+
+    int f = Find( key, i );
+    if( f >= 0 && !nodes[ record[ f ].node ].array )
+    {
+	// The base name is a plain value already, so the key is kept
+	// whole, as InsertItem does
+	int n = NewNode( &val );
+	int g = Find( key, len );
+	if( g >= 0 )
+	{
+	    record[ g ].node = n;
+	    return;
+	}
+	Field nf;
+	nf.name.assign( key, len );
+	nf.node = n;
+	record.push_back( nf );
+	return;
+    }
+
+    if( f < 0 )
+    {
+	Field nf;
+	nf.name.assign( key, i );
+	nf.node = NewNode( 0 );
+	record.push_back( nf );
+	f = (int) record.size() - 1;
+    }
+
+    // Each comma separated index is one level of nesting. Nodes are
+    // held by index as NewNode() may move them.
+    int n = record[ f ].node;
+    const char *p = key + i;
+    for( ;; )
+    {
+	int pos = atoi( p );
+	const char *c = strchr( p, ',' );
+	if( !c )
+	{
+	    int leaf = NewNode( &val );
+	    Slot( n, pos ) = leaf;
+	    return;
+	}
+
+	int next = Slot( n, pos );
+	if( next < 0 || !nodes[ next ].array )
+	{
+	    next = NewNode( 0 );
+	    Slot( n, pos ) = next;
+	}
+	n = next;
+	p = c + 1;
+    }
+}
+
+int
+P4Export::Find( const char *name, size_t len )
+{
+    for( size_t i = 0; i < record.size(); i++ )
+	if( record[ i ].name.size() == len &&
+	    !memcmp( record[ i ].name.data(), name, len ) )
+	    return (int) i;
+    return -1;
+}
+
+int
+P4Export::NewNode( const StrPtr *val )
+{
+    Node n;
+    n.val = val ? val->Text() : 0;
+    n.len = val ? val->Length() : 0;
+    n.array = !val;
+    nodes.push_back( n );
+    return (int) nodes.size() - 1;
+}
+
+//
+// Item pos of an array node, grown with gaps to reach it
+//
+int &
+P4Export::Slot( int array, int pos )
+{
+    std::vector<int> &items = nodes[ array ].items;
+    if( (size_t) pos >= items.size() )
+	items.resize( pos + 1, -1 );
+    return items[ pos ];
+}
+
+void
+P4Export::JsonNode( int n )
+{
+    if( !nodes[ n ].array )
+    {
+	Json( nodes[ n ].val, nodes[ n ].len );
+	return;
+    }
+
+    buf += '[';
+    for( size_t i = 0; i < nodes[ n ].items.size(); i++ )
+    {
+	if( i ) buf += ',';
+	int item = nodes[ n ].items[ i ];
+	if( item < 0 )
+	    buf += "null";
+	else
+	    JsonNode( item );
+    }
+    buf += ']';
+}
+
+void
+P4Export::CsvNode( int n, std::string &out, int &leaves )
+{
+    if( !nodes[ n ].array )
+    {
+	if( leaves++ ) out += '\n';
+	out.append( nodes[ n ].val, nodes[ n ].len );
+	return;
+    }
+
+    for( size_t i = 0; i < nodes[ n ].items.size(); i++ )
+	if( nodes[ n ].items[ i ] >= 0 )
+	    CsvNode( nodes[ n ].items[ i ], out, leaves );
+}
+
+//
+// Length of the valid UTF-8 sequence at p, or 0 if it isn't one
+//
+static int
+Utf8Length( const unsigned char *p, const unsigned char *end )
+{
+    int n;
+    unsigned int c = p[ 0 ];
+    if( c >= 0xC2 && c <= 0xDF ) n = 2;
+    else if( c >= 0xE0 && c <= 0xEF ) n = 3;
+    else if( c >= 0xF0 && c <= 0xF4 ) n = 4;
+    else return 0;
+
+    if( end - p < n )
+	return 0;
+    for( int i = 1; i < n; i++ )
+	if( ( p[ i ] & 0xC0 ) != 0x80 )
+	    return 0;
+
+    // Overlong forms, surrogates and code points past U+10FFFF
+    if( c == 0xE0 && p[ 1 ] < 0xA0 ) return 0;
+    if( c == 0xED && p[ 1 ] > 0x9F ) return 0;
+    if( c == 0xF0 && p[ 1 ] < 0x90 ) return 0;
+    if( c == 0xF4 && p[ 1 ] > 0x8F ) return 0;
+    return n;
+}
+
+void
+P4Export::Json( const char *s, int len )
+{
+    const unsigned char *p = (const unsigned char *) s;
+    const unsigned char *end = p + len;
+    const unsigned char *run = p;
+
+    buf += '"';
+    while( p < end )
+    {
+	unsigned int c = *p;
+	if( c >= 0x20 && c != '"' && c != '\\' && ( c < 0x80 || raw ) )
+	{
+	    p++;
+	    continue;
+	}
+
+	buf.append( (const char *) run, p - run );
+	if( c >= 0x80 )
+	{
+	    int n = Utf8Length( p, end );
+	    if( n )
+		buf.append( (const char *) p, n );
+	    else
+		buf += "\\ufffd";
+	    p += n ? n : 1;
+	}
+	else
+	{
+	    buf += '\\';
+	    switch( c )
+	    {
+	    case '"':	buf += '"'; break;
+	    case '\\':	buf += '\\'; break;
+	    case '\b':	buf += 'b'; break;
+	    case '\f':	buf += 'f'; break;
+	    case '\n':	buf += 'n'; break;
+	    case '\r':	buf += 'r'; break;
+	    case '\t':	buf += 't'; break;
+	    default:
+		buf += "u00";
+		buf += hex[ c >> 4 ];
+		buf += hex[ c & 0xF ];
+	    }
+	    p++;
+	}
+	run = p;
+    }
+    buf.append( (const char *) run, p - run );
+    buf += '"';
+}
+
+void
+P4Export::Csv( const char *p, int len )
+{
+    if( !memchr( p, ',', len ) && !memchr( p, '"', len ) &&
+	!memchr( p, '\n', len ) && !memchr( p, '\r', len ) )
+    {
+	buf.append( p, len );
+	return;
+    }
+
+    buf += '"';
+    for( int i = 0; i < len; i++ )
+    {
+	if( p[ i ] == '"' ) buf += '"';
+	buf += p[ i ];
+    }
+    buf += '"';
+}
+
+void
+P4Export::GCMark()
+{
+    rb_gc_mark( io );
+}
@@ -0,0 +1,145 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4export.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Serializes tagged output straight to an IO as JSON lines
+ * 		  or CSV, without building Ruby objects per record.
+ *
+ ******************************************************************************/
+
+#include <string>
+#include <vector>
+
+//
+// Records are appended to a buffer as they arrive and the buffer is
+// written to the IO, with its write method, whenever it grows past
+// BUFFER_SIZE, so the only Ruby objects made are one string per chunk.
+//
+// Indexed keys, such as depotFile0 and how0,1 from describe or filelog,
+// are gathered under their base names as SpecMgr::InsertItem does for
+// hashes, so a record has the same shape as the one P4#run returns and
+// fields are named by their base names.
+//
+// JSON strings are escaped per RFC 8259, with bytes that aren't valid
+// UTF-8 replaced by U+FFFD unless raw is set, when they're written as
+// they are and the chunks are ASCII-8BIT. Arrays hold null for indexes
+// the server skipped.
+//
+// CSV follows RFC 4180 quoting, one record per line, with the values of
+// an indexed field joined by newlines in one cell. Without a list of
+// fields, the fields of the first record make the header and later
+// records are written in those columns, so a field that first appears
+// in a later record isn't written; name the fields to avoid that.
+//
+class P4Export
+{
+    public:
+	enum Format { NDJSON, CSV };
+
+	P4Export();
+
+	// Starts an export. fields is an Array of field names or Qnil.
+	void		Start( VALUE io, int format, VALUE fields, int raw );
+
+	// Whether indexed keys are gathered into arrays. See
+	// P4#set_array_conversion=.
+	void		SetArrayConversion( int a )	{ convertArray = a; }
+
+	// Writes out what's buffered and ends the export. Returns 0, with
+	// the exception's tag in state, if the IO raised.
+	int		Finish( int &state );
+	int		IsOn()			{ return io != Qnil;	}
+
+	// Adds one record. Returns 0, with the tag in state, if writing
+	// to the IO raised; nothing more is written after that.
+	int		Stat( StrDict *values, int &state );
+
+	P4INT64		GetCount()		{ return count;		}
+
+	// Encoding index for CSV chunks. See P4Utils::EncodingIndex().
+	void		SetEncoding( int e )	{ encoding = e;		}
+
+	// Ruby garbage collection. Once the owner, the P4 object, is set,
+	// storing the IO goes through its write barrier.
+	void		SetOwner( VALUE o )	{ owner = o;		}
+	void		GCMark();
+
+	enum {
+	    BUFFER_SIZE	= 64 * 1024
+	};
+
+    private:
+	//
+	// The record being written. Values point into the StrDict, so
+	// they're only good during Stat(). A node is a value, or an array
+	// whose items are indexes into nodes, -1 for a gap.
+	//
+	struct Node
+	{
+	    const char *	val;
+	    int			len;
+	    int			array;
+	    std::vector<int>	items;
+	};
+
+	struct Field
+	{
+	    std::string		name;
+	    int			node;
+	};
+
+	int		Flush( int &state );
+	void		Set( VALUE &slot, VALUE v );
+	void		Group( StrDict *values );
+	void		Insert( const StrPtr &var, const StrPtr &val );
+	int		Find( const char *name, size_t len );
+	int		NewNode( const StrPtr *val );
+	int &		Slot( int array, int pos );
+	void		JsonNode( int n );
+	void		CsvNode( int n, std::string &out, int &leaves );
+	void		Json( const char *p, int len );
+	void		Csv( const char *p, int len );
+
+	VALUE		owner;
+	VALUE		io;
+	int		format;
+	int		encoding;
+	int		raw;
+	int		convertArray;
+	int		failed;
+	int		header;		// CSV header written
+	P4INT64		count;
+	std::vector<std::string> fields;
+	std::vector<Field>	record;
+	std::vector<Node>	nodes;
+	std::string	cell;
+	std::string	buf;
+};
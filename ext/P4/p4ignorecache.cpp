@@ -0,0 +1,316 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4ignorecache.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Batched evaluation of ignore rules. Keeps the compiled
+ * 		  rules between calls and spreads large path lists across
+ * 		  worker threads.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <p4/ignore.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "p4rubydebug.h"
+#include "p4ignorecache.h"
+
+static inline int
+IsSeparator( char c )
+{
+#ifdef OS_NT
+    return c == '/' || c == '\\';
+#else
+    return c == '/';
+#endif
+}
+
+// Length of the directory part of a path, not counting the separator
+static int
+DirLength( const char *p )
+{
+    int len = 0;
+    for( int i = 0; p[ i ]; i++ )
+	if( IsSeparator( p[ i ] ) )
+	    len = i;
+    return len;
+}
+
+static int
+ModTime( const char *path )
+{
+    FileSys *f = FileSys::Create( FST_TEXT );
+    f->Set( path );
+    int t = f->StatModTime();
+    delete f;
+    return t;
+}
+
+//
+// Ignore::Reject() rebuilds its rules whenever the directory changes, so
+// we visit the paths grouped by directory, and within a directory in name
+// order, to compile each directory's rules once per batch.
+//
+struct ByDirectory
+{
+    const char * const *paths;
+    const int *dirLens;
+
+    bool operator()( int a, int b ) const
+    {
+	int la = dirLens[ a ];
+	int lb = dirLens[ b ];
+	int c = strncmp( paths[ a ], paths[ b ], la < lb ? la : lb );
+	if( c ) return c < 0;
+	if( la != lb ) return la < lb;
+	return strcmp( paths[ a ], paths[ b ] ) < 0;
+    }
+};
+
+static void
+CheckRange( Ignore *ignore, const StrPtr &name, const char * const *paths,
+		const int *order, int from, int to, char *rejected,
+		const std::atomic<int> *stop )
+{
+    for( int i = from; i < to; i++ )
+    {
+	if( stop && *stop )
+	    return;
+
+	StrRef p( paths[ order[ i ] ] );
+	rejected[ order[ i ] ] = ignore->Reject( p, name ) ? 1 : 0;
+    }
+}
+
+P4IgnoreCache::P4IgnoreCache()
+{
+    debug = 0;
+    for( int i = 0; i < MAX_WORKERS; i++ )
+	workers[ i ] = 0;
+}
+
+P4IgnoreCache::~P4IgnoreCache()
+{
+    Reset();
+}
+
+void
+P4IgnoreCache::Reset()
+{
+    for( int i = 0; i < MAX_WORKERS; i++ )
+    {
+	delete workers[ i ];
+	workers[ i ] = 0;
+    }
+    watched.clear();
+    name.Clear();
+}
+
+int
+P4IgnoreCache::Check( const StrPtr &ignoreName, int count,
+		const char * const *paths, char *rejected,
+		const std::atomic<int> *stop )
+{
+    if( count <= 0 ) return 1;
+
+    std::lock_guard<std::mutex> hold( lock );
+
+    if( Stale( ignoreName ) )
+    {
+	if( P4RDB_COMMANDS )
+	    fprintf( stderr, "[P4] Ignore rules changed, recompiling\n" );
+	Reset();
+	name = ignoreName;
+    }
+
+    std::vector<int> dirLens( count );
+    std::vector<int> order( count );
+    for( int i = 0; i < count; i++ )
+    {
+	dirLens[ i ] = DirLength( paths[ i ] );
+	order[ i ] = i;
+    }
+
+    ByDirectory cmp = { paths, dirLens.data() };
+    std::sort( order.begin(), order.end(), cmp );
+
+    int n = Workers( count );
+    for( int i = 0; i < n; i++ )
+	if( !workers[ i ] )
+	    workers[ i ] = new Ignore;
+
+    if( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Checking %d paths against %s using %d thread(s)\n",
+		count, name.Text(), n );
+
+    int chunk = ( count + n - 1 ) / n;
+    std::vector<std::thread> threads;
+
+    for( int i = 1; i < n; i++ )
+    {
+	int from = i * chunk;
+	int to = std::min( count, from + chunk );
+	if( from >= to ) break;
+
+	try
+	{
+	    threads.push_back( std::thread( CheckRange, workers[ i ],
+			std::cref( name ), paths, order.data(), from, to,
+			rejected, stop ) );
+	}
+	catch( ... )
+	{
+	    // Couldn't start a thread; do the work here instead.
+	    CheckRange( workers[ i ], name, paths, order.data(), from, to,
+			rejected, stop );
+	}
+    }
+
+    CheckRange( workers[ 0 ], name, paths, order.data(), 0,
+		std::min( count, chunk ), rejected, stop );
+
+    for( size_t i = 0; i < threads.size(); i++ )
+	threads[ i ].join();
+
+    // The rules compiled so far are still good if we were stopped, but
+    // the ignore files for the paths we skipped weren't looked at.
+    if( stop && *stop )
+	return 0;
+
+    Watch( name, count, paths, order.data() );
+    return 1;
+}
+
+//
+// The compiled rules are out of date if the ignore file setting has
+// changed, or any ignore file we've looked at (or looked for) has a
+// different modification time than it did when we compiled the rules.
+//
+int
+P4IgnoreCache::Stale( const StrPtr &ignoreName )
+{
+    if( name != ignoreName )
+	return 1;
+
+    for( MTimeMap::iterator i = watched.begin(); i != watched.end(); ++i )
+	if( ModTime( i->first.c_str() ) != i->second )
+	    return 1;
+
+    return 0;
+}
+
+//
+// Record the modification times of the ignore files that could apply to
+// the paths we've just checked. P4IGNORE may name several files, split
+// like a PATH; for each, that's the file itself when it's a path,
+// otherwise one in each directory from the path's parent up to the root.
+// Files that don't exist yet are recorded too, so that creating one
+// invalidates the cache.
+//
+void
+P4IgnoreCache::Watch( const StrPtr &ignoreName, int count,
+		const char * const *paths, const int *order )
+{
+#ifdef OS_NT
+    const char sep = ';';
+#else
+    const char sep = ':';
+#endif
+    const char *p = ignoreName.Text();
+    for( ;; )
+    {
+	const char *e = strchr( p, sep );
+	std::string one( p, e ? e - p : strlen( p ) );
+	if( one.length() )
+	    WatchOne( one, count, paths, order );
+	if( !e )
+	    break;
+	p = e + 1;
+    }
+}
+
+void
+P4IgnoreCache::WatchOne( const std::string &ignoreName, int count,
+		const char * const *paths, const int *order )
+{
+    if( DirLength( ignoreName.c_str() ) || IsSeparator( ignoreName[ 0 ] ) )
+    {
+	if( watched.find( ignoreName ) == watched.end() )
+	    watched[ ignoreName ] = ModTime( ignoreName.c_str() );
+	return;
+    }
+
+    std::string lastDir;
+    std::string candidate;
+
+    for( int i = 0; i < count; i++ )
+    {
+	const char *p = paths[ order[ i ] ];
+	int rooted = IsSeparator( p[ 0 ] );
+	std::string dir( p, DirLength( p ) );
+
+	if( i && dir == lastDir )
+	    continue;
+	lastDir = dir;
+
+	for( ;; )
+	{
+	    candidate = dir;
+	    if( dir.length() || rooted )
+		candidate += '/';
+	    candidate += ignoreName;
+
+	    // Ancestors were recorded along with this one
+	    if( watched.find( candidate ) != watched.end() )
+		break;
+	    watched[ candidate ] = ModTime( candidate.c_str() );
+
+	    if( !dir.length() )
+		break;
+	    dir.resize( DirLength( dir.c_str() ) );
+	}
+    }
+}
+
+int
+P4IgnoreCache::Workers( int count )
+{
+    int n = (int) std::thread::hardware_concurrency();
+    int wanted = count / PATHS_PER_WORKER;
+
+    if( n < 1 ) n = 1;
+    if( n > MAX_WORKERS ) n = MAX_WORKERS;
+    if( wanted < 1 ) wanted = 1;
+
+    return wanted < n ? wanted : n;
+}
@@ -0,0 +1,87 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4ignorecache.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Batched evaluation of ignore rules. Keeps the compiled
+ * 		  rules between calls and spreads large path lists across
+ * 		  worker threads.
+ *
+ ******************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class Ignore;
+class P4IgnoreCache
+{
+    public:
+	P4IgnoreCache();
+	~P4IgnoreCache();
+
+	void	SetDebug( int d )	{ debug = d;	}
+
+	// Throw away the compiled rules. The next Check() rebuilds them.
+	void	Reset();
+
+	//
+	// Check count paths against the rules named by ignoreName, setting
+	// rejected[ i ] for each path that is ignored. Runs without touching
+	// Ruby, so callers may release the GVL around it; calls from several
+	// threads take turns. Setting stop gives up part way through, and
+	// Check returns 0 if it did.
+	//
+	int	Check( const StrPtr &ignoreName, int count,
+			const char * const *paths, char *rejected,
+			const std::atomic<int> *stop = 0 );
+
+	enum {
+	    MAX_WORKERS		= 16,
+	    PATHS_PER_WORKER	= 16384
+	};
+
+    private:
+	int	Stale( const StrPtr &ignoreName );
+	void	Watch( const StrPtr &ignoreName, int count,
+			const char * const *paths, const int *order );
+	void	WatchOne( const std::string &ignoreName, int count,
+			const char * const *paths, const int *order );
+	int	Workers( int count );
+
+	typedef std::unordered_map<std::string, int> MTimeMap;
+
+	int		debug;
+	std::mutex	lock;
+	StrBuf		name;
+	Ignore *	workers[ MAX_WORKERS ];
+	MTimeMap	watched;
+};
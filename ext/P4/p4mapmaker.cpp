@@ -46,6 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 P4MapMaker::P4MapMaker()
 {
     map = new MapApi;
+    encoding = P4Utils::DefaultEncoding();
 }
 
 P4MapMaker::~P4MapMaker()
@@ -61,6 +62,7 @@ P4MapMaker::P4MapMaker( const P4MapMaker &m )
     int 	i;
 
     map = new MapApi;
+    encoding = m.encoding;
     for( i = 0; i < m.map->Count(); i++ )
     {
 	s = m.map->GetLeft( i );
@@ -83,6 +85,7 @@ P4MapMaker::Join( P4MapMaker *l, P4MapMaker *r)
 {
     P4MapMaker *m = new P4MapMaker();
     delete m->map;
+    m->encoding = l->encoding;
 
     m->map = MapApi::Join( l->map, r->map );
     return m;
@@ -198,6 +201,18 @@ P4MapMaker::Clear()
     map->Clear();
 }
 
+size_t
+P4MapMaker::MemSize()
+{
+    const size_t entryOverhead = 192;
+
+    size_t size = sizeof( *this ) + sizeof( MapApi );
+    for( int i = 0; i < map->Count(); i++ )
+	size += entryOverhead + map->GetLeft( i )->Length() +
+		map->GetRight( i )->Length();
+    return size;
+}
+
 void
 P4MapMaker::Reverse()
 {
@@ -231,7 +246,7 @@ P4MapMaker::Translate( VALUE p, int fwd )
 
     from = StringValuePtr( p );
     if( map->Translate( from, to, dir ) )
-	return P4Utils::ruby_string( to.Text(), to.Length() );
+	return P4Utils::ruby_string( encoding, to );
     return Qnil;
 }
 
@@ -272,7 +287,7 @@ P4MapMaker::Lhs()
 	s << l->Text();
 	if( quote ) s << "\"";
 
-	rb_ary_push( a, P4Utils::ruby_string( s.Text(), s.Length() ) );
+	rb_ary_push( a, P4Utils::ruby_string( encoding, s ) );
     }
     return a;
 }
@@ -301,7 +316,7 @@ P4MapMaker::Rhs()
 	s << r->Text();
 	if( quote ) s << "\"";
 
-	rb_ary_push( a, P4Utils::ruby_string( s.Text(), s.Length() ) );
+	rb_ary_push( a, P4Utils::ruby_string( encoding, s ) );
     }
     return a;
 }
@@ -351,7 +366,7 @@ P4MapMaker::ToA()
 	s << r->Text();
 	if( quote ) s << "\"";
 
-	rb_ary_push( a, P4Utils::ruby_string( s.Text(), s.Length() ) );
+	rb_ary_push( a, P4Utils::ruby_string( encoding, s ) );
     }
     return a;
 }
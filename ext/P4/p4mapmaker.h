@@ -61,9 +61,15 @@ class P4MapMaker
 	// We hold no references to Ruby objects, so no GC to do...
 	void		GCMark() {}
 
+	// Native memory held, for ObjectSpace.memsize_of. The MapApi's
+	// own bookkeeping per entry is estimated.
+	size_t		MemSize();
+
     private:
 	void		SplitMapping( const StrPtr &in, StrBuf &l, StrBuf &r );
 	MapApi *	map;
+	int		encoding;	// Of the strings we return, fixed
+					// when the map is made
 };
 
 
@@ -39,23 +39,43 @@
 #include <p4/i18napi.h>
 #include <p4/strtable.h>
 #include <p4/spec.h>
+#include "p4track.h"
 #include "p4result.h"
 #include "p4rubydebug.h"
+#include "p4commandstats.h"
 #include "clientuserruby.h"
 #include "p4utils.h"
 #include "p4mergedata.h"
 
-static void mergedata_free(P4MergeData *md) {
-	delete md;
+static void mergedata_free(void *md) {
+	delete (P4MergeData *) md;
 }
 
-static void mergedata_mark(P4MergeData *md) {
-	md->GCMark();
+static void mergedata_mark(void *md) {
+	((P4MergeData *) md)->GCMark();
 }
 
+static void mergedata_compact(void *md) {
+	((P4MergeData *) md)->GCCompact();
+}
+
+static size_t mergedata_size(const void *md) {
+	return ((P4MergeData *) md)->MemSize();
+}
+
+// info is only set before wrapping, and Wrap() tells the GC about it
+const rb_data_type_t P4MergeData::dataType = {
+	"P4::MergeData",
+	{ mergedata_mark, mergedata_free, mergedata_size, mergedata_compact,
+	  { 0 } },
+	0, 0,
+	RUBY_TYPED_FREE_IMMEDIATELY | RUBY_TYPED_WB_PROTECTED
+};
+
 P4MergeData::P4MergeData(ClientUser *ui, ClientMerge *m, StrPtr &hint,
 		VALUE info) {
 	this->debug = 0;
+	this->encoding = P4Utils::EncodingIndex(0, 0);
 	this->actionmerger = 0;
 	this->ui = ui;
 	this->merger = m;
@@ -73,6 +93,7 @@ P4MergeData::P4MergeData(ClientUser *ui, ClientMerge *m, StrPtr &hint,
 P4MergeData::P4MergeData(ClientUser *ui, ClientResolveA *m, StrPtr &hint,
 		VALUE info) {
 	this->debug = 0;
+	this->encoding = P4Utils::EncodingIndex(0, 0);
 	this->merger = 0;
 	this->ui = ui;
 	this->hint = hint;
@@ -83,56 +104,56 @@ P4MergeData::P4MergeData(ClientUser *ui, ClientResolveA *m, StrPtr &hint,
 
 VALUE P4MergeData::GetYourName() {
 	if (merger && yours.Length())
-		return P4Utils::ruby_string(yours.Text());
+		return P4Utils::ruby_string(encoding, yours);
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetTheirName() {
 	if (merger && theirs.Length())
-		return P4Utils::ruby_string(theirs.Text());
+		return P4Utils::ruby_string(encoding, theirs);
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetBaseName() {
 	if (merger && base.Length())
-		return P4Utils::ruby_string(base.Text());
+		return P4Utils::ruby_string(encoding, base);
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetYourPath() {
 	if (merger && merger->GetYourFile())
-		return P4Utils::ruby_string(merger->GetYourFile()->Name());
+		return P4Utils::ruby_string(encoding, merger->GetYourFile()->Name());
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetTheirPath() {
 	if (merger && merger->GetTheirFile())
-		return P4Utils::ruby_string(merger->GetTheirFile()->Name());
+		return P4Utils::ruby_string(encoding, merger->GetTheirFile()->Name());
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetBasePath() {
 	if (merger && merger->GetBaseFile())
-		return P4Utils::ruby_string(merger->GetBaseFile()->Name());
+		return P4Utils::ruby_string(encoding, merger->GetBaseFile()->Name());
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetResultPath() {
 	if (merger && merger->GetResultFile())
-		return P4Utils::ruby_string(merger->GetResultFile()->Name());
+		return P4Utils::ruby_string(encoding, merger->GetResultFile()->Name());
 	else
 		return Qnil;
 }
 
 VALUE P4MergeData::GetMergeHint() {
 	if (hint.Length())
-		return P4Utils::ruby_string(hint.Text());
+		return P4Utils::ruby_string(encoding, hint);
 	else
 		return Qnil;
 }
@@ -167,7 +188,7 @@ VALUE P4MergeData::GetMergeAction() {
 		StrBuf buf;
 		actionmerger->GetMergeAction().Fmt(&buf, EF_PLAIN);
 		if (buf.Length())
-			return P4Utils::ruby_string(buf.Text());
+			return P4Utils::ruby_string(encoding, buf);
 		else
 			return Qnil;
 	}
@@ -179,7 +200,7 @@ VALUE P4MergeData::GetYoursAction() {
 		StrBuf buf;
 		actionmerger->GetYoursAction().Fmt(&buf, EF_PLAIN);
 		if (buf.Length())
-			return P4Utils::ruby_string(buf.Text());
+			return P4Utils::ruby_string(encoding, buf);
 		else
 			return Qnil;
 	}
@@ -191,7 +212,7 @@ VALUE P4MergeData::GetTheirAction() {
 		StrBuf buf;
 		actionmerger->GetTheirAction().Fmt(&buf, EF_PLAIN);
 		if (buf.Length())
-			return P4Utils::ruby_string(buf.Text());
+			return P4Utils::ruby_string(encoding, buf);
 		else
 			return Qnil;
 	}
@@ -203,7 +224,7 @@ VALUE P4MergeData::GetType() {
 		StrBuf buf;
 		actionmerger->GetType().Fmt(&buf, EF_PLAIN);
 		if (buf.Length())
-			return P4Utils::ruby_string(buf.Text());
+			return P4Utils::ruby_string(encoding, buf);
 		else
 			return Qnil;
 	}
@@ -238,7 +259,7 @@ VALUE P4MergeData::GetString() {
 		buffer.Clear();
 
 		result << "\thint: " << hint << "\n";
-		return P4Utils::ruby_string(result.Text());
+		return P4Utils::ruby_string(encoding, result);
 	} else {
 		result << "P4MergeData - Content\n";
 		if (yours.Length()) result << "yourName: " << yours << "\n";
@@ -252,7 +273,7 @@ VALUE P4MergeData::GetString() {
 		if ( merger && merger->GetBaseFile())
 			result << "\tbaseFile: " << merger->GetBaseFile()->Name() << "\n";
 
-		return P4Utils::ruby_string(result.Text());
+		return P4Utils::ruby_string(encoding, result);
 	}
 	return Qnil;
 }
@@ -261,12 +282,22 @@ VALUE P4MergeData::Wrap(VALUE pClass) {
 	VALUE md;
 	VALUE argv[1];
 
-	md = Data_Wrap_Struct(pClass, mergedata_mark, mergedata_free, this);
+	md = TypedData_Wrap_Struct(pClass, &dataType, this);
+	RB_OBJ_WRITTEN(md, Qundef, info);
 	rb_obj_call_init(md, 0, argv);
 	return md;
 }
 
 void P4MergeData::GCMark() {
-	// We don't hold Ruby objects
+	rb_gc_mark_movable(info);
+}
+
+void P4MergeData::GCCompact() {
+	info = rb_gc_location(info);
+}
+
+size_t P4MergeData::MemSize() {
+	return sizeof(*this) + hint.BufSize() + yours.BufSize() +
+		theirs.BufSize() + base.BufSize();
 }
 
@@ -42,6 +42,10 @@ class P4MergeData
 
     void  SetDebug( int d )	{ debug = d;	}
 
+    // Encoding index for the strings we return. See
+    // P4Utils::EncodingIndex().
+    void  SetEncoding( int e )	{ encoding = e;	}
+
     //	Content resolve
     VALUE	GetYourName();
     VALUE	GetTheirName();
@@ -80,9 +84,14 @@ class P4MergeData
 
     // Ruby garbage collection
     void  GCMark();
+    void  GCCompact();
+    size_t MemSize();
+
+    static const rb_data_type_t dataType;
 
     private:
     int				debug;
+    int				encoding;
     ClientUser *	ui;
     StrBuf			hint;
     ClientMerge *	merger;
@@ -0,0 +1,369 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4metrics.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Process-wide counters and latency histograms for
+ * 		  every command run by any P4 instance.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "p4utils.h"
+#include "p4metrics.h"
+
+typedef P4Metrics::Slot Slot;
+
+static std::atomic<Slot *>	slots[ P4Metrics::MAX_COMMANDS ];
+static Slot			overflow;	// Once every slot is taken
+static std::atomic<long long>	connects;
+static std::atomic<long long>	connectFailures;
+static std::atomic<long long>	reconnects;
+
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+static void
+ClearSlot( Slot *s )
+{
+    s->calls.store( 0, relaxed );
+    s->errors.store( 0, relaxed );
+    s->records.store( 0, relaxed );
+    s->bytes.store( 0, relaxed );
+    s->micros.store( 0, relaxed );
+    s->maxMicros.store( 0, relaxed );
+    for( int i = 0; i < P4Metrics::BUCKETS; i++ )
+	s->buckets[ i ].store( 0, relaxed );
+}
+
+int
+P4Metrics::Bucket( long long v )
+{
+    if( v < 0 ) v = 0;
+    if( v < 2 * SUB_BUCKETS )
+	return (int)v;
+
+    int msb = 0;
+    for( long long t = v; t >>= 1; )
+	msb++;
+    if( msb > MAX_BITS )
+	return BUCKETS - 1;
+
+    int shift = msb - SUB_BITS;
+    return ( shift * SUB_BUCKETS ) + (int)( ( v >> shift ) & ( SUB_BUCKETS - 1 ) )
+		+ SUB_BUCKETS;
+}
+
+// The largest value that lands in a bucket
+long long
+P4Metrics::BucketHigh( int b )
+{
+    if( b < 2 * SUB_BUCKETS )
+	return b;
+
+    int shift = ( b - SUB_BUCKETS ) / SUB_BUCKETS;
+    int sub = ( b - SUB_BUCKETS ) % SUB_BUCKETS;
+    return ( (long long)( SUB_BUCKETS + sub + 1 ) << shift ) - 1;
+}
+
+//
+// Open addressing on the command name. A new slot is published with a
+// compare-and-swap; losing the race just means using the winner's.
+//
+Slot *
+P4Metrics::Find( const char *cmd )
+{
+    unsigned int h = 2166136261u;
+    for( const char *p = cmd; *p; p++ )
+	h = ( h ^ (unsigned char)*p ) * 16777619u;
+
+    for( int n = 0; n < MAX_COMMANDS; n++ )
+    {
+	std::atomic<Slot *> &entry = slots[ ( h + n ) % MAX_COMMANDS ];
+	Slot *s = entry.load( std::memory_order_acquire );
+
+	if( !s )
+	{
+	    Slot *fresh = new Slot;
+	    strncpy( fresh->name, cmd, NAME_LEN - 1 );
+	    fresh->name[ NAME_LEN - 1 ] = 0;
+	    ClearSlot( fresh );
+
+	    if( entry.compare_exchange_strong( s, fresh,
+					std::memory_order_acq_rel ) )
+		return fresh;
+
+	    delete fresh;
+	}
+
+	if( !strncmp( s->name, cmd, NAME_LEN - 1 ) )
+	    return s;
+    }
+
+    return &overflow;
+}
+
+void
+P4Metrics::Command( const char *cmd, long long nanos, int failed,
+			long long records, long long bytes )
+{
+    Slot *s = Find( cmd );
+    long long us = nanos / 1000;
+
+    s->calls.fetch_add( 1, relaxed );
+    if( failed ) s->errors.fetch_add( 1, relaxed );
+    s->records.fetch_add( records, relaxed );
+    s->bytes.fetch_add( bytes, relaxed );
+    s->micros.fetch_add( us, relaxed );
+    s->buckets[ Bucket( us ) ].fetch_add( 1, relaxed );
+
+    long long m = s->maxMicros.load( relaxed );
+    while( us > m && !s->maxMicros.compare_exchange_weak( m, us, relaxed ) )
+	;
+}
+
+void
+P4Metrics::Connected()
+{
+    connects.fetch_add( 1, relaxed );
+}
+
+void
+P4Metrics::ConnectFailed()
+{
+    connectFailures.fetch_add( 1, relaxed );
+}
+
+void
+P4Metrics::Reconnected()
+{
+    reconnects.fetch_add( 1, relaxed );
+}
+
+void
+P4Metrics::Reset()
+{
+    for( int i = 0; i < MAX_COMMANDS; i++ )
+    {
+	Slot *s = slots[ i ].load( std::memory_order_acquire );
+	if( s ) ClearSlot( s );
+    }
+    ClearSlot( &overflow );
+    connects.store( 0, relaxed );
+    connectFailures.store( 0, relaxed );
+    reconnects.store( 0, relaxed );
+}
+
+long long
+P4Metrics::Percentile( Slot *s, long long calls, double p )
+{
+    long long want = (long long)( calls * p + 0.5 );
+    if( want < 1 ) want = 1;
+
+    long long seen = 0;
+    for( int b = 0; b < BUCKETS; b++ )
+    {
+	seen += s->buckets[ b ].load( relaxed );
+	if( seen >= want )
+	    return BucketHigh( b );
+    }
+    return s->maxMicros.load( relaxed );
+}
+
+static inline void
+SetInt( VALUE h, const char *key, long long v )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( key ), LL2NUM( v ) );
+}
+
+static inline void
+SetSeconds( VALUE h, const char *key, long long micros )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( key ), rb_float_new( micros / 1e6 ) );
+}
+
+VALUE
+P4Metrics::Snapshot()
+{
+    VALUE h = rb_hash_new();
+    VALUE cmds = rb_hash_new();
+
+    for( int i = 0; i <= MAX_COMMANDS; i++ )
+    {
+	Slot *s = i < MAX_COMMANDS ?
+		    slots[ i ].load( std::memory_order_acquire ) : &overflow;
+	long long calls = s ? s->calls.load( relaxed ) : 0;
+	if( !calls )
+	    continue;
+
+	VALUE c = rb_hash_new();
+	SetInt( c, "calls", calls );
+	SetInt( c, "errors", s->errors.load( relaxed ) );
+	SetInt( c, "records", s->records.load( relaxed ) );
+	SetInt( c, "bytes", s->bytes.load( relaxed ) );
+	SetSeconds( c, "time", s->micros.load( relaxed ) );
+	SetSeconds( c, "p50", Percentile( s, calls, 0.50 ) );
+	SetSeconds( c, "p90", Percentile( s, calls, 0.90 ) );
+	SetSeconds( c, "p99", Percentile( s, calls, 0.99 ) );
+	SetSeconds( c, "max", s->maxMicros.load( relaxed ) );
+
+	rb_hash_aset( cmds, P4Utils::ruby_string( s == &overflow ?
+					"other" : s->name ), c );
+    }
+
+    rb_hash_aset( h, P4Utils::ruby_string( "commands" ), cmds );
+    SetInt( h, "connects", connects.load( relaxed ) );
+    SetInt( h, "connect_failures", connectFailures.load( relaxed ) );
+    SetInt( h, "reconnects", reconnects.load( relaxed ) );
+    return h;
+}
+
+//
+// Prometheus wants cumulative buckets on fixed bounds, so the fine
+// buckets are folded into these. A fine bucket is counted under a bound
+// only once all of it lies below that bound.
+//
+static const double promBounds[] = {
+    .001, .0025, .005, .01, .025, .05, .1, .25, .5, 1, 2.5, 5, 10, 30, 60
+};
+
+static void
+Append( std::string &out, const char *fmt, ... )
+{
+    char buf[ 256 ];
+    va_list ap;
+    va_start( ap, fmt );
+    vsnprintf( buf, sizeof( buf ), fmt, ap );
+    va_end( ap );
+    out += buf;
+}
+
+static void
+Header( std::string &out, const char *name, const char *type, const char *help )
+{
+    Append( out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type );
+}
+
+static std::string
+Label( const char *cmd )
+{
+    std::string l;
+    for( const char *p = cmd; *p; p++ )
+    {
+	if( *p == '\\' || *p == '"' ) l += '\\';
+	if( *p == '\n' ) { l += "\\n"; continue; }
+	l += *p;
+    }
+    return l;
+}
+
+VALUE
+P4Metrics::Prometheus()
+{
+    static const struct {
+	const char *name;
+	const char *help;
+	std::atomic<long long> Slot::*field;
+    } counters[] = {
+	{ "p4ruby_commands_total", "Commands run.", &Slot::calls },
+	{ "p4ruby_command_errors_total", "Commands that reported errors.",
+		&Slot::errors },
+	{ "p4ruby_command_records_total", "Tagged records received.",
+		&Slot::records },
+	{ "p4ruby_command_bytes_total", "Bytes sent and received.",
+		&Slot::bytes },
+    };
+
+    Slot *live[ MAX_COMMANDS + 1 ];
+    std::string names[ MAX_COMMANDS + 1 ];
+    int n = 0;
+
+    for( int i = 0; i <= MAX_COMMANDS; i++ )
+    {
+	Slot *s = i < MAX_COMMANDS ?
+		    slots[ i ].load( std::memory_order_acquire ) : &overflow;
+	if( s && s->calls.load( relaxed ) )
+	{
+	    names[ n ] = Label( s == &overflow ? "other" : s->name );
+	    live[ n++ ] = s;
+	}
+    }
+
+    std::string out;
+    for( size_t c = 0; c < sizeof( counters ) / sizeof( counters[0] ); c++ )
+    {
+	Header( out, counters[ c ].name, "counter", counters[ c ].help );
+	for( int i = 0; i < n; i++ )
+	    Append( out, "%s{command=\"%s\"} %lld\n", counters[ c ].name,
+		names[ i ].c_str(), ( live[ i ]->*counters[ c ].field ).load( relaxed ) );
+    }
+
+    const char *hist = "p4ruby_command_duration_seconds";
+    Header( out, hist, "histogram", "Command latency." );
+    for( int i = 0; i < n; i++ )
+    {
+	Slot *s = live[ i ];
+	const char *l = names[ i ].c_str();
+	long long total = 0;
+	int b = 0;
+
+	for( size_t k = 0; k < sizeof( promBounds ) / sizeof( double ); k++ )
+	{
+	    long long bound = (long long)( promBounds[ k ] * 1e6 );
+	    for( ; b < BUCKETS && BucketHigh( b ) <= bound; b++ )
+		total += s->buckets[ b ].load( relaxed );
+	    Append( out, "%s_bucket{command=\"%s\",le=\"%g\"} %lld\n",
+		hist, l, promBounds[ k ], total );
+	}
+
+	long long calls = s->calls.load( relaxed );
+	Append( out, "%s_bucket{command=\"%s\",le=\"+Inf\"} %lld\n",
+		hist, l, calls );
+	Append( out, "%s_sum{command=\"%s\"} %.6f\n",
+		hist, l, s->micros.load( relaxed ) / 1e6 );
+	Append( out, "%s_count{command=\"%s\"} %lld\n", hist, l, calls );
+    }
+
+    Header( out, "p4ruby_connects_total", "counter", "Successful connects." );
+    Append( out, "p4ruby_connects_total %lld\n", connects.load( relaxed ) );
+    Header( out, "p4ruby_connect_failures_total", "counter",
+		"Failed connects." );
+    Append( out, "p4ruby_connect_failures_total %lld\n",
+		connectFailures.load( relaxed ) );
+    Header( out, "p4ruby_reconnects_total", "counter",
+		"Reconnects after a dropped connection." );
+    Append( out, "p4ruby_reconnects_total %lld\n", reconnects.load( relaxed ) );
+
+    return P4Utils::ruby_string( out.c_str(), out.size() );
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4metrics.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Process-wide counters and latency histograms for
+ * 		  every command run by any P4 instance.
+ *
+ ******************************************************************************/
+
+#include <atomic>
+
+//
+// All updates are relaxed atomic adds on per-command slots, so any
+// number of threads may record at once without taking a lock. Slots are
+// claimed on first use of a command name and live until the process
+// exits.
+//
+class P4Metrics
+{
+    public:
+	// Called once a command has finished
+	static void	Command( const char *cmd, long long nanos, int failed,
+				long long records, long long bytes );
+
+	static void	Connected();
+	static void	ConnectFailed();
+	static void	Reconnected();
+
+	// Zero every counter, keeping the slots
+	static void	Reset();
+
+	// Current values as a Hash, or in the Prometheus text format
+	static VALUE	Snapshot();
+	static VALUE	Prometheus();
+
+	//
+	// Latency is kept in microseconds in log-linear buckets: each power
+	// of two is split into SUB_BUCKETS, which bounds the error to one
+	// part in eight whatever the magnitude.
+	//
+	enum {
+	    SUB_BITS		= 3,
+	    SUB_BUCKETS		= 1 << SUB_BITS,
+	    MAX_BITS		= 40,		// ~12 days
+	    BUCKETS		= ( MAX_BITS - SUB_BITS + 1 ) * SUB_BUCKETS
+					+ SUB_BUCKETS,
+	    MAX_COMMANDS	= 256,
+	    NAME_LEN		= 32
+	};
+
+	struct Slot
+	{
+	    char			name[ NAME_LEN ];
+	    std::atomic<long long>	calls;
+	    std::atomic<long long>	errors;
+	    std::atomic<long long>	records;
+	    std::atomic<long long>	bytes;
+	    std::atomic<long long>	micros;
+	    std::atomic<long long>	maxMicros;
+	    std::atomic<long long>	buckets[ BUCKETS ];
+	};
+
+	static int		Bucket( long long micros );
+	static long long	BucketHigh( int bucket );
+
+    private:
+	static Slot *	Find( const char *cmd );
+	static long long Percentile( Slot *s, long long calls, double p );
+};
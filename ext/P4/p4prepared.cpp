@@ -0,0 +1,229 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4prepared.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: A command with its leading arguments and protocol
+ * 		  variables worked out once, for running many times
+ * 		  with different trailing arguments.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <p4/spec.h>
+#include "p4track.h"
+#include "p4result.h"
+#include "p4commandstats.h"
+#include "clientuserruby.h"
+#include "specmgr.h"
+#include "p4clientapi.h"
+#include "p4utils.h"
+#include "p4prepared.h"
+
+P4Prepared::P4Prepared( VALUE o, P4ClientApi *api, VALUE c, VALUE args )
+{
+    self = Qnil;
+    owner = o;
+    p4 = api;
+    cmd = StringValuePtr( c );
+
+    VALUE flat = P4Utils::flatten( args );
+    long n = RARRAY_LEN( flat );
+    for( long i = 0; i < n; i++ )
+    {
+	VALUE v = rb_obj_as_string( RARRAY_AREF( flat, i ) );
+	pinned.push_back( std::string( RSTRING_PTR( v ), RSTRING_LEN( v ) ) );
+    }
+
+    for( size_t i = 0; i < pinned.size(); i++ )
+	argv.push_back( &pinned[ i ][ 0 ] );
+
+    p4->GetRunVars( vars );
+
+    batchCount = 0;
+    batchBytes = 0;
+    streamed = Qnil;
+    block = Qnil;
+}
+
+VALUE
+P4Prepared::Call( VALUE args )
+{
+    VALUE flat = P4Utils::flatten( args );
+    long n = RARRAY_LEN( flat );
+
+    // Keep the converted strings where the GC can see them
+    VALUE strs = rb_ary_new_capa( n );
+
+    argv.resize( pinned.size() );
+    for( long i = 0; i < n; i++ )
+    {
+	VALUE s = rb_obj_as_string( RARRAY_AREF( flat, i ) );
+	rb_ary_push( strs, s );
+	argv.push_back( StringValuePtr( s ) );
+    }
+    argv.push_back( 0 );
+
+    int argc = (int)argv.size() - 1;
+    VALUE r = p4->Run( cmd.c_str(), argc, &argv[ 0 ], &vars );
+    RB_GC_GUARD( strs );
+    return r;
+}
+
+VALUE
+P4Prepared::Stream( VALUE source, long maxCount, long maxBytes )
+{
+    if( maxCount < 1 )
+	rb_raise( rb_eArgError, "Batch size must be at least 1" );
+
+    batchCount = maxCount;
+    batchBytes = maxBytes;
+    batch.clear();
+    offsets.clear();
+
+    //
+    // The block has to be captured here: inside StreamItem, rb_yield()
+    // would go to the block of the 'each' call instead.
+    //
+    RB_OBJ_WRITE( self, &block, rb_block_given_p() ? rb_block_proc() : Qnil );
+    RB_OBJ_WRITE( self, &streamed, NIL_P( block ) ? rb_ary_new() : Qnil );
+
+    // IO objects give us lines, anything else is taken to be Enumerable
+    ID each = rb_respond_to( source, rb_intern( "each_line" ) ) &&
+		!RB_TYPE_P( source, T_ARRAY ) ?
+		rb_intern( "each_line" ) : rb_intern( "each" );
+
+    rb_block_call( source, each, 0, 0, StreamItem, (VALUE)this );
+    Flush();
+
+    VALUE r = streamed;
+    streamed = Qnil;
+    block = Qnil;
+    return NIL_P( r ) ? Qtrue : r;
+}
+
+VALUE
+P4Prepared::StreamItem( RB_BLOCK_CALL_FUNC_ARGLIST( item, data ) )
+{
+    P4Prepared *p = (P4Prepared *)data;
+    VALUE s = rb_obj_as_string( item );
+    const char *t = RSTRING_PTR( s );
+    long len = RSTRING_LEN( s );
+
+    // Lines from an IO come with their terminators
+    while( len && ( t[ len - 1 ] == '\n' || t[ len - 1 ] == '\r' ) )
+	len--;
+    if( !len )
+	return Qnil;
+
+    if( !p->offsets.empty() &&
+	( (long)p->offsets.size() >= p->batchCount ||
+	  (long)( p->batch.size() + len ) > p->batchBytes ) )
+	p->Flush();
+
+    p->offsets.push_back( p->batch.size() );
+    p->batch.append( t, len );
+    p->batch.push_back( '\0' );
+    return Qnil;
+}
+
+void
+P4Prepared::Flush()
+{
+    if( offsets.empty() )
+	return;
+
+    argv.resize( pinned.size() );
+    for( size_t i = 0; i < offsets.size(); i++ )
+	argv.push_back( &batch[ offsets[ i ] ] );
+    argv.push_back( 0 );
+
+    int argc = (int)argv.size() - 1;
+    VALUE r = p4->Run( cmd.c_str(), argc, &argv[ 0 ], &vars );
+
+    batch.clear();
+    offsets.clear();
+
+    if( !NIL_P( block ) )
+	rb_funcall( block, rb_intern( "call" ), 1, r );
+    else if( RB_TYPE_P( r, T_ARRAY ) )
+	rb_ary_concat( streamed, r );
+}
+
+VALUE
+P4Prepared::GetCommand()
+{
+    return P4Utils::ruby_string( cmd.c_str(), cmd.size() );
+}
+
+VALUE
+P4Prepared::GetArgs()
+{
+    VALUE a = rb_ary_new_capa( pinned.size() );
+    for( size_t i = 0; i < pinned.size(); i++ )
+	rb_ary_push( a, P4Utils::ruby_string( pinned[ i ].c_str(),
+						pinned[ i ].size() ) );
+    return a;
+}
+
+void
+P4Prepared::SetSelf( VALUE s )
+{
+    self = s;
+    RB_OBJ_WRITTEN( self, Qundef, owner );
+}
+
+void
+P4Prepared::GCMark()
+{
+    rb_gc_mark_movable( owner );
+    rb_gc_mark_movable( streamed );
+    rb_gc_mark_movable( block );
+}
+
+void
+P4Prepared::GCCompact()
+{
+    owner = rb_gc_location( owner );
+    streamed = rb_gc_location( streamed );
+    block = rb_gc_location( block );
+}
+
+size_t
+P4Prepared::MemSize()
+{
+    size_t size = sizeof( *this ) + batch.capacity() +
+		  argv.capacity() * sizeof( char * ) +
+		  offsets.capacity() * sizeof( size_t );
+    for( size_t i = 0; i < pinned.size(); i++ )
+	size += sizeof( std::string ) + pinned[ i ].capacity();
+    return size;
+}
@@ -0,0 +1,95 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4prepared.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: A command with its leading arguments and protocol
+ * 		  variables worked out once, for running many times
+ * 		  with different trailing arguments.
+ *
+ ******************************************************************************/
+
+#include <string>
+#include <vector>
+
+class P4Prepared
+{
+    public:
+	// Batch limits used by Stream() when none are given. The count
+	// matches the p4 command line's default for -x.
+	enum {
+	    BATCH_COUNT	= 128,
+	    BATCH_BYTES	= 128 * 1024
+	};
+
+	P4Prepared( VALUE owner, P4ClientApi *p4, VALUE cmd, VALUE args );
+
+	// Run the command with these arguments after the pinned ones
+	VALUE	Call( VALUE args );
+
+	//
+	// Run the command over every line or element of source, in batches
+	// of at most maxCount arguments or maxBytes of argument text. Only
+	// one batch is held at a time. Each batch's results are yielded if
+	// a block is given, otherwise they're all returned together.
+	//
+	VALUE	Stream( VALUE source, long maxCount, long maxBytes );
+
+	VALUE	GetCommand();
+	VALUE	GetArgs();
+
+	// Ruby garbage collection. SetSelf() is given the wrapping object,
+	// for the write barrier.
+	void	SetSelf( VALUE s );
+	void	GCMark();
+	void	GCCompact();
+	size_t	MemSize();
+
+    private:
+	static VALUE	StreamItem( RB_BLOCK_CALL_FUNC_ARGLIST( item, data ) );
+	void		Flush();
+
+	VALUE				self;
+	VALUE				owner;	// The P4 object
+	P4ClientApi *			p4;
+	std::string			cmd;
+	std::vector<std::string>	pinned;
+	std::vector<char *>		argv;
+	P4RunVars			vars;
+
+	// The batch being built by Stream(). Members rather than locals so
+	// nothing leaks if a command raises part way through.
+	std::string			batch;
+	std::vector<size_t>		offsets;
+	long				batchCount;
+	long				batchBytes;
+	VALUE				streamed;
+	VALUE				block;
+};
@@ -0,0 +1,246 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4printstore.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Local store of printed file content, shared between
+ * 		  processes and keyed by digest or by revision.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <p4/md5.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <atomic>
+#ifdef OS_NT
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+#include "p4rubydebug.h"
+#include "p4utils.h"
+#include "p4printstore.h"
+
+#ifdef OS_NT
+static const char *	SEP = "\\";
+#else
+static const char *	SEP = "/";
+#endif
+
+// Distinguishes temporary files from other P4 objects in this process,
+// which may be storing from several Ractors at once
+static std::atomic<unsigned int>	tmpCount( 0 );
+
+P4PrintStore::P4PrintStore()
+{
+    debug = 0;
+    hits = misses = stores = bytesServed = 0;
+}
+
+void
+P4PrintStore::SetDir( const char *d )
+{
+    dir = d ? d : "";
+}
+
+void
+P4PrintStore::Path( const StrPtr &name, StrBuf &path )
+{
+    path.Set( dir );
+    path << SEP;
+    path.Append( name.Text(), 2 );
+    path << SEP << name;
+}
+
+void
+P4PrintStore::Digest( const char *data, long length, StrBuf &digest )
+{
+    MD5 md5;
+
+    // MD5::Update() takes a StrPtr, so big files go in slices
+    const long slice = 64 * 1024 * 1024;
+    for( long done = 0; done < length; done += slice )
+    {
+	long n = length - done < slice ? length - done : slice;
+	StrRef s( data + done, (int) n );
+	md5.Update( s );
+    }
+    md5.Final( digest );
+}
+
+VALUE
+P4PrintStore::Load( const StrPtr &name, int enc )
+{
+    StrBuf path;
+    Path( name, path );
+
+    VALUE content = Qnil;
+
+#ifdef OS_NT
+    FILE *f = fopen( path.Text(), "rb" );
+    if( f )
+    {
+	std::string data;
+	char buf[ 65536 ];
+	size_t n;
+	while( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
+	    data.append( buf, n );
+	if( !ferror( f ) )
+	    content = P4Utils::ruby_string( enc, data.data(),
+						(long) data.size() );
+	fclose( f );
+	if( content != Qnil ) _utime( path.Text(), 0 );
+    }
+#else
+    int fd = open( path.Text(), O_RDONLY );
+    if( fd >= 0 )
+    {
+	struct stat st;
+	if( !fstat( fd, &st ) )
+	{
+	    if( !st.st_size )
+		content = P4Utils::ruby_string( enc, "", 0 );
+	    else
+	    {
+		void *m = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+		if( m != MAP_FAILED )
+		{
+		    content = P4Utils::ruby_string( enc, (const char *) m,
+							(long) st.st_size );
+		    munmap( m, st.st_size );
+		}
+	    }
+	}
+	close( fd );
+
+	// Keep the modification time as the last use, so that a store
+	// can be trimmed from cron by age
+	if( content != Qnil ) utime( path.Text(), 0 );
+    }
+#endif
+
+    if( content != Qnil && P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Print store hit: %s\n", path.Text() );
+    return content;
+}
+
+VALUE
+P4PrintStore::Fetch( const StrPtr *digest, const StrPtr &rev, int enc )
+{
+    VALUE content = digest ? Load( *digest, enc ) : Qnil;
+    if( content == Qnil )
+	content = Load( rev, enc );
+
+    if( content == Qnil )
+    {
+	misses++;
+	return Qnil;
+    }
+
+    hits++;
+    bytesServed += RSTRING_LEN( content );
+    return content;
+}
+
+void
+P4PrintStore::Store( const StrPtr &name, const char *data, long length )
+{
+    StrBuf path, tmp;
+    Path( name, path );
+
+    // The subdirectory, and the store itself, may not exist yet. If
+    // another process gets there first that's fine.
+    tmp.Set( dir );
+#ifdef OS_NT
+    _mkdir( tmp.Text() );
+    tmp << SEP;
+    tmp.Append( name.Text(), 2 );
+    _mkdir( tmp.Text() );
+#else
+    mkdir( tmp.Text(), 0777 );
+    tmp << SEP;
+    tmp.Append( name.Text(), 2 );
+    mkdir( tmp.Text(), 0777 );
+#endif
+
+    tmp.Set( path );
+    tmp << "." << (int) getpid() << "." << (int) ++tmpCount << ".tmp";
+
+    FILE *f = fopen( tmp.Text(), "wb" );
+    if( !f )
+	return;
+
+    size_t written = length ? fwrite( data, 1, length, f ) : 0;
+    if( fclose( f ) || written != (size_t) length )
+    {
+	remove( tmp.Text() );
+	return;
+    }
+
+    // Windows won't rename over an existing file, but if the entry is
+    // already there someone else has stored the same content.
+    if( rename( tmp.Text(), path.Text() ) )
+    {
+	remove( tmp.Text() );
+	return;
+    }
+
+    stores++;
+
+    if( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Print store added: %s\n", path.Text() );
+}
+
+static void
+SetCount( VALUE h, const char *key, P4INT64 v )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( key ), LL2NUM( v ) );
+}
+
+VALUE
+P4PrintStore::GetStats()
+{
+    VALUE h = rb_hash_new();
+    SetCount( h, "hits", hits );
+    SetCount( h, "misses", misses );
+    SetCount( h, "stores", stores );
+    SetCount( h, "bytes_served", bytesServed );
+    return h;
+}
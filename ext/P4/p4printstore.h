@@ -0,0 +1,87 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4printstore.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Local store of printed file content, shared between
+ * 		  processes and keyed by digest or by revision.
+ *
+ ******************************************************************************/
+
+//
+// Content is kept one file per entry, in a subdirectory named after the
+// first two characters of the entry's name. Names are the upper case
+// hex MD5 digest of the content, the same as the digest reported by
+// fstat -Ol, or a digest of the port, charset, depot path and revision
+// for content that doesn't match the server's digest or that the server
+// translates when printing it. Entries are written to a temporary file
+// and renamed into place, so any number of processes can fill the same
+// store and no reader ever sees a partial file.
+//
+class P4PrintStore
+{
+    public:
+	P4PrintStore();
+
+	void		SetDebug( int d )	{ debug = d;		}
+
+	// An empty directory turns the store off
+	void		SetDir( const char *d );
+	const StrPtr &	GetDir()		{ return dir;		}
+	int		IsOn()			{ return dir.Length();	}
+
+	// The content stored under the digest, or failing that under the
+	// revision's name, as a Ruby string in encoding enc. Qnil if it's
+	// in neither. Pass no digest for content the server translates, as
+	// a stored entry with the same digest holds the untranslated bytes.
+	VALUE		Fetch( const StrPtr *digest, const StrPtr &rev,
+				int enc );
+
+	void		Store( const StrPtr &name, const char *data,
+				long length );
+
+	// Upper case hex MD5 of the data, as reported by fstat -Ol
+	static void	Digest( const char *data, long length,
+				StrBuf &digest );
+
+	VALUE		GetStats();
+
+    private:
+	VALUE		Load( const StrPtr &name, int enc );
+	void		Path( const StrPtr &name, StrBuf &path );
+
+	int		debug;
+	StrBuf		dir;
+
+	P4INT64		hits;
+	P4INT64		misses;
+	P4INT64		stores;
+	P4INT64		bytesServed;
+};
@@ -0,0 +1,681 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4querycache.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Opt-in read-through cache for the results of queries
+ * 		  that can't change, such as describe of a submitted
+ * 		  change. Entries are files shared between processes.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#ifdef OS_NT
+#include <windows.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+#include "p4rubydebug.h"
+#include "p4utils.h"
+#include "p4querycache.h"
+
+static const char	MAGIC[ 4 ] = { 'P', '4', 'Q', 'C' };
+static const char *	SUFFIX = ".p4qc";
+
+enum {
+    R_STAT	= 'S',
+    R_TEXT	= 'T',
+    R_BINARY	= 'B',
+    R_END	= 'E'
+};
+
+P4QueryCache::P4QueryCache()
+{
+    debug = 0;
+    limit = DEFAULT_LIMIT;
+    size = 0;
+    scanned = 0;
+    recording = 0;
+    submittedOnly = 0;
+    depotOnly = 0;
+    submitted = 0;
+    hits = misses = stores = evictions = 0;
+}
+
+void
+P4QueryCache::SetDir( const char *d )
+{
+    dir = d ? d : "";
+    scanned = 0;
+}
+
+//
+// Commands whose output is fixed once every file argument names a
+// specific revision or change, and the flags that take a value.
+//
+struct CacheableCmd
+{
+    const char *	cmd;
+    const char *	valueFlags;
+    const char *	refused;
+};
+
+static const CacheableCmd cacheableCmds[] = {
+    { "describe",	"m",		"S" },
+    { "filelog",	"m",		"" },
+    { "files",		"m",		"" },
+    { "fstat",		"FTmeA",	"R" },
+    { "print",		"m",		"o" },
+    { 0, 0, 0 }
+};
+
+static int
+AllDigits( const char *p, const char *end )
+{
+    if( p == end ) return 0;
+    for( ; p < end; p++ )
+	if( *p < '0' || *p > '9' )
+	    return 0;
+    return 1;
+}
+
+//
+// True if the argument is a path pinned to a revision or change number:
+// file#3, file@123 or a range of those. A revision only pins a single
+// file; //depot/...#1 grows as files are added. Changes are pinned only
+// once they're submitted, which the caller checks against the highest
+// change number given, returned in change.
+//
+static int
+Pinned( const char *arg, P4INT64 &change )
+{
+    const char *rev = strpbrk( arg, "@#" );
+    if( !rev || rev == arg ) return 0;
+
+    std::string path( arg, rev - arg );
+    int wild = path.find( "..." ) != std::string::npos ||
+	       path.find( '*' ) != std::string::npos ||
+	       path.find( "%%" ) != std::string::npos;
+
+    char kind = *rev;
+    while( *rev )
+    {
+	const char *end = strchr( rev, ',' );
+	if( !end ) end = rev + strlen( rev );
+
+	if( *rev == '@' || *rev == '#' ) kind = *rev++;
+	if( !AllDigits( rev, end ) ) return 0;
+
+	if( kind == '#' && wild )
+	    return 0;
+	if( kind == '@' )
+	{
+	    P4INT64 n = atoll( std::string( rev, end - rev ).c_str() );
+	    if( n > change ) change = n;
+	}
+
+	rev = *end ? end + 1 : end;
+    }
+    return 1;
+}
+
+int
+P4QueryCache::Cacheable( const char *cmd, int argc, char * const *argv,
+			 P4INT64 &change )
+{
+    change = 0;
+
+    const CacheableCmd *c = cacheableCmds;
+    for( ; c->cmd; c++ )
+	if( !strcmp( c->cmd, cmd ) )
+	    break;
+    if( !c->cmd ) return 0;
+
+    int describe = !strcmp( cmd, "describe" );
+    int files = 0;
+
+    for( int i = 0; i < argc; i++ )
+    {
+	const char *a = argv[ i ];
+	if( a[ 0 ] == '-' && a[ 1 ] )
+	{
+	    if( strchr( c->refused, a[ 1 ] ) )
+		return 0;
+	    if( !a[ 2 ] && strchr( c->valueFlags, a[ 1 ] ) )
+		i++;
+	    continue;
+	}
+
+	if( describe ? !AllDigits( a, a + strlen( a ) ) : !Pinned( a, change ) )
+	    return 0;
+	files++;
+    }
+    return files > 0;
+}
+
+//
+// Entries are named after a 64-bit FNV-1a hash of the key. The key is
+// also stored in the entry and compared on lookup, so a collision is
+// only a miss.
+//
+void
+P4QueryCache::Path( const StrPtr &k, StrBuf &path )
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for( int i = 0; i < k.Length(); i++ )
+    {
+	h ^= (unsigned char) k.Text()[ i ];
+	h *= 1099511628211ULL;
+    }
+
+    char name[ 24 ];
+    snprintf( name, sizeof( name ), "%016llx", h );
+
+    path.Set( dir );
+#ifdef OS_NT
+    path << "\\";
+#else
+    path << "/";
+#endif
+    path << name << SUFFIX;
+}
+
+static unsigned int
+Get32( const char *&p, const char *end, int &ok )
+{
+    unsigned int v = 0;
+    if( end - p < 4 ) { ok = 0; return 0; }
+    memcpy( &v, p, 4 );
+    p += 4;
+    return v;
+}
+
+static const char *
+GetBytes( const char *&p, const char *end, unsigned int len, int &ok )
+{
+    if( (unsigned int)( end - p ) < len ) { ok = 0; return 0; }
+    const char *r = p;
+    p += len;
+    return r;
+}
+
+//
+// Walk an entry, replaying it into ui if it's complete and its key
+// matches. Returns 0 if it doesn't.
+//
+static int
+ReplayEntry( const char *p, const char *end, const StrPtr &key,
+		ClientUser *ui )
+{
+    int ok = 1;
+
+    const char *magic = GetBytes( p, end, 4, ok );
+    if( !ok || memcmp( magic, MAGIC, 4 ) ) return 0;
+    if( Get32( p, end, ok ) != P4QueryCache::VERSION || !ok ) return 0;
+
+    unsigned int klen = Get32( p, end, ok );
+    const char *k = GetBytes( p, end, klen, ok );
+    if( !ok || klen != (unsigned int) key.Length() ||
+	memcmp( k, key.Text(), klen ) )
+	return 0;
+
+    // Check the entry is complete before replaying any of it
+    const char *start = p;
+    for( ;; )
+    {
+	const char *t = GetBytes( p, end, 1, ok );
+	if( !ok ) return 0;
+	if( *t == R_END ) break;
+
+	unsigned int n = Get32( p, end, ok );
+	if( *t == R_STAT )
+	    for( unsigned int i = 0; ok && i < n * 2; i++ )
+		GetBytes( p, end, Get32( p, end, ok ), ok );
+	else if( *t == R_TEXT || *t == R_BINARY )
+	    GetBytes( p, end, n, ok );
+	else
+	    return 0;
+	if( !ok ) return 0;
+    }
+
+    for( p = start; *p != R_END; )
+    {
+	char t = *p++;
+	unsigned int n = Get32( p, end, ok );
+
+	if( t == R_STAT )
+	{
+	    StrBufDict dict;
+	    for( unsigned int i = 0; i < n; i++ )
+	    {
+		unsigned int vl = Get32( p, end, ok );
+		StrRef var( GetBytes( p, end, vl, ok ), vl );
+		unsigned int ll = Get32( p, end, ok );
+		StrRef val( GetBytes( p, end, ll, ok ), ll );
+		dict.SetVar( var, val );
+	    }
+	    ui->OutputStat( &dict );
+	}
+	else
+	{
+	    const char *data = GetBytes( p, end, n, ok );
+	    if( t == R_TEXT )
+		ui->OutputText( data, n );
+	    else
+		ui->OutputBinary( data, n );
+	}
+    }
+    return 1;
+}
+
+//
+// The cache's own queries of the server, run outside the Ruby results:
+// only the first tagged record is kept and messages are dropped.
+//
+class P4CacheProbe : public ClientUser
+{
+    public:
+    P4CacheProbe() : got( 0 ) {}
+
+    void	OutputStat( StrDict *v )
+    {
+	if( !got ) values.CopyVars( *v );
+	got = 1;
+    }
+    void	Message( Error * )		{}
+    void	HandleError( Error * )		{}
+    void	OutputError( const char * )	{}
+    void	OutputInfo( char, const char * ) {}
+
+    StrBufDict	values;
+    int		got;
+};
+
+void
+P4QueryCache::Probe( ClientApi *client, const char *cmd, int argc,
+		     char * const *argv, StrBufDict &values )
+{
+    P4CacheProbe probe;
+    client->SetVar( "tag" );
+    client->SetArgv( argc, argv );
+    client->Run( cmd, &probe );
+    values = probe.values;
+}
+
+//
+// Who the server says it is, for the keys. The server id if one is
+// set, or the address it reports for itself.
+//
+void
+P4QueryCache::ServerId( ClientApi *client, StrBuf &id )
+{
+    StrBufDict info;
+    char *argv[] = { (char *) "-s", 0 };
+    Probe( client, "info", 1, argv, info );
+
+    StrPtr *v = info.GetVar( "serverID" );
+    if( !v || !v->Length() )
+	v = info.GetVar( "serverAddress" );
+    id.Set( v ? v->Text() : "" );
+}
+
+//
+// The newest submitted change the user can see. Changes hidden by the
+// protections table only make this lower, which is the safe side.
+//
+P4INT64
+P4QueryCache::SubmittedChange( ClientApi *client )
+{
+    StrBufDict changes;
+    char *argv[] = { (char *) "-m1", (char *) "-ssubmitted", 0 };
+    Probe( client, "changes", 2, argv, changes );
+
+    StrPtr *v = changes.GetVar( "change" );
+    return v ? v->Atoi64() : 0;
+}
+
+int
+P4QueryCache::Replay( const StrPtr &k, ClientUser *ui )
+{
+    StrBuf path;
+    Path( k, path );
+
+    int hit = 0;
+
+#ifdef OS_NT
+    FILE *f = fopen( path.Text(), "rb" );
+    if( f )
+    {
+	std::string data;
+	char buf[ 65536 ];
+	size_t n;
+	while( ( n = fread( buf, 1, sizeof( buf ), f ) ) > 0 )
+	    data.append( buf, n );
+	fclose( f );
+	hit = ReplayEntry( data.data(), data.data() + data.size(), k, ui );
+	if( hit ) _utime( path.Text(), 0 );
+    }
+#else
+    int fd = open( path.Text(), O_RDONLY );
+    if( fd >= 0 )
+    {
+	struct stat st;
+	void *m = MAP_FAILED;
+	if( !fstat( fd, &st ) && st.st_size > 0 )
+	    m = mmap( 0, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if( m != MAP_FAILED )
+	{
+	    const char *p = (const char *) m;
+	    hit = ReplayEntry( p, p + st.st_size, k, ui );
+	    munmap( m, st.st_size );
+	}
+	if( hit ) utime( path.Text(), 0 );
+    }
+#endif
+
+    if( hit ) hits++; else misses++;
+
+    if( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Query cache %s: %s\n", hit ? "hit" : "miss",
+		path.Text() );
+    return hit;
+}
+
+void
+P4QueryCache::Begin( const StrPtr &k, const char *cmd )
+{
+    key.Set( k );
+    recording = 1;
+    submittedOnly = !strcmp( cmd, "describe" );
+    depotOnly = !strcmp( cmd, "fstat" );
+    submitted = 0;
+
+    entry.clear();
+    Put( MAGIC, 4 );
+    Put32( VERSION );
+    Put32( key.Length() );
+    Put( key.Text(), key.Length() );
+}
+
+void
+P4QueryCache::Put32( unsigned int v )
+{
+    entry.append( (const char *) &v, 4 );
+}
+
+void
+P4QueryCache::Put( const char *data, int length )
+{
+    entry.append( data, length );
+}
+
+//
+// Fields that reflect the state of the workspace rather than the
+// depot; fstat output with any of them isn't fixed.
+//
+static const char * const clientState[] = {
+    "haveRev", "action", "otherOpen", "ourLock", "otherLock",
+    "resolved", "unresolved", 0
+};
+
+void
+P4QueryCache::Stat( StrDict *values )
+{
+    if( !recording ) return;
+
+    StrPtr *status = values->GetVar( "status" );
+    if( submittedOnly && status )
+    {
+	if( *status != "submitted" )
+	{
+	    recording = 0;
+	    return;
+	}
+	submitted = 1;
+    }
+
+    for( int i = 0; depotOnly && clientState[ i ]; i++ )
+	if( values->GetVar( clientState[ i ] ) )
+	{
+	    recording = 0;
+	    return;
+	}
+
+    StrRef var, val;
+    int n = 0;
+    while( values->GetVar( n, var, val ) )
+	n++;
+
+    entry += (char) R_STAT;
+    Put32( n );
+    for( int i = 0; i < n; i++ )
+    {
+	values->GetVar( i, var, val );
+	Put32( var.Length() );
+	Put( var.Text(), var.Length() );
+	Put32( val.Length() );
+	Put( val.Text(), val.Length() );
+    }
+}
+
+void
+P4QueryCache::Text( const char *data, int length )
+{
+    if( !recording ) return;
+    entry += (char) R_TEXT;
+    Put32( length );
+    Put( data, length );
+}
+
+void
+P4QueryCache::Binary( const char *data, int length )
+{
+    if( !recording ) return;
+    entry += (char) R_BINARY;
+    Put32( length );
+    Put( data, length );
+}
+
+void
+P4QueryCache::Commit()
+{
+    // Untagged describe output doesn't say whether the change is
+    // submitted, so only the tagged form is kept.
+    int keep = recording && ( !submittedOnly || submitted );
+    recording = 0;
+
+    entry += (char) R_END;
+    if( !keep || (P4INT64) entry.size() > limit / 4 )
+    {
+	entry.clear();
+	return;
+    }
+
+    StrBuf path, tmp;
+    Path( key, path );
+
+    tmp << path << "." << (int) getpid() << ".tmp";
+
+    FILE *f = fopen( tmp.Text(), "wb" );
+    if( !f )
+    {
+	entry.clear();
+	return;
+    }
+
+    size_t written = fwrite( entry.data(), 1, entry.size(), f );
+    if( fclose( f ) || written != entry.size() )
+    {
+	remove( tmp.Text() );
+	entry.clear();
+	return;
+    }
+
+#ifdef OS_NT
+    // Windows won't rename over an existing file
+    remove( path.Text() );
+#endif
+    if( rename( tmp.Text(), path.Text() ) )
+    {
+	remove( tmp.Text() );
+	entry.clear();
+	return;
+    }
+
+    stores++;
+    size += entry.size();
+    entry.clear();
+
+    if( !scanned || size > limit )
+	Evict();
+}
+
+struct CacheFile
+{
+    std::string	path;
+    P4INT64	size;
+    time_t	mtime;
+
+    bool operator<( const CacheFile &o ) const { return mtime < o.mtime; }
+};
+
+static void
+ListEntries( const StrPtr &dir, std::vector<CacheFile> &files )
+{
+    size_t sl = strlen( SUFFIX );
+
+#ifdef OS_NT
+    StrBuf pattern;
+    pattern << dir << "\\*" << SUFFIX;
+
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA( pattern.Text(), &fd );
+    if( h == INVALID_HANDLE_VALUE ) return;
+    do
+    {
+	CacheFile c;
+	c.path = std::string( dir.Text() ) + "\\" + fd.cFileName;
+	c.size = ( (P4INT64) fd.nFileSizeHigh << 32 ) | fd.nFileSizeLow;
+	c.mtime = ( ( (P4INT64) fd.ftLastWriteTime.dwHighDateTime << 32 ) |
+		    fd.ftLastWriteTime.dwLowDateTime ) / 10000000;
+	files.push_back( c );
+    } while( FindNextFileA( h, &fd ) );
+    FindClose( h );
+#else
+    DIR *d = opendir( dir.Text() );
+    if( !d ) return;
+
+    struct dirent *e;
+    while( ( e = readdir( d ) ) )
+    {
+	size_t l = strlen( e->d_name );
+	if( l <= sl || strcmp( e->d_name + l - sl, SUFFIX ) )
+	    continue;
+
+	CacheFile c;
+	c.path = std::string( dir.Text() ) + "/" + e->d_name;
+
+	struct stat st;
+	if( stat( c.path.c_str(), &st ) )
+	    continue;
+	c.size = st.st_size;
+	c.mtime = st.st_mtime;
+	files.push_back( c );
+    }
+    closedir( d );
+#endif
+}
+
+//
+// Work out how big the directory really is, since other processes
+// share it, and remove the least recently used entries until it's back
+// under 90% of the limit.
+//
+void
+P4QueryCache::Evict()
+{
+    std::vector<CacheFile> files;
+    ListEntries( dir, files );
+
+    size = 0;
+    for( size_t i = 0; i < files.size(); i++ )
+	size += files[ i ].size;
+    scanned = 1;
+
+    if( size <= limit )
+	return;
+
+    std::sort( files.begin(), files.end() );
+
+    P4INT64 target = limit / 10 * 9;
+    for( size_t i = 0; i < files.size() && size > target; i++ )
+    {
+	if( remove( files[ i ].path.c_str() ) )
+	    continue;
+	size -= files[ i ].size;
+	evictions++;
+    }
+
+    if( P4RDB_COMMANDS )
+	fprintf( stderr, "[P4] Query cache trimmed to %lld bytes\n", size );
+}
+
+static void
+SetCount( VALUE h, const char *key, P4INT64 v )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( key ), LL2NUM( v ) );
+}
+
+VALUE
+P4QueryCache::GetStats()
+{
+    VALUE h = rb_hash_new();
+    SetCount( h, "hits", hits );
+    SetCount( h, "misses", misses );
+    SetCount( h, "stores", stores );
+    SetCount( h, "evictions", evictions );
+    return h;
+}
@@ -0,0 +1,124 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4querycache.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Opt-in read-through cache for the results of queries
+ * 		  that can't change, such as describe of a submitted
+ * 		  change. Entries are files shared between processes.
+ *
+ ******************************************************************************/
+
+#include <string>
+
+//
+// Each entry is one file in the cache directory, named after a hash of
+// its key. The file holds the key followed by the raw output callbacks
+// of the command, so a hit is replayed through the same ClientUser
+// methods as live output. Entries are written to a temporary file and
+// renamed into place, so readers never see a partial entry, and least
+// recently used entries are removed once the directory grows past the
+// size limit.
+//
+class P4QueryCache
+{
+    public:
+	P4QueryCache();
+
+	void		SetDebug( int d )	{ debug = d;		}
+
+	// An empty directory turns the cache off
+	void		SetDir( const char *d );
+	const StrPtr &	GetDir()		{ return dir;		}
+	int		IsOn()			{ return dir.Length();	}
+
+	void		SetLimit( P4INT64 l )	{ limit = l;		}
+	P4INT64		GetLimit()		{ return limit;		}
+
+	// Whether the output of the command can never change, as long
+	// as every change up to 'change' has been submitted
+	static int	Cacheable( const char *cmd, int argc,
+				char * const *argv, P4INT64 &change );
+
+	// What keys and Cacheable() need to know of the server. These
+	// run commands of their own on the connection.
+	static void	ServerId( ClientApi *client, StrBuf &id );
+	static P4INT64	SubmittedChange( ClientApi *client );
+
+	// Play a stored result back into ui. Returns 0 on a miss.
+	int		Replay( const StrPtr &key, ClientUser *ui );
+
+	//
+	// Recording a result. Begin() starts a new entry and the output
+	// callbacks are added as they arrive. Any message abandons the
+	// entry, as does a describe of a change that isn't submitted or
+	// fstat output that shows the state of the workspace.
+	// Commit() writes out whatever survived.
+	//
+	void		Begin( const StrPtr &key, const char *cmd );
+	void		Stat( StrDict *values );
+	void		Text( const char *data, int length );
+	void		Binary( const char *data, int length );
+	void		Abandon()		{ recording = 0;	}
+	void		Commit();
+
+	VALUE		GetStats();
+
+	enum {
+	    VERSION		= 1,
+	    DEFAULT_LIMIT	= 256 * 1024 * 1024
+	};
+
+    private:
+	static void	Probe( ClientApi *client, const char *cmd, int argc,
+				char * const *argv, StrBufDict &values );
+	void		Path( const StrPtr &key, StrBuf &path );
+	void		Put32( unsigned int v );
+	void		Put( const char *data, int length );
+	void		Evict();
+
+	int		debug;
+	StrBuf		dir;
+	P4INT64		limit;
+	P4INT64		size;		// estimated size of the directory
+	int		scanned;
+
+	int		recording;
+	int		submittedOnly;
+	int		depotOnly;
+	int		submitted;
+	StrBuf		key;
+	std::string	entry;
+
+	P4INT64		hits;
+	P4INT64		misses;
+	P4INT64		stores;
+	P4INT64		evictions;
+};
@@ -0,0 +1,203 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4resolverules.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Path based resolve policy. Rules map file patterns
+ * 		  to resolve actions and are evaluated natively, so
+ * 		  only files no rule covers are handed to Ruby.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <p4/mapapi.h>
+#include "p4resolverules.h"
+
+P4ResolveRules::P4ResolveRules()
+{
+    caseSensitive = 1;
+    caseKnown = 0;
+    caseSource = 0;
+}
+
+P4ResolveRules::~P4ResolveRules()
+{
+    Clear();
+}
+
+void
+P4ResolveRules::Clear()
+{
+    for( size_t i = 0; i < rules.size(); i++ )
+	delete rules[ i ].map;
+    rules.clear();
+}
+
+void
+P4ResolveRules::SetCaseSource( ClientApi *c )
+{
+    caseSource = c;
+    caseKnown = 0;
+}
+
+//
+// The server's protocol has arrived by the time it asks us to resolve
+// anything. Until it has, paths match case sensitively.
+//
+void
+P4ResolveRules::LearnCase()
+{
+    if( !caseSource || !caseSource->GetProtocol( P4Tag::v_server2 ) )
+	return;
+
+    SetCaseSensitivity( !caseSource->GetProtocol( P4Tag::v_nocase ) );
+}
+
+void
+P4ResolveRules::SetCaseSensitivity( int c )
+{
+    caseSensitive = c;
+    caseKnown = 1;
+    for( size_t i = 0; i < rules.size(); i++ )
+	rules[ i ].map->SetCaseSensitivity( c ? Sensitive : Insensitive );
+}
+
+P4ResolveRules::Action
+P4ResolveRules::Parse( const StrPtr &a )
+{
+    if( a == "ay" || a == "yours" )	return YOURS;
+    if( a == "at" || a == "theirs" )	return THEIRS;
+    if( a == "am" || a == "merged" )	return MERGED;
+    if( a == "s"  || a == "skip" )	return SKIP;
+    if( a == "automerge" )		return AUTOMERGE;
+    if( a == "as" || a == "safe" )	return SAFE;
+    return NONE;
+}
+
+int
+P4ResolveRules::Add( const StrPtr &pattern, const StrPtr &action )
+{
+    Rule r;
+    r.action = Parse( action );
+    if( r.action == NONE )
+	return 0;
+
+    r.map = new MapApi;
+    r.map->SetCaseSensitivity( caseSensitive ? Sensitive : Insensitive );
+    r.map->Insert( pattern );
+    rules.push_back( r );
+    return 1;
+}
+
+P4ResolveRules::Action
+P4ResolveRules::Match( const StrPtr &path )
+{
+    StrBuf to;
+    for( size_t i = rules.size(); i > 0; i-- )
+	if( rules[ i - 1 ].map->Translate( path, to ) )
+	    return rules[ i - 1 ].action;
+    return NONE;
+}
+
+P4ResolveRules::Action
+P4ResolveRules::Match( StrDict *vars, FileSys *yours )
+{
+    //
+    // yourName is in client syntax and theirName in depot syntax with
+    // a revision on the end; action resolves only report the depot
+    // and client files.
+    //
+    static const char * const names[] = {
+	"yourName", "theirName", "clientFile", "fromFile", 0
+    };
+
+    Action a = NONE;
+    StrPtr *v;
+    StrBuf path;
+
+    if( !caseKnown )
+	LearnCase();
+
+    for( int i = 0; a == NONE && names[ i ]; i++ )
+    {
+	if( !vars || !( v = vars->GetVar( names[ i ] ) ) )
+	    continue;
+
+	const char *rev = strchr( v->Text(), '#' );
+	if( rev )
+	{
+	    path.Set( v->Text(), rev - v->Text() );
+	    a = Match( path );
+	}
+	else
+	{
+	    a = Match( *v );
+	}
+    }
+
+    if( a == NONE && yours )
+    {
+	path = yours->Name();
+	for( char *p = path.Text(); *p; p++ )
+	    if( *p == '\\' ) *p = '/';
+	a = Match( path );
+    }
+
+    return a;
+}
+
+MergeStatus
+P4ResolveRules::Apply( Action a, ClientMerge *m )
+{
+    switch( a )
+    {
+    case YOURS:		return CMS_YOURS;
+    case THEIRS:	return CMS_THEIRS;
+    case MERGED:	return CMS_MERGED;
+    case AUTOMERGE:	return m->AutoResolve( CMF_AUTO );
+    case SAFE:		return m->AutoResolve( CMF_SAFE );
+    default:		return CMS_SKIP;
+    }
+}
+
+MergeStatus
+P4ResolveRules::Apply( Action a, ClientResolveA *m )
+{
+    switch( a )
+    {
+    case YOURS:		return CMS_YOURS;
+    case THEIRS:	return CMS_THEIRS;
+    case MERGED:	return CMS_MERGED;
+    case AUTOMERGE:	return m->AutoResolve( CMF_AUTO );
+    case SAFE:		return m->AutoResolve( CMF_SAFE );
+    default:		return CMS_SKIP;
+    }
+}
@@ -0,0 +1,100 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4resolverules.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Path based resolve policy. Rules map file patterns
+ * 		  to resolve actions and are evaluated natively, so
+ * 		  only files no rule covers are handed to Ruby.
+ *
+ ******************************************************************************/
+
+#include <vector>
+
+class MapApi;
+class ClientApi;
+class P4ResolveRules
+{
+    public:
+	enum Action {
+	    NONE,		// No rule covers the file
+	    YOURS,		// ay
+	    THEIRS,		// at
+	    MERGED,		// am: accept the merged result as is
+	    SKIP,		// s
+	    AUTOMERGE,		// merge if there are no conflicts, else skip
+	    SAFE		// accept only if one side changed, else skip
+	};
+
+	P4ResolveRules();
+	~P4ResolveRules();
+
+	void	Clear();
+	int	Count()			{ return (int) rules.size();	}
+	void	SetCaseSensitivity( int caseSensitive );
+
+	//
+	// The connection whose server decides whether paths match case
+	// sensitively. It's only asked once a resolve is under way, from
+	// the protocol the server sent, so setting rules never has to run
+	// a command. Setting it again forgets what we learnt.
+	//
+	void	SetCaseSource( ClientApi *c );
+
+	// Returns 0 if the action name is not recognised
+	int	Add( const StrPtr &pattern, const StrPtr &action );
+
+	//
+	// Find the action for the file being resolved. The names the
+	// server sent for the resolve are tried first, then the local
+	// path. Later rules take precedence over earlier ones, as in a
+	// P4::Map.
+	//
+	Action	Match( StrDict *vars, FileSys *yours );
+
+	MergeStatus	Apply( Action a, ClientMerge *m );
+	MergeStatus	Apply( Action a, ClientResolveA *m );
+
+	static Action	Parse( const StrPtr &action );
+
+    private:
+	Action	Match( const StrPtr &path );
+	void	LearnCase();
+
+	struct Rule {
+	    MapApi *	map;
+	    Action	action;
+	};
+
+	std::vector<Rule>	rules;
+	int			caseSensitive;
+	int			caseKnown;
+	ClientApi *		caseSource;
+};
@@ -36,39 +36,140 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 
 #include <ruby.h>
+#include <ruby/ractor.h>
 #include "undefdups.h"
 #include <p4/clientapi.h>
+#include <algorithm>
 #include "gc_hack.h"
 #include "p4error.h"
 #include "p4utils.h"
+#include "p4track.h"
 #include "p4result.h"
 
+extern VALUE	cP4Msg;	// Message class
+
+static VALUE emptyResult = Qnil;
+
 P4Result::P4Result()
 {
-    output = rb_ary_new();
-    warnings = rb_ary_new();
-    errors = rb_ary_new();
-    messages = rb_ary_new();
-    track = rb_ary_new();
+    owner = Qnil;
+    output = Qnil;
+    spare = Qnil;
+    reuse = 0;
+    encoding = P4Utils::EncodingIndex( 0, 0 );
+    warnings = Qnil;
+    errors = Qnil;
+    messages = Qnil;
+    track = Qnil;
+    formatted = 0;
+    errorCount = 0;
+    warningCount = 0;
     apiLevel = atoi( P4Tag::l_client );
-    ID	idP4 	= rb_intern( "P4" );
-    ID	idP4Msg	= rb_intern( "Message" );
-
-    VALUE cP4	= rb_const_get_at( rb_cObject, idP4 );
-    cP4Msg	= rb_const_get_at( cP4, idP4Msg );
-
     Reset();
 }
 
+P4Result::~P4Result()
+{
+    Clear();
+}
 
 void
 P4Result::Reset()
 {
-    output = rb_ary_new();
-    warnings = rb_ary_new();
-    errors = rb_ary_new();
-    messages = rb_ary_new();
-    track = rb_ary_new();
+    Clear();
+
+    // The output array is only made when the command has some output,
+    // and in reuse mode it's the last command's array, emptied.
+    Retire();
+    warnings = Qnil;
+    errors = Qnil;
+    messages = Qnil;
+    track = Qnil;
+}
+
+//
+// Done with the output array. In reuse mode it's kept for the next
+// command, unless the caller froze it to keep it; otherwise it belongs
+// to whoever it was handed to.
+//
+void
+P4Result::Retire()
+{
+    if( reuse && output != Qnil && !OBJ_FROZEN( output ) )
+    {
+	rb_ary_clear( output );
+	Set( spare, output );
+    }
+    output = Qnil;
+}
+
+void
+P4Result::Clear()
+{
+    buf.clear();
+
+    msgs.clear();
+    trackData.Reset();
+    formatted = 0;
+    errorCount = 0;
+    warningCount = 0;
+}
+
+void
+P4Result::Set( VALUE &slot, VALUE v )
+{
+    if( owner != Qnil )
+	RB_OBJ_WRITE( owner, &slot, v );
+    else
+	slot = v;
+}
+
+void
+P4Result::SetReuse( int r )
+{
+    reuse = r;
+    if( !reuse ) spare = Qnil;
+}
+
+VALUE
+P4Result::Output()
+{
+    if( output != Qnil )
+	return output;
+
+    if( spare != Qnil )
+    {
+	Set( output, spare );
+	spare = Qnil;
+    }
+    else
+	Set( output, rb_ary_new() );
+    return output;
+}
+
+//
+// The frozen empty array returned in reuse mode for results that have
+// nothing in them. Made up front and shareable, so every Ractor can
+// hand out the same one.
+//
+void
+P4Result::Init()
+{
+    emptyResult = rb_ractor_make_shareable( rb_ary_new() );
+    rb_gc_register_mark_object( emptyResult );
+}
+
+VALUE
+P4Result::Empty()
+{
+    return emptyResult;
+}
+
+long
+P4Result::Size()
+{
+    long n = output == Qnil ? 0 : RARRAY_LEN( output );
+    return n + errorCount + warningCount;
 }
 
 //
@@ -78,7 +179,7 @@ P4Result::Reset()
 void
 P4Result::AddOutput( VALUE v )
 {
-    rb_ary_push( output, v );
+    rb_ary_push( Output(), v );
 
     //
     // Call the ruby thread scheduler to allow another thread to run
@@ -89,35 +190,53 @@ P4Result::AddOutput( VALUE v )
 }
 
 /*
- * Main distribution of output to the user. This method sorts the
- * output into groups: output, warnings, errors, and sends all output
- * (regardless of severity) to the messages array.
+ * Main distribution of output to the user. Messages are kept marshalled
+ * in a native buffer, and sorted into output, warnings and errors (and
+ * wrapped as P4::Message objects) only when the caller asks for them.
+ * Informational messages reserve their place in the output array so
+ * that they still interleave correctly with other output.
  */
 void
 P4Result::AddMessage( Error *e )
 {
+    Message m;
 
-    int s;
-    s = e->GetSeverity();
+    scratch.Clear();
+    e->Marshall2( scratch );
+    m.offset = buf.size();
+    m.length = scratch.Length();
+    m.severity = e->GetSeverity();
+    m.slot = -1;
+    buf.append( scratch.Text(), scratch.Length() );
 
     // 
     // Empty and informational messages are pushed out as output as nothing
     // worthy of error handling has occurred. Warnings go into the warnings
     // list and the rest are lumped together as errors.
     //
-
-    if ( s == E_EMPTY || s == E_INFO )
-	rb_ary_push( output, FmtMessage( e ) );
-    else if ( s == E_WARN )
-	rb_ary_push( warnings, FmtMessage( e ) );
+    if ( m.severity == E_EMPTY || m.severity == E_INFO )
+    {
+	m.slot = RARRAY_LEN( Output() );
+	rb_ary_push( output, Qnil );
+    }
+    else if ( m.severity == E_WARN )
+    {
+	warningCount++;
+	if( warnings != Qnil )
+	    rb_ary_push( warnings, FmtMessage( e ) );
+    }
     else
-	rb_ary_push( errors, FmtMessage( e ) );
+    {
+	errorCount++;
+	if( errors != Qnil )
+	    rb_ary_push( errors, FmtMessage( e ) );
+    }
 
-    //
-    // Whatever severity, format the message into the messages array, wrapped
-    // up in a P4::Message object.
-    //
-    rb_ary_push( messages, WrapMessage( e ) );
+    // Keep the messages array current once someone has asked for it
+    if( messages != Qnil )
+	rb_ary_push( messages, WrapMessage( e ) );
+
+    msgs.push_back( m );
 
     //
     // Call the ruby thread scheduler to allow another thread to run
@@ -127,121 +246,209 @@ P4Result::AddMessage( Error *e )
     rb_thread_schedule();
 }
 
-void
-P4Result::AddTrack( const char *msg )
+VALUE
+P4Result::GetOutput()
 {
-    rb_ary_push( track,  P4Utils::ruby_string( msg ) );
-
-    //
-    // Call the ruby thread scheduler to allow another thread to run
-    // now. We should perhaps only call this every 'n' times, but I've 
-    // no idea what a good value for n might be; so for now at least, n=1
-    //
-    rb_thread_schedule();
+    if( output == Qnil && reuse )
+	return Empty();
+    Output();
+
+    // Fill in the slots reserved for any messages we haven't formatted
+    for( ; formatted < msgs.size(); formatted++ )
+    {
+	Message &m = msgs[ formatted ];
+	if( m.slot < 0 )
+	    continue;
+
+	Error e;
+	Unpack( m, e );
+	rb_ary_store( output, m.slot, FmtMessage( &e ) );
+    }
+    return output;
 }
 
-void
-P4Result::DeleteTrack()
+VALUE
+P4Result::GetErrors()
 {
-    rb_ary_clear( track );
+    if( errors == Qnil && !errorCount && reuse )
+	return Empty();
 
-    //
-    // Call the ruby thread scheduler to allow another thread to run
-    // now. We should perhaps only call this every 'n' times, but I've
-    // no idea what a good value for n might be; so for now at least, n=1
-    //
-    rb_thread_schedule();
+    if( errors == Qnil )
+	Set( errors, Collect( E_FAILED, E_FATAL ) );
+    return errors;
 }
 
-void
-P4Result::AddTrack( VALUE t )
+VALUE
+P4Result::GetWarnings()
 {
-    rb_ary_push( track, t );
+    if( warnings == Qnil && !warningCount && reuse )
+	return Empty();
 
-    //
-    // Call the ruby thread scheduler to allow another thread to run
-    // now. We should perhaps only call this every 'n' times, but I've 
-    // no idea what a good value for n might be; so for now at least, n=1
-    //
-    rb_thread_schedule();
+    if( warnings == Qnil )
+	Set( warnings, Collect( E_WARN, E_WARN ) );
+    return warnings;
 }
 
-int
-P4Result::ErrorCount()
+VALUE
+P4Result::GetMessages()
 {
-    return Length( errors );
+    if( messages == Qnil && msgs.empty() && reuse )
+	return Empty();
+
+    if( messages == Qnil )
+    {
+	VALUE m = rb_ary_new2( msgs.size() );
+	for( size_t i = 0; i < msgs.size(); i++ )
+	{
+	    Error e;
+	    Unpack( msgs[ i ], e );
+	    rb_ary_push( m, WrapMessage( &e ) );
+	}
+	Set( messages, m );
+    }
+    return messages;
 }
 
-int
-P4Result::WarningCount()
+VALUE
+P4Result::Collect( int minSev, int maxSev )
 {
-    return Length( warnings );
+    VALUE ary = rb_ary_new();
+    for( size_t i = 0; i < msgs.size(); i++ )
+    {
+	if( msgs[ i ].severity < minSev || msgs[ i ].severity > maxSev )
+	    continue;
+
+	Error e;
+	Unpack( msgs[ i ], e );
+	rb_ary_push( ary, FmtMessage( &e ) );
+    }
+    return ary;
 }
 
+//
+// Message suppression. Ids are the values returned by P4::Message#msgid,
+// kept sorted so the check on each message is a binary search.
+//
 void
-P4Result::FmtErrors( StrBuf &buf )
+P4Result::SetSuppressed( VALUE ids )
 {
-    Fmt( "[Error]: ", errors, buf );
+    suppressed.clear();
+    if( ids == Qnil ) return;
+
+    Check_Type( ids, T_ARRAY );
+    for( long i = 0; i < RARRAY_LEN( ids ); i++ )
+	suppressed.push_back( NUM2INT( rb_ary_entry( ids, i ) ) );
+
+    std::sort( suppressed.begin(), suppressed.end() );
 }
 
-void
-P4Result::FmtWarnings( StrBuf &buf )
+VALUE
+P4Result::GetSuppressed()
 {
-    Fmt( "[Warning]: ", warnings, buf );
+    VALUE ary = rb_ary_new2( suppressed.size() );
+    for( size_t i = 0; i < suppressed.size(); i++ )
+	rb_ary_push( ary, INT2NUM( suppressed[ i ] ) );
+    return ary;
 }
 
-
 int
-P4Result::Length( VALUE ary )
+P4Result::IsSuppressed( Error *e )
 {
-    ID		iLength;
-    VALUE 	len;
+    if( suppressed.empty() ) return 0;
 
-    iLength = rb_intern( "length" );
+    ErrorId *id = e->GetId( 0 );
+    if( !id ) return 0;
 
-    len = rb_funcall( ary, iLength, 0 );
-    return NUM2INT( len );
+    return std::binary_search( suppressed.begin(), suppressed.end(),
+				id->UniqueCode() );
 }
 
+//
+// Tracking output is kept natively; the array of lines is only built if
+// someone asks for it.
+//
 void
-P4Result::GCMark()
+P4Result::AddTrack( const char *data, int length )
+{
+    trackData.Add( data, length );
+    track = Qnil;
+}
+
+VALUE
+P4Result::GetTrack()
 {
-    rb_gc_mark( output );
-    rb_gc_mark( errors );
-    rb_gc_mark( warnings );
-    rb_gc_mark( messages );
-    rb_gc_mark( track );
+    if( track == Qnil )
+	Set( track, trackData.Lines( encoding ) );
+    return track;
 }
 
+void
+P4Result::FmtErrors( StrBuf &buf )
+{
+    Fmt( "[Error]: ", E_FAILED, E_FATAL, buf );
+}
 
 void
-P4Result::Fmt( const char *label, VALUE ary, StrBuf &buf )
+P4Result::FmtWarnings( StrBuf &buf )
 {
-    ID		idJoin;
-    VALUE	s1;
-    StrBuf	csep;
-    VALUE	rsep;
+    Fmt( "[Warning]: ", E_WARN, E_WARN, buf );
+}
 
-    buf.Clear();
-    // If the array is empty, then we just return
-    if( ! Length( ary ) ) return;
+void
+P4Result::GCMark()
+{
+    rb_gc_mark_movable( output );
+    rb_gc_mark_movable( spare );
+    rb_gc_mark_movable( errors );
+    rb_gc_mark_movable( warnings );
+    rb_gc_mark_movable( messages );
+    rb_gc_mark_movable( track );
+}
+
+void
+P4Result::GCCompact()
+{
+    output = rb_gc_location( output );
+    spare = rb_gc_location( spare );
+    errors = rb_gc_location( errors );
+    warnings = rb_gc_location( warnings );
+    messages = rb_gc_location( messages );
+    track = rb_gc_location( track );
+}
 
-    // Not empty, so we'll format it. 
-    idJoin 	= rb_intern( "join" );
- 
-    // This is the string we'll use to prefix each entry in the array
-    csep << "\n\t" << label;
-    rsep =  P4Utils::ruby_string( csep.Text() );
+//
+// Native memory beyond the object itself: the held messages and the
+// suppression list.
+//
+size_t
+P4Result::MemSize()
+{
+    return msgs.capacity() * sizeof( Message ) +
+	   buf.capacity() + scratch.BufSize() +
+	   suppressed.capacity() * sizeof( int );
+}
 
-    // Since Array#join() won't prefix the first element with the separator
-    // we'll have to do it manually.
-    buf << csep;
 
-    // Join the array elements together, and append the result to the buffer
-    s1 		= rb_funcall( ary, idJoin, 1, rsep );
-    buf << StringValuePtr( s1 );
+//
+// Formats the matching messages straight from the native list, each one
+// prefixed with "\n\t" and the label.
+//
+void
+P4Result::Fmt( const char *label, int minSev, int maxSev, StrBuf &buf )
+{
+    buf.Clear();
 
-    return;
+    for( size_t i = 0; i < msgs.size(); i++ )
+    {
+	if( msgs[ i ].severity < minSev || msgs[ i ].severity > maxSev )
+	    continue;
+
+	Error e;
+	StrBuf t;
+	Unpack( msgs[ i ], e );
+	e.Fmt( t, EF_PLAIN );
+	buf << "\n\t" << label << t;
+    }
 }
 
 VALUE
@@ -249,12 +456,19 @@ P4Result::FmtMessage( Error *e )
 {
     StrBuf t;
     e->Fmt( t, EF_PLAIN );
-    return  P4Utils::ruby_string( t.Text(), t.Length() );
+    return  P4Utils::ruby_string( encoding, t );
 }
 
 VALUE
 P4Result::WrapMessage( Error *e )
 {
-    P4Error *pe = new P4Error( *e );
+    P4Error *pe = new P4Error( *e, encoding );
     return pe->Wrap( cP4Msg );
 }
+
+void
+P4Result::Unpack( const Message &m, Error &e )
+{
+    StrRef r( buf.data() + m.offset, m.length );
+    e.UnMarshall2( r );
+}
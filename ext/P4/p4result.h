@@ -34,53 +34,115 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  ******************************************************************************/
 
+#include <vector>
+#include <string>
+
 class P4Result
 {
     public:
 
     P4Result();
+    ~P4Result();
+
+    // Creates the shared empty result. Called once from Init_P4.
+    static void	Init();
     
     // Setting
     void	AddOutput( VALUE v );
     void	AddMessage( Error *e );
-    void	AddTrack( const char *msg );
-    void	AddTrack( VALUE t );
-    void 	DeleteTrack();
+    void	AddTrack( const char *data, int length );
 
-    // Getting
-    VALUE	GetOutput()	{ return output;	}
-    VALUE	GetErrors()	{ return errors;	}
-    VALUE	GetWarnings()	{ return warnings;	}
-    VALUE	GetMessages()	{ return messages;	}
-    VALUE 	GetTrack()	{ return track;         }
+    // Getting. Messages are held natively and only converted to Ruby
+    // strings and P4::Message objects when these are called.
+    VALUE	GetOutput();
+    VALUE	GetErrors();
+    VALUE	GetWarnings();
+    VALUE	GetMessages();
+    VALUE 	GetTrack();
+    VALUE	GetTrackData()	{ return trackData.Parse( encoding ); }
 
     // Get errors/warnings as a formatted string
     void	FmtErrors( StrBuf &buf );
     void	FmtWarnings( StrBuf &buf );
 
+    // Messages to drop on arrival, by unique message id
+    void	SetSuppressed( VALUE ids );
+    VALUE	GetSuppressed();
+    int		IsSuppressed( Error *e );
+
     // Set API level for backwards compatibility
     void	SetApiLevel( int l )	{ apiLevel = l; }
+
+    // Encoding index for the strings we create. See
+    // P4Utils::EncodingIndex().
+    void	SetEncoding( int e )	{ encoding = e;	}
     // Testing
-    int		ErrorCount();
-    int		WarningCount();
+    int		ErrorCount()		{ return errorCount;	}
+    int		WarningCount()		{ return warningCount;	}
+    // Entries held across output, errors and warnings
+    long	Size();
 
     // Clear previous results
     void	Reset();
 
-    // Ruby garbage collection
+    //
+    // Reuse mode, for callers that run many small commands. The output
+    // array handed out is cleared and refilled by the next command
+    // instead of a new one being made, so it's only valid until then;
+    // callers that keep results must copy or freeze them. Empty results
+    // are a single shared frozen array.
+    //
+    void	SetReuse( int r );
+    int		GetReuse()		{ return reuse;		}
+
+    // Ruby garbage collection. Once the owner, the P4 object, is set,
+    // stores into our VALUEs go through its write barrier.
+    void	SetOwner( VALUE o )	{ owner = o;		}
     void	GCMark();
+    void	GCCompact();
+    size_t	MemSize();
 
     private:
-    int		Length( VALUE ary );
-    void	Fmt( const char *label, VALUE ary, StrBuf &buf );
+    //
+    // Messages are held marshalled, end to end in buf, and are only
+    // unmarshalled when they're formatted or wrapped.
+    //
+    struct Message
+    {
+	size_t	offset;		// Marshalled Error in buf
+	int	length;
+	int	severity;
+	long	slot;		// Index in output for info messages
+    };
+
+    void	Clear();
+    void	Retire();
+    void	Set( VALUE &slot, VALUE v );
+    VALUE	Output();
+    VALUE	Empty();
+    void	Fmt( const char *label, int minSev, int maxSev, StrBuf &buf );
+    VALUE	Collect( int minSev, int maxSev );
     VALUE	FmtMessage( Error *e );
     VALUE	WrapMessage( Error *e );
+    void	Unpack( const Message &m, Error &e );
 
-    VALUE	cP4Msg;
-    VALUE	output;
+    VALUE	owner;
+    VALUE	output;		// Qnil until there's some
+    VALUE	spare;		// Last output, kept for reuse
     VALUE	warnings;
     VALUE	errors;
     VALUE	messages;
     VALUE	track;
+    P4Track	trackData;
     int		apiLevel;
+    int		encoding;
+    int		reuse;
+
+    std::vector<Message>	msgs;
+    std::string			buf;		// Marshalled messages
+    StrBuf			scratch;
+    size_t			formatted;	// msgs already in output
+    int				errorCount;
+    int				warningCount;
+    std::vector<int>		suppressed;
 };
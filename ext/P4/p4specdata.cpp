@@ -46,62 +46,85 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "p4utils.h"
 #include "p4specdata.h"
 
+//
+// Returns the array holding the lines of the list field sd, creating it
+// if asked to. Qnil if there isn't one.
+//
+VALUE
+SpecDataRuby::ListFor( SpecElem *sd, int create )
+{
+	if( sd == elem )
+	    return list;
+
+	VALUE key = P4Utils::ruby_string( encoding, sd->tag );
+	VALUE ary = rb_hash_aref( hash, key );
+
+	if( ary == Qnil )
+	{
+	    if( !create ) return Qnil;
+	    ary = rb_ary_new();
+	    rb_hash_aset( hash, key, ary );
+	}
+	else if( !rb_obj_is_kind_of( ary, rb_cArray ) )
+	{
+	    rb_warn( "%s should be an array element. Ignoring...", 
+		    sd->tag.Text() );
+	    ary = Qnil;
+	}
+
+	elem = sd;
+	list = ary;
+	return ary;
+}
+
 StrPtr *
 SpecDataRuby::GetLine( SpecElem *sd, int x, const char **cmt )
 {
 	*cmt = 0;
 	VALUE val;
 	VALUE key;
-	StrBuf t;
-
-	key = P4Utils::ruby_string( sd->tag.Text(), sd->tag.Length() );
-	val = rb_hash_aref( hash, key );
-	if( val == Qnil ) return 0;
 
 	if( !sd->IsList() )
 	{
-	    last = StringValuePtr( val );
+	    key = P4Utils::ruby_string( encoding, sd->tag );
+	    val = rb_hash_aref( hash, key );
+	    if( val == Qnil ) return 0;
+
+	    StringValue( val );
+	    last.Set( RSTRING_PTR( val ), RSTRING_LEN( val ) );
 	    return &last;
 	}
 
 	// It's a list, which means we should have an array value here
-	
-	if( !rb_obj_is_kind_of( val, rb_cArray ) )
-	{
-	    rb_warn( "%s should be an array element. Ignoring...", 
-		    sd->tag.Text() );
-	    return 0;
-	}
-	val = rb_ary_entry( val, x );
+
+	VALUE ary = ListFor( sd, 0 );
+	if( ary == Qnil || x >= RARRAY_LEN( ary ) ) return 0;
+
+	val = RARRAY_AREF( ary, x );
 	if( val == Qnil ) return 0;
 
-	last = StringValuePtr( val );
+	StringValue( val );
+	last.Set( RSTRING_PTR( val ), RSTRING_LEN( val ) );
 	return &last;
 }
 
 void	
 SpecDataRuby::SetLine( SpecElem *sd, int x, const StrPtr *v, Error *e )
 {
-	VALUE 	key;
-	VALUE	val;
-	VALUE	ary;
-	StrBuf	t;
-
-	key = P4Utils::ruby_string( sd->tag.Text(), sd->tag.Length() );
-	val = P4Utils::ruby_string( v->Text(), v->Length() );
+	VALUE	val = P4Utils::ruby_string( encoding, *v );
 
 	if( sd->IsList() )
 	{
-	    ary = rb_hash_aref( hash, key );
-	    if( ary == Qnil )
-	    {
-		ary = rb_ary_new();
-		rb_hash_aset( hash, key, ary );
-	    }
-	    rb_ary_store( ary, x, val );
+	    VALUE ary = ListFor( sd, 1 );
+	    if( ary == Qnil ) return;
+	    if( x == RARRAY_LEN( ary ) )
+		rb_ary_push( ary, val );
+	    else
+		rb_ary_store( ary, x, val );
 	}
 	else
 	{
+	    VALUE key = P4Utils::ruby_string( encoding, sd->tag );
 	    rb_hash_aset( hash, key, val );
 	}
 	return;
@@ -110,28 +133,105 @@ SpecDataRuby::SetLine( SpecElem *sd, int x, const StrPtr *v, Error *e )
 void
 SpecDataRuby::Comment ( SpecElem *sd, int x, const char **wv,  int nl, Error *e )
 {
-	VALUE 	key;
-	VALUE	val;
-	VALUE	ary;
-	StrBuf	t;
-
-	key = P4Utils::ruby_string( sd->tag.Text(), sd->tag.Length() );
-	val = P4Utils::ruby_string( *wv );
+	VALUE	val = P4Utils::ruby_string( encoding, *wv );
 
 	if( sd->IsList() )
 	{
-
-	    ary = rb_hash_aref( hash, key ); // rb_hash_aref  - get the value for hash key
-	    if( ary == Qnil )
-	    {
-		ary = rb_ary_new();
-		rb_hash_aset( hash, key, ary ); // rb_hash_aset(hash, key, value) - set the hash key to value
-	    }
+	    VALUE ary = ListFor( sd, 1 );
+	    if( ary == Qnil ) return;
 	    rb_ary_store( ary, x, val );
 	}
 	else
 	{ 
+	    VALUE key = P4Utils::ruby_string( encoding, sd->tag );
 	    rb_hash_aset( hash, key, val );
 	}
 	return;
-}
\ No newline at end of file
+}
+
+StrPtr *
+SpecDataNative::GetLine( SpecElem *sd, int x, const char **cmt )
+{
+	*cmt = 0;
+	if( sd != elem )
+	{
+	    std::string tag( sd->tag.Text(), sd->tag.Length() );
+	    std::unordered_map<std::string,Field>::iterator i =
+		fields.find( tag );
+
+	    elem = sd;
+	    field = i == fields.end() ? 0 : &i->second;
+	}
+
+	if( !field || x >= (int) field->size() ) return 0;
+	return &(*field)[ x ];
+}
+
+void
+SpecDataNative::SetLine( SpecElem *sd, int x, const StrPtr *v, Error *e )
+{
+	parsed.push_back( Line() );
+	Line &l = parsed.back();
+	l.elem = sd;
+	l.x = x;
+	l.comment = 0;
+	l.nl = 0;
+	l.val = *v;
+}
+
+void
+SpecDataNative::Comment( SpecElem *sd, int x, const char **wv, int nl,
+			Error *e )
+{
+	parsed.push_back( Line() );
+	Line &l = parsed.back();
+	l.elem = sd;
+	l.x = x;
+	l.comment = 1;
+	l.nl = nl;
+	l.val = *wv;
+}
+
+void
+SpecDataNative::Load( Spec &s, VALUE hash, int enc )
+{
+	SpecDataRuby	data( hash, enc );
+	const char *	cmt;
+
+	for( int i = 0; i < s.Count(); i++ )
+	{
+	    SpecElem *sd = s.Get( i );
+	    Field f;
+	    StrPtr *v;
+
+	    for( int x = 0; ( v = data.GetLine( sd, x, &cmt ) ); x++ )
+	    {
+		f.push_back( *v );
+		if( !sd->IsList() ) break;
+	    }
+
+	    if( f.size() )
+		fields[ std::string( sd->tag.Text(), sd->tag.Length() ) ] = f;
+	}
+}
+
+void
+SpecDataNative::Replay( VALUE hash, int enc )
+{
+	SpecDataRuby	data( hash, enc );
+	Error		e;
+
+	for( size_t i = 0; i < parsed.size(); i++ )
+	{
+	    Line &l = parsed[ i ];
+	    if( l.comment )
+	    {
+		const char *wv = l.val.Text();
+		data.Comment( l.elem, l.x, &wv, l.nl, &e );
+	    }
+	    else
+	    {
+		data.SetLine( l.elem, l.x, &l.val, &e );
+	    }
+	}
+}
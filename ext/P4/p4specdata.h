@@ -36,10 +36,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *
  ******************************************************************************/
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 class SpecDataRuby : public SpecData
 {
     public:
-	    		SpecDataRuby( VALUE h ) { hash = h; }
+	    		SpecDataRuby( VALUE h, int enc )
+				{ hash = h; encoding = enc; elem = 0; }
 
 	virtual StrPtr *GetLine( SpecElem *sd, int x, const char **cmt );
 	virtual void	SetLine( SpecElem *sd, int x, const StrPtr *val,
@@ -48,7 +53,57 @@ class SpecDataRuby : public SpecData
 	            int nl, Error *e );
 
     private:
+	VALUE	ListFor( SpecElem *sd, int create );
+
 	VALUE	hash;
+	int	encoding;
 	StrBuf	last;
+
+	// The array behind the list field last used. Spec walks each
+	// field's lines in turn, so the key is looked up once per field.
+	SpecElem *	elem;
+	VALUE		list;
 };
 
+
+//
+// SpecData that keeps its lines in native storage so that Spec can parse
+// and format on threads that don't hold the GVL. Load() and Replay() move
+// the lines from and to Ruby hashes, and must be called with the GVL.
+//
+class SpecDataNative : public SpecData
+{
+    public:
+			SpecDataNative() { elem = 0; field = 0; }
+
+	virtual StrPtr *GetLine( SpecElem *sd, int x, const char **cmt );
+	virtual void	SetLine( SpecElem *sd, int x, const StrPtr *val,
+				Error *e );
+	virtual void	Comment( SpecElem *sd, int x, const char **wv,
+	            int nl, Error *e );
+
+	// Copy the fields of hash that s knows about, ready to Format
+	void		Load( Spec &s, VALUE hash, int enc );
+
+	// Apply what Parse produced to hash, in the order it was produced,
+	// as strings in encoding enc. The Spec that did the parsing must
+	// still be alive.
+	void		Replay( VALUE hash, int enc );
+
+    private:
+	struct Line {
+	    SpecElem *	elem;
+	    int		x;
+	    int		comment;
+	    int		nl;
+	    StrBuf	val;
+	};
+
+	typedef std::vector<StrBuf>	Field;
+
+	std::vector<Line>			parsed;
+	std::unordered_map<std::string,Field>	fields;
+
+	SpecElem *	elem;
+	Field *		field;
+};
@@ -0,0 +1,235 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4trace.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Fixed-size ring buffer of binary trace events for
+ * 		  diagnosing problems in production, dumped on demand
+ * 		  or when an exception is raised.
+ *
+ ******************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <mutex>
+#include <thread>
+#include "p4trace.h"
+
+//
+// On-disk layout, all in host byte order (see byteOrder):
+//
+//   header   "P4TRACE\0", version, event size, byte order mark,
+//            reserved, event count, wall clock at start (ns since epoch)
+//   events   count x Event, oldest first
+//
+static const char	TRACE_MAGIC[ 8 ] = { 'P','4','T','R','A','C','E', 0 };
+static const uint32_t	TRACE_VERSION = 1;
+static const uint32_t	TRACE_BYTE_ORDER = 0x01020304;
+
+struct TraceRing
+{
+    uint64_t			size;		// Events allocated
+    std::atomic<uint64_t>	mask;		// Events in use, less one
+    std::atomic<uint64_t>	head;
+    std::atomic<int>		users;		// Writers and dumpers inside
+    std::chrono::steady_clock::time_point	start;
+    uint64_t			wallStart;
+    P4Trace::Event *		events;
+};
+
+std::atomic<int>		P4Trace::enabled( 0 );
+static std::atomic<TraceRing *>	ring( 0 );
+static std::string		dumpFile;
+static std::mutex		startLock;	// One Start at a time
+
+//
+// Holds the current ring for as long as it's in scope. The count is
+// raised before the ring is checked again, so once Start has swapped
+// in a new ring and seen the old one's count at zero, nothing can
+// still be using it.
+//
+class RingRef
+{
+    public:
+    RingRef()
+    {
+	for( ;; )
+	{
+	    r = ring.load();
+	    if( !r ) return;
+	    r->users.fetch_add( 1 );
+	    if( ring.load() == r ) return;
+	    r->users.fetch_sub( 1 );
+	}
+    }
+
+    ~RingRef()
+    {
+	if( r ) r->users.fetch_sub( 1, std::memory_order_release );
+    }
+
+    TraceRing *	r;
+};
+
+static void
+StartClocks( TraceRing *r )
+{
+    r->start = std::chrono::steady_clock::now();
+    r->wallStart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch() ).count();
+}
+
+//
+// A ring big enough for the new capacity is emptied and used again.
+// Otherwise a new one replaces it, and the old one is freed once the
+// writers that were part way through an event have finished with it.
+//
+void
+P4Trace::Start( long capacity )
+{
+    uint64_t size = 1024;
+    while( size < (uint64_t)capacity && size < ( 1u << 26 ) )
+	size <<= 1;
+
+    std::lock_guard<std::mutex> lock( startLock );
+    TraceRing *old = ring.load();
+    if( old && old->size >= size )
+    {
+	enabled.store( 0, std::memory_order_release );
+	old->mask.store( size - 1, std::memory_order_relaxed );
+	old->head.store( 0, std::memory_order_relaxed );
+	StartClocks( old );
+	enabled.store( 1, std::memory_order_release );
+	return;
+    }
+
+    TraceRing *r = new TraceRing;
+    r->size = size;
+    r->mask = size - 1;
+    r->head = 0;
+    r->users = 0;
+    StartClocks( r );
+    r->events = new Event[ size ];
+    memset( r->events, 0, size * sizeof( Event ) );
+
+    ring.store( r );
+    enabled.store( 1, std::memory_order_release );
+
+    if( old )
+    {
+	while( old->users.load() )
+	    std::this_thread::yield();
+	delete [] old->events;
+	delete old;
+    }
+}
+
+void
+P4Trace::Stop()
+{
+    enabled.store( 0, std::memory_order_release );
+}
+
+void
+P4Trace::Add( int type, const void *session, uint32_t size, uint32_t extra,
+		const char *tag )
+{
+    RingRef ref;
+    TraceRing *r = ref.r;
+    if( !r ) return;
+
+    uint64_t n = r->head.fetch_add( 1, std::memory_order_relaxed );
+    Event &e = r->events[ n & r->mask.load( std::memory_order_relaxed ) ];
+
+    e.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - r->start ).count();
+    e.type = (uint16_t)type;
+    e.session = (uint16_t)( ( (uintptr_t)session >> 4 ) & 0xffff );
+    e.size = size;
+    e.extra = extra;
+    if( tag )
+	strncpy( e.tag, tag, sizeof( e.tag ) );
+    else
+	e.tag[ 0 ] = 0;
+}
+
+long
+P4Trace::Dump( const char *path )
+{
+    RingRef ref;
+    TraceRing *r = ref.r;
+    if( !r ) return 0;
+
+    FILE *f = fopen( path, "wb" );
+    if( !f ) return -1;
+
+    uint64_t mask = r->mask.load( std::memory_order_relaxed );
+    uint64_t head = r->head.load( std::memory_order_acquire );
+    uint64_t count = head > mask ? mask + 1 : head;
+    uint32_t eventSize = sizeof( Event );
+    uint32_t reserved = 0;
+
+    int ok = fwrite( TRACE_MAGIC, sizeof( TRACE_MAGIC ), 1, f ) == 1
+	&& fwrite( &TRACE_VERSION, sizeof( uint32_t ), 1, f ) == 1
+	&& fwrite( &eventSize, sizeof( uint32_t ), 1, f ) == 1
+	&& fwrite( &TRACE_BYTE_ORDER, sizeof( uint32_t ), 1, f ) == 1
+	&& fwrite( &reserved, sizeof( uint32_t ), 1, f ) == 1
+	&& fwrite( &count, sizeof( uint64_t ), 1, f ) == 1
+	&& fwrite( &r->wallStart, sizeof( uint64_t ), 1, f ) == 1;
+
+    // Oldest first: the slot after the newest when the ring has wrapped
+    for( uint64_t i = head - count; ok && i < head; i++ )
+	ok = fwrite( &r->events[ i & mask ], sizeof( Event ), 1, f ) == 1;
+
+    if( fclose( f ) || !ok )
+	return -1;
+
+    return (long)count;
+}
+
+void
+P4Trace::SetDumpFile( const char *path )
+{
+    dumpFile = path ? path : "";
+}
+
+const char *
+P4Trace::GetDumpFile()
+{
+    return dumpFile.empty() ? 0 : dumpFile.c_str();
+}
+
+void
+P4Trace::DumpOnException()
+{
+    if( On() && !dumpFile.empty() )
+	Dump( dumpFile.c_str() );
+}
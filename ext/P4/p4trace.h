@@ -0,0 +1,106 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4trace.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Fixed-size ring buffer of binary trace events for
+ * 		  diagnosing problems in production, dumped on demand
+ * 		  or when an exception is raised.
+ *
+ ******************************************************************************/
+
+#include <atomic>
+#include <stdint.h>
+
+//
+// Tracing is process-wide. While it's off, each trace point costs one
+// relaxed load and a branch. While it's on, an event is a 32 byte copy
+// into the next slot of the ring, with no locking and no allocation;
+// writers that lap each other may lose an event, which is fine for
+// diagnostics. Restarting reuses the ring when it's big enough, and
+// frees it once it's idle when it isn't.
+//
+class P4Trace
+{
+    public:
+	enum EventType {
+	    CMD_START = 1,	// tag: command
+	    CMD_END,		// tag: command, size: errors, extra: records
+	    CONNECT,		// size: 1 on success
+	    DISCONNECT,
+	    OUTPUT_TEXT,	// size: bytes
+	    OUTPUT_BINARY,	// size: bytes
+	    OUTPUT_STAT,	// size: fields
+	    MESSAGE,		// size: severity, extra: unique code
+	    INPUT,		// size: bytes
+	    RESOLVE,		// size: 1 for action resolves
+	    EXCEPTION		// tag: function
+	};
+
+	struct Event
+	{
+	    uint64_t	time;		// Nanoseconds since tracing began
+	    uint16_t	type;
+	    uint16_t	session;	// Hash of the P4 object's address
+	    uint32_t	size;
+	    uint32_t	extra;
+	    char	tag[ 12 ];	// Not necessarily terminated
+	};
+
+	static inline int	On()
+	{
+	    return enabled.load( std::memory_order_relaxed );
+	}
+
+	static inline void	Record( int type, const void *session,
+				    uint32_t size = 0, uint32_t extra = 0,
+				    const char *tag = 0 )
+	{
+	    if( On() ) Add( type, session, size, extra, tag );
+	}
+
+	// capacity is rounded up to a power of two
+	static void	Start( long capacity );
+	static void	Stop();
+
+	// Write the events, oldest first. Returns the number written or -1.
+	static long	Dump( const char *path );
+
+	// Where to dump automatically when a P4Exception is raised
+	static void		SetDumpFile( const char *path );
+	static const char *	GetDumpFile();
+	static void		DumpOnException();
+
+    private:
+	static void	Add( int type, const void *session, uint32_t size,
+			    uint32_t extra, const char *tag );
+
+	static std::atomic<int>	enabled;
+};
@@ -0,0 +1,287 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4track.cpp
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Holds the performance tracking output of a command
+ * 		  natively and parses it into a structured Hash on demand.
+ *
+ ******************************************************************************/
+#include <ruby.h>
+#include "undefdups.h"
+#include <p4/clientapi.h>
+#include <stdio.h>
+#include <string.h>
+#include "p4utils.h"
+#include "p4track.h"
+
+static const char	TRACK_PREFIX[] = "--- ";
+static const int	TRACK_PREFIX_LEN = 4;
+
+P4Track::P4Track()
+{
+}
+
+void
+P4Track::Reset()
+{
+    text.clear();
+    lines.clear();
+}
+
+int
+P4Track::IsTrack( const char *data, int length )
+{
+    if( length <= TRACK_PREFIX_LEN || data[ length - 1 ] != '\n' )
+	return 0;
+
+    const char *p = data;
+    const char *end = data + length;
+    while( p < end )
+    {
+	if( end - p <= TRACK_PREFIX_LEN ||
+	    strncmp( p, TRACK_PREFIX, TRACK_PREFIX_LEN ) )
+	    return 0;
+
+	const char *nl = (const char *)memchr( p, '\n', end - p );
+	if( nl == p + TRACK_PREFIX_LEN )
+	    return 0;
+	p = nl + 1;
+    }
+    return 1;
+}
+
+void
+P4Track::Add( const char *data, int length )
+{
+    const char *p = data;
+    const char *end = data + length;
+    while( p < end )
+    {
+	const char *nl = (const char *)memchr( p, '\n', end - p );
+	if( !nl ) break;
+
+	p += TRACK_PREFIX_LEN;
+	lines.push_back( text.size() );
+	text.append( p, nl - p );
+	text.push_back( '\0' );
+	p = nl + 1;
+    }
+}
+
+VALUE
+P4Track::Lines( int enc )
+{
+    VALUE a = rb_ary_new_capa( lines.size() );
+    for( size_t i = 0; i < lines.size(); i++ )
+	rb_ary_push( a, P4Utils::ruby_string( enc, text.c_str() + lines[ i ] ) );
+    return a;
+}
+
+static inline void
+SetInt( VALUE h, const char *key, long long v, int enc )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( enc, key ), LL2NUM( v ) );
+}
+
+static inline void
+SetFloat( VALUE h, const char *key, double v, int enc )
+{
+    rb_hash_aset( h, P4Utils::ruby_string( enc, key ), rb_float_new( v ) );
+}
+
+static VALUE
+SubHash( VALUE h, const char *key, int enc )
+{
+    VALUE k = P4Utils::ruby_string( enc, key );
+    VALUE s = rb_hash_aref( h, k );
+    if( NIL_P( s ) )
+    {
+	s = rb_hash_new();
+	rb_hash_aset( h, k, s );
+    }
+    return s;
+}
+
+//
+// Parses the table detail lines that follow a "db.xxx" header:
+//
+//   pages in+out+cached 3+0+2
+//   locks read/write 1/0 rows get+pos+scan put+del 1+0+0 0+0
+//   total lock wait+held read/write 0ms+0ms/0ms+0ms
+//   max lock wait+held read/write 0ms+0ms/0ms+0ms
+//   peek count 1 wait+held total/max 0ms+0ms/0ms+0ms
+//
+static int
+ParseTableLine( const char *l, VALUE table, int enc )
+{
+    long long a, b, c, d, e, f, g;
+
+    if( sscanf( l, "pages in+out+cached %lld+%lld+%lld", &a, &b, &c ) == 3 )
+    {
+	SetInt( table, "pages_in", a, enc );
+	SetInt( table, "pages_out", b, enc );
+	SetInt( table, "pages_cached", c, enc );
+	return 1;
+    }
+
+    int n = sscanf( l, "locks read/write %lld/%lld rows get+pos+scan put+del "
+		"%lld+%lld+%lld %lld+%lld", &a, &b, &c, &d, &e, &f, &g );
+    if( n >= 2 )
+    {
+	SetInt( table, "locks_read", a, enc );
+	SetInt( table, "locks_write", b, enc );
+	if( n == 7 )
+	{
+	    SetInt( table, "rows_get", c, enc );
+	    SetInt( table, "rows_pos", d, enc );
+	    SetInt( table, "rows_scan", e, enc );
+	    SetInt( table, "rows_put", f, enc );
+	    SetInt( table, "rows_del", g, enc );
+	}
+	return 1;
+    }
+
+    if( sscanf( l, "total lock wait+held read/write %lldms+%lldms/%lldms+%lldms",
+		&a, &b, &c, &d ) == 4 )
+    {
+	SetInt( table, "total_read_wait", a, enc );
+	SetInt( table, "total_read_held", b, enc );
+	SetInt( table, "total_write_wait", c, enc );
+	SetInt( table, "total_write_held", d, enc );
+	return 1;
+    }
+
+    if( sscanf( l, "max lock wait+held read/write %lldms+%lldms/%lldms+%lldms",
+		&a, &b, &c, &d ) == 4 )
+    {
+	SetInt( table, "max_read_wait", a, enc );
+	SetInt( table, "max_read_held", b, enc );
+	SetInt( table, "max_write_wait", c, enc );
+	SetInt( table, "max_write_held", d, enc );
+	return 1;
+    }
+
+    if( sscanf( l, "peek count %lld wait+held total/max "
+		"%lldms+%lldms/%lldms+%lldms", &a, &b, &c, &d, &e ) == 5 )
+    {
+	SetInt( table, "peek_count", a, enc );
+	SetInt( table, "peek_total_wait", b, enc );
+	SetInt( table, "peek_total_held", c, enc );
+	SetInt( table, "peek_max_wait", d, enc );
+	SetInt( table, "peek_max_held", e, enc );
+	return 1;
+    }
+
+    return 0;
+}
+
+VALUE
+P4Track::Parse( int enc )
+{
+    VALUE h = rb_hash_new();
+    VALUE tables = rb_hash_new();
+    VALUE other = rb_ary_new();
+    VALUE table = Qnil;
+
+    rb_hash_aset( h, P4Utils::ruby_string( enc, "tables" ), tables );
+
+    for( size_t i = 0; i < lines.size(); i++ )
+    {
+	const char *l = text.c_str() + lines[ i ];
+	long long a, b, c, d, e, f, g, k;
+	double x, y;
+
+	// Indented lines belong to the last section header seen
+	if( *l == ' ' )
+	{
+	    while( *l == ' ' ) l++;
+	    if( table != Qnil && ParseTableLine( l, table, enc ) )
+		continue;
+	}
+	else if( sscanf( l, "lapse %lfs", &x ) == 1 )
+	{
+	    SetFloat( h, "lapse", x, enc );
+	    continue;
+	}
+	else if( sscanf( l, "usage %lld+%lldus %lld+%lldio %lld+%lldnet "
+			"%lldk %lldpf", &a, &b, &c, &d, &e, &f, &g, &k ) == 8 )
+	{
+	    VALUE u = SubHash( h, "usage", enc );
+	    SetInt( u, "user", a, enc );
+	    SetInt( u, "system", b, enc );
+	    SetInt( u, "io_in", c, enc );
+	    SetInt( u, "io_out", d, enc );
+	    SetInt( u, "net_in", e, enc );
+	    SetInt( u, "net_out", f, enc );
+	    SetInt( u, "max_rss", g, enc );
+	    SetInt( u, "page_faults", k, enc );
+	    continue;
+	}
+	else if( !strncmp( l, "rpc ", 4 ) )
+	{
+	    int n = sscanf( l, "rpc msgs/size in+out %lld+%lld/%lldmb+%lldmb "
+			"himarks %lld/%lld snd/rcv %lfs/%lfs",
+			&a, &b, &c, &d, &e, &f, &x, &y );
+	    if( n >= 4 )
+	    {
+		VALUE r = SubHash( h, "rpc", enc );
+		SetInt( r, "msgs_in", a, enc );
+		SetInt( r, "msgs_out", b, enc );
+		SetInt( r, "size_in", c, enc );
+		SetInt( r, "size_out", d, enc );
+		if( n >= 6 )
+		{
+		    SetInt( r, "himark_snd", e, enc );
+		    SetInt( r, "himark_rcv", f, enc );
+		}
+		if( n == 8 )
+		{
+		    SetFloat( r, "snd", x, enc );
+		    SetFloat( r, "rcv", y, enc );
+		}
+		continue;
+	    }
+	}
+	else if( *l && !strchr( l, ' ' ) )
+	{
+	    // A section header such as "db.counters"
+	    table = SubHash( tables, l, enc );
+	    continue;
+	}
+
+	rb_ary_push( other, P4Utils::ruby_string( enc, text.c_str() + lines[ i ] ) );
+    }
+
+    if( RARRAY_LEN( other ) )
+	rb_hash_aset( h, P4Utils::ruby_string( enc, "other" ), other );
+
+    return h;
+}
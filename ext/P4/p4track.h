@@ -0,0 +1,72 @@
+/*******************************************************************************
+
+Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1.  Redistributions of source code must retain the above copyright
+    notice, this list of conditions and the following disclaimer.
+
+2.  Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE SOFTWARE, INC. BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*******************************************************************************/
+
+/*******************************************************************************
+ * Name		: p4track.h
+ *
+ * Author	: Perforce Software, Inc.
+ *
+ * Description	: Holds the performance tracking output of a command
+ * 		  natively and parses it into a structured Hash on demand.
+ *
+ ******************************************************************************/
+
+#include <string>
+#include <vector>
+
+class P4Track
+{
+    public:
+	P4Track();
+
+	void	Reset();
+
+	//
+	// Returns true if the text output is a block of tracking lines,
+	// each prefixed with "--- " and terminated by a newline.
+	//
+	static int	IsTrack( const char *data, int length );
+
+	// Keep the lines of a tracking block, minus their prefixes
+	void	Add( const char *data, int length );
+
+	int	Count()	{ return (int)lines.size(); }
+
+	// The raw lines, as returned by P4#track_output, as strings in
+	// encoding enc
+	VALUE	Lines( int enc );
+
+	//
+	// The lines parsed into a Hash. Lines that aren't recognised are
+	// kept as strings under "other" so nothing is lost.
+	//
+	VALUE	Parse( int enc );
+
+    private:
+	std::string		text;	// NUL separated lines
+	std::vector<size_t>	lines;	// Offsets into text
+};
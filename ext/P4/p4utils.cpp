@@ -26,37 +26,122 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 *******************************************************************************/
 #include <ruby.h>
+#include <ruby/ractor.h>
 #ifdef HAVE_RUBY_ENCODING_H  
 #include <ruby/encoding.h>
 #endif
+#include "undefdups.h"
+#include <p4/clientapi.h>
 #include "p4utils.h"
 
-char *P4Utils::charset = 0;
+struct P4Utils::State
+{
+    char *	charset;
 
-VALUE P4Utils::ruby_string( const char *msg, long len )
+    // Index of the encoding new strings are tagged with. Looked up on
+    // first use after the charset changes, rather than per string.
+    int		encIndex;
+};
+
+static void
+FreeState( void *p )
 {
-    VALUE str;
-    //	If a length has been passed then use it
-    if( len )
-    {
-	str = rb_str_new( msg, len );
-    }
-    else
+    xfree( p );
+}
+
+static const struct rb_ractor_local_storage_type stateType = {
+    0,
+    FreeState
+};
+
+static rb_ractor_local_key_t stateKey;
+
+void P4Utils::Init()
+{
+    stateKey = rb_ractor_local_storage_ptr_newkey( &stateType );
+}
+
+P4Utils::State *P4Utils::Current()
+{
+    State *s = (State *) rb_ractor_local_storage_ptr( stateKey );
+    if( !s )
     {
-	str = rb_str_new2( msg );
+	s = ALLOC( State );
+	s->charset = 0;
+	s->encIndex = -1;
+	rb_ractor_local_storage_ptr_set( stateKey, s );
     }
+    return s;
+}
+
+char *P4Utils::GetCharset()
+{
+    return Current()->charset;
+}
+
+void P4Utils::SetCharset( const char *cs )
+{
+    State *s = Current();
+    s->charset = (char *) cs;
+    s->encIndex = -1;
+}
 
-    //	Now check if an encoding should be set for the string.
+int P4Utils::EncodingIndex( int unicode, int raw )
+{
 #ifdef HAVE_RUBY_ENCODING_H
-    if( charset )
-    {
-	rb_enc_associate(str, rb_enc_find("UTF-8"));  
-    }
-    else 
-    {
-	rb_enc_associate(str, rb_locale_encoding());  
-    }
+    return raw ? rb_ascii8bit_encindex() :
+	   unicode ? rb_utf8_encindex() : rb_locale_encindex();
+#else
+    return -1;
+#endif
+}
+
+int P4Utils::DefaultEncoding()
+{
+#ifdef HAVE_RUBY_ENCODING_H
+    State *s = Current();
+    if( s->encIndex < 0 )
+	s->encIndex = EncodingIndex( s->charset != 0, 0 );
+    return s->encIndex;
+#else
+    return -1;
+#endif
+}
+
+VALUE P4Utils::ruby_string( const char *msg, long len )
+{
+    return ruby_string( DefaultEncoding(), msg, len );
+}
+
+VALUE P4Utils::ruby_string( const StrPtr &s )
+{
+    return ruby_string( s.Text(), s.Length() );
+}
+
+VALUE P4Utils::ruby_string( int enc, const char *msg, long len )
+{
+    if( len < 0 )
+	len = strlen( msg );
+
+    //	Create the string in the encoding it should have, if any.
+#ifdef HAVE_RUBY_ENCODING_H
+    return rb_enc_str_new( msg, len, rb_enc_from_index( enc ) );
+#else
+    return rb_str_new( msg, len );
 #endif  
+}
+
+VALUE P4Utils::ruby_string( int enc, const StrPtr &s )
+{
+    return ruby_string( enc, s.Text(), s.Length() );
+}
+
+VALUE P4Utils::flatten( VALUE args )
+{
+    long len = RARRAY_LEN( args );
+    for( long i = 0; i < len; i++ )
+	if( RB_TYPE_P( RARRAY_AREF( args, i ), T_ARRAY ) )
+	    return rb_funcall( args, rb_intern( "flatten" ), 0 );
 
-    return str;
+    return args;
 }
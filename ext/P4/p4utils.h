@@ -33,14 +33,38 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * Description	: C++ class with useful methods 
  *
  ******************************************************************************/
+class StrPtr;
 class P4Utils {
 	public:
-	static void	 SetCharset( const char *cs ) { charset = (char *) cs; };
-	static char* GetCharset() { return charset; };
+	// Creates the per-Ractor storage key. Called once from Init_P4.
+	static void	 Init();
 
-	static VALUE ruby_string( const char *msg, long len = 0);
+	static void	 SetCharset( const char *cs );
+	static char* GetCharset();
+
+	// Index of the encoding for strings from a connection: ASCII-8BIT
+	// in raw bytes mode, UTF-8 if it has a charset, else the locale's.
+	static int	 EncodingIndex( int unicode, int raw );
+
+	// Index of the encoding for strings that aren't from a connection,
+	// per the charset last set in this Ractor. It takes a Ractor-local
+	// lookup, so code making many strings gets it once up front.
+	static int	 DefaultEncoding();
+
+	// len < 0 means msg is nul-terminated. Without an encoding index,
+	// strings are tagged according to the charset last set.
+	static VALUE ruby_string( const char *msg, long len = -1 );
+	static VALUE ruby_string( const StrPtr &s );
+	static VALUE ruby_string( int enc, const char *msg, long len = -1 );
+	static VALUE ruby_string( int enc, const StrPtr &s );
+
+	// Returns args flattened, or args itself if it's already flat
+	static VALUE flatten( VALUE args );
 	
 	private:
-	static char* charset;
+	// The charset and cached encoding index are kept per Ractor, so
+	// a P4 object in one Ractor can't change how strings are tagged
+	// in another.
+	struct State;
+	static State *Current();
 };
-
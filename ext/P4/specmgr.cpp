@@ -36,6 +36,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 #include <ctype.h>
 #include <ruby.h>
+#include <ruby/thread.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "p4utils.h"
 #include "undefdups.h"
 #include <p4/clientapi.h>
@@ -48,6 +52,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "p4specdata.h"
 #include "specmgr.h"
 
+extern VALUE	cP4Spec;	// P4::Spec class
+
 struct defaultspec {
     const char *type;
     const char *spec;
@@ -335,6 +341,7 @@ SpecMgr::SpecMgr()
     debug = 0;
     specs = 0;
     convertArray = 1;
+    encoding = P4Utils::EncodingIndex( 0, 0 );
     Reset();
 }
 
@@ -377,13 +384,39 @@ SpecMgr::HaveSpecDef( const char *type )
     return specs->GetVar( type ) != 0;
 }
 
+//
+// A projection names the fields wanted by their base names, so that
+// 'depotFile' keeps depotFile0, depotFile1 and so on too.
+//
+
+static int
+Projected( StrDict *fields, const StrPtr &var )
+{
+    if( fields->GetVar( var ) )
+	return 1;
+
+    int i = var.Length();
+    while( i && ( isdigit( var[ i-1 ] ) || var[ i-1 ] == ',' ) )
+	i--;
+    if( !i || i == var.Length() )
+	return 0;
+
+    // Dictionary lookups compare nul-terminated strings, so the base
+    // name needs a copy of its own rather than a reference into var.
+    StrBuf base;
+    base.Set( var.Text(), i );
+    return fields->GetVar( base ) != 0;
+}
+
 //
 // Convert a Perforce StrDict into a Ruby hash. Convert multi-level
 // data (Files0, Files1 etc. ) into (nested) array members of the hash.
+// Keys outside the projection, if there is one, are skipped before any
+// Ruby string is made for them.
 //
 
 VALUE
-SpecMgr::StrDictToHash( StrDict *dict, VALUE hash )
+SpecMgr::StrDictToHash( StrDict *dict, VALUE hash, StrDict *fields )
 {
     StrRef      var, val;
     int         i;
@@ -396,6 +429,9 @@ SpecMgr::StrDictToHash( StrDict *dict, VALUE hash )
         if ( var == "specdef" || var == "func" || var == "specFormatted" )
             continue;
 
+        if ( fields && !Projected( fields, var ) )
+            continue;
+
         InsertItem( hash, &var, &val );
     }
     return hash;
@@ -428,7 +464,7 @@ SpecMgr::StrDictToSpec( StrDict *dict, StrPtr *specDef )
 
     // Now parse the StrBuf into a new P4::Spec object
     VALUE               spec = NewSpec( specDef );
-    SpecDataRuby        hashData( spec );
+    SpecDataRuby        hashData( spec, encoding );
 
     s.ParseNoValid( form.Text(), &hashData, &e );
     if( e.Test() ) return Qfalse;
@@ -463,7 +499,7 @@ SpecMgr::StringToSpec( const char *type, const char *form, Error *e )
 
     StrPtr *            specDef = specs->GetVar( type );
     VALUE               hash = NewSpec( specDef );
-    SpecDataRuby        specData( hash );
+    SpecDataRuby        specData( hash, encoding );
 #if P4APIVER_ID >= 513538
     Spec                s( specDef->Text(), "", e );
 #else
@@ -497,7 +533,7 @@ SpecMgr::SpecToString( const char *type, VALUE hash, StrBuf &b, Error *e )
         return;
     }
 
-    SpecDataRuby        specData( hash );
+    SpecDataRuby        specData( hash, encoding );
 #if P4APIVER_ID >= 513538
     Spec                s( specDef->Text(), "", e );
 #else
@@ -509,6 +545,330 @@ SpecMgr::SpecToString( const char *type, VALUE hash, StrBuf &b, Error *e )
     s.Format( &specData, &b );
 }
 
+//
+// Parsing and formatting forms in bulk. Each worker thread gets its own
+// Spec and works through a contiguous range of the forms. An interrupt
+// stops the workers; forms already done are marked so that picking the
+// batch up again carries on where it left off.
+//
+
+enum {
+    SPEC_MAX_WORKERS	= 16,
+    FORMS_PER_WORKER	= 64
+};
+
+struct SpecBatch
+{
+    int			count;
+    int			format;
+    Spec **		specs;
+    int			workers;
+    const StrBuf *	in;
+    StrBuf *		out;
+    SpecDataNative *	data;
+    Error *		errors;
+    char *		done;
+    std::atomic<int>	stop;
+};
+
+static void
+SpecRange( SpecBatch *b, Spec *s, int from, int to )
+{
+    for( int i = from; i < to && !b->stop; i++ )
+    {
+	if( b->done[ i ] )
+	    continue;
+	if( b->format )
+	    s->Format( &b->data[ i ], &b->out[ i ] );
+	else
+	    s->ParseNoValid( b->in[ i ].Text(), &b->data[ i ], &b->errors[ i ] );
+	b->done[ i ] = 1;
+    }
+}
+
+static void *
+RunSpecBatch( void *arg )
+{
+    SpecBatch *b = (SpecBatch *) arg;
+    int chunk = ( b->count + b->workers - 1 ) / b->workers;
+    std::vector<std::thread> threads;
+
+    for( int i = 1; i < b->workers; i++ )
+    {
+	int from = i * chunk;
+	int to = std::min( b->count, from + chunk );
+	if( from >= to ) break;
+
+	try
+	{
+	    threads.push_back( std::thread( SpecRange, b, b->specs[ i ],
+			from, to ) );
+	}
+	catch( ... )
+	{
+	    // Couldn't start a thread; do the work here instead.
+	    SpecRange( b, b->specs[ i ], from, to );
+	}
+    }
+
+    SpecRange( b, b->specs[ 0 ], 0, std::min( b->count, chunk ) );
+
+    for( size_t i = 0; i < threads.size(); i++ )
+	threads[ i ].join();
+    return 0;
+}
+
+// Called by Ruby to interrupt a batch, for Ctrl-C or Thread#raise
+static void
+StopSpecBatch( void *arg )
+{
+    ( (SpecBatch *) arg )->stop = 1;
+}
+
+static VALUE
+CheckInterrupts( VALUE )
+{
+    rb_thread_check_ints();
+    return Qnil;
+}
+
+//
+// Runs the batch without the GVL until it's finished. Returns 0, or the
+// tag of the exception an interrupt raised, which the caller re-raises
+// once it has freed the batch.
+//
+static int
+RunSpecBatchUntilDone( SpecBatch *b )
+{
+    for( ;; )
+    {
+	b->stop = 0;
+	rb_thread_call_without_gvl( RunSpecBatch, b, StopSpecBatch, b );
+	if( !b->stop )
+	    return 0;
+
+	int state = 0;
+	rb_protect( CheckInterrupts, Qnil, &state );
+	if( state )
+	    return state;
+    }
+}
+
+static int
+SpecWorkers( int count )
+{
+    int n = (int) std::thread::hardware_concurrency();
+    int wanted = count / FORMS_PER_WORKER;
+
+    if( n < 1 ) n = 1;
+    if( n > SPEC_MAX_WORKERS ) n = SPEC_MAX_WORKERS;
+    if( wanted < 1 ) wanted = 1;
+
+    return wanted < n ? wanted : n;
+}
+
+struct SpecLoad
+{
+    SpecBatch *		batch;
+    VALUE		hashes;
+    int			encoding;
+};
+
+static VALUE
+LoadSpecBatch( VALUE arg )
+{
+    SpecLoad *l = (SpecLoad *) arg;
+    for( int i = 0; i < l->batch->count; i++ )
+	l->batch->data[ i ].Load( *l->batch->specs[ 0 ],
+				  rb_ary_entry( l->hashes, i ), l->encoding );
+    return Qnil;
+}
+
+struct SpecBuild
+{
+    SpecMgr *		mgr;
+    SpecBatch *		batch;
+    VALUE		fields;
+    VALUE		result;
+};
+
+VALUE
+SpecMgr::BuildSpecs( VALUE arg )
+{
+    SpecBuild *sb = (SpecBuild *) arg;
+    for( int i = 0; i < sb->batch->count; i++ )
+    {
+	VALUE spec = sb->mgr->NewSpec( sb->fields );
+	sb->batch->data[ i ].Replay( spec, sb->mgr->encoding );
+	rb_ary_push( sb->result, spec );
+    }
+    return Qnil;
+}
+
+static Spec *
+NewSpecEngine( StrPtr *specDef, Error *e )
+{
+#if P4APIVER_ID >= 513538
+    return new Spec( specDef->Text(), "", e );
+#else
+    return new Spec( specDef->Text(), "" );
+#endif
+}
+
+VALUE
+SpecMgr::StringsToSpecs( const char *type, VALUE forms, int &failed,
+			Error *e )
+{
+    StrPtr *	specDef = specs->GetVar( type );
+    int		count = (int) RARRAY_LEN( forms );
+    int		i;
+
+    failed = -1;
+    if( !specDef ) return Qfalse;
+
+    // Type-check everything before we allocate anything. The converted
+    // strings are kept in an array of their own so the GC sees them.
+    VALUE strs = rb_ary_new_capa( count );
+    for( i = 0; i < count; i++ )
+    {
+	VALUE v = rb_ary_entry( forms, i );
+	StringValue( v );
+	rb_ary_push( strs, v );
+    }
+
+    SpecBatch b;
+    b.count = count;
+    b.format = 0;
+    b.workers = SpecWorkers( count );
+    b.specs = new Spec *[ b.workers ];
+    for( i = 0; i < b.workers; i++ )
+	b.specs[ i ] = NewSpecEngine( specDef, e );
+
+    StrBuf *in = new StrBuf[ count ];
+    for( i = 0; i < count; i++ )
+    {
+	VALUE v = RARRAY_AREF( strs, i );
+	in[ i ].Set( RSTRING_PTR( v ), RSTRING_LEN( v ) );
+    }
+    b.in = in;
+    b.out = 0;
+    b.data = new SpecDataNative[ count ];
+    b.errors = new Error[ count ];
+    b.done = new char[ count ]();
+
+    //
+    // An interrupt, or building the Ruby objects, can raise, so catch
+    // that and re-raise once the native copies have been freed.
+    //
+    VALUE result = Qfalse;
+    int state = 0;
+    if( !e->Test() )
+    {
+	if( P4RDB_COMMANDS )
+	    fprintf( stderr, "[P4] Parsing %d %s specs using %d thread(s)\n",
+		    count, type, b.workers );
+
+	state = RunSpecBatchUntilDone( &b );
+
+	for( i = 0; !state && i < count && failed < 0; i++ )
+	    if( b.errors[ i ].Test() )
+	    {
+		failed = i;
+		*e = b.errors[ i ];
+	    }
+
+	if( !state && failed < 0 )
+	{
+	    SpecBuild sb = { this, &b, SpecFields( specDef ),
+			      rb_ary_new2( count ) };
+	    rb_protect( BuildSpecs, (VALUE) &sb, &state );
+	    result = sb.result;
+	    RB_GC_GUARD( sb.fields );
+	}
+    }
+
+    for( i = 0; i < b.workers; i++ )
+	delete b.specs[ i ];
+    delete [] b.specs;
+    delete [] b.done;
+    delete [] b.errors;
+    delete [] b.data;
+    delete [] in;
+
+    if( state )
+	rb_jump_tag( state );
+    return result;
+}
+
+VALUE
+SpecMgr::SpecsToStrings( const char *type, VALUE hashes, int &failed,
+			Error *e )
+{
+    StrPtr *	specDef = specs->GetVar( type );
+    int		count = (int) RARRAY_LEN( hashes );
+    int		i;
+
+    failed = -1;
+    if( !specDef ) return Qfalse;
+
+    for( i = 0; i < count; i++ )
+	Check_Type( rb_ary_entry( hashes, i ), T_HASH );
+
+    SpecBatch b;
+    b.count = count;
+    b.format = 1;
+    b.workers = SpecWorkers( count );
+    b.specs = new Spec *[ b.workers ];
+    for( i = 0; i < b.workers; i++ )
+	b.specs[ i ] = NewSpecEngine( specDef, e );
+
+    b.in = 0;
+    b.out = new StrBuf[ count ];
+    b.data = new SpecDataNative[ count ];
+    b.errors = 0;
+    b.done = new char[ count ]();
+
+    //
+    // Reading the hashes, or an interrupt, can raise, so catch that and
+    // re-raise once the native copies have been freed.
+    //
+    VALUE result = Qfalse;
+    int state = 0;
+    if( !e->Test() )
+    {
+	SpecLoad l = { &b, hashes, encoding };
+	rb_protect( LoadSpecBatch, (VALUE) &l, &state );
+    }
+
+    if( !e->Test() && !state )
+    {
+	if( P4RDB_COMMANDS )
+	    fprintf( stderr, "[P4] Formatting %d %s specs using %d thread(s)\n",
+		    count, type, b.workers );
+
+	state = RunSpecBatchUntilDone( &b );
+    }
+
+    if( !e->Test() && !state )
+    {
+	result = rb_ary_new2( count );
+	for( i = 0; i < count; i++ )
+	    rb_ary_push( result,
+		    P4Utils::ruby_string( encoding, b.out[ i ] ) );
+    }
+
+    for( i = 0; i < b.workers; i++ )
+	delete b.specs[ i ];
+    delete [] b.specs;
+    delete [] b.done;
+    delete [] b.data;
+    delete [] b.out;
+
+    if( state )
+	rb_jump_tag( state );
+    return result;
+}
+
 //
 // This method returns a hash describing the valid fields in the spec. To
 // make it easy on our users, we map the lowercase name to the name defined
@@ -554,8 +914,8 @@ SpecMgr::SpecFields( StrPtr *specDef )
         StrOps::Lower( k );
 
         rb_hash_aset(hash,
-                    P4Utils::ruby_string( k.Text(), k.Length() ),
-                    P4Utils::ruby_string( v.Text(), v.Length() ) );
+                    P4Utils::ruby_string( encoding, k ),
+                    P4Utils::ruby_string( encoding, v ) );
     }
     return hash;
 }
@@ -616,21 +976,21 @@ SpecMgr::InsertItem( VALUE hash, const StrPtr *var, const StrPtr *val )
         ID idHasKey     = rb_intern( "has_key?");
         ID idPlus       = rb_intern( "+" );
 
-        key =  P4Utils::ruby_string( var->Text() );
+        key =  P4Utils::ruby_string( encoding, *var );
         if ( rb_funcall( hash, idHasKey, 1, key ) == Qtrue )
-            key = rb_funcall( key, idPlus, 1,  P4Utils::ruby_string( "s" ) );
+            key = rb_funcall( key, idPlus, 1,  P4Utils::ruby_string( encoding, "s" ) );
 
         if( P4RDB_DATA )
             fprintf( stderr, "... %s -> %s\n", StringValuePtr( key ), val->Text() );
 
-        rb_hash_aset( hash, key,  P4Utils::ruby_string( val->Text() ) );
+        rb_hash_aset( hash, key,  P4Utils::ruby_string( encoding, *val ) );
         return;
     }
 
     //
     // Get or create the parent array from the hash.
     //
-    key =  P4Utils::ruby_string( base.Text() );
+    key =  P4Utils::ruby_string( encoding, base );
     ary = rb_hash_aref( hash, key );
 
     if ( Qnil == ary )
@@ -651,8 +1011,8 @@ SpecMgr::InsertItem( VALUE hash, const StrPtr *var, const StrPtr *val )
         if( P4RDB_DATA )
             fprintf( stderr, "... %s -> %s\n", var->Text(), val->Text() );
 
-        rb_hash_aset( hash,  P4Utils::ruby_string( var->Text() ) ,
-                             P4Utils::ruby_string( val->Text() ) );
+        rb_hash_aset( hash,  P4Utils::ruby_string( encoding, *var ) ,
+                             P4Utils::ruby_string( encoding, *val ) );
         return;
 }
 
@@ -687,7 +1047,7 @@ SpecMgr::InsertItem( VALUE hash, const StrPtr *var, const StrPtr *val )
     if( P4RDB_DATA )
         fprintf( stderr, "%d] = %s\n", pos, val->Text() );
 
-    rb_ary_store( ary, pos,  P4Utils::ruby_string( val->Text() )  );
+    rb_ary_store( ary, pos,  P4Utils::ruby_string( encoding, *val )  );
 }
 
 //
@@ -696,13 +1056,14 @@ SpecMgr::InsertItem( VALUE hash, const StrPtr *var, const StrPtr *val )
 
 VALUE
 SpecMgr::NewSpec( StrPtr *specDef )
+{
+    return NewSpec( SpecFields( specDef ) );
+}
+
+VALUE
+SpecMgr::NewSpec( VALUE fields )
 {
     ID          idNew           = rb_intern( "new" );
-    ID          idP4            = rb_intern( "P4" );
-    ID          idP4Spec        = rb_intern( "Spec" );
-    VALUE       cP4             = rb_const_get_at( rb_cObject, idP4 );
-    VALUE       cP4Spec         = rb_const_get_at( cP4, idP4Spec );
-    VALUE       fields          = SpecFields( specDef );
 
     return rb_funcall( cP4Spec, idNew, 1, fields );
 }
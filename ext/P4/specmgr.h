@@ -46,6 +46,10 @@ class SpecMgr
 	void	SetDebug( int i )	{ debug = i; 	}
 	void	SetArrayConversion( int a)	{ convertArray = a; }
 
+	// Encoding index the strings we create are tagged with. See
+	// P4Utils::EncodingIndex().
+	void	SetEncoding( int e )	{ encoding = e;	}
+
 	// Clear the spec cache and revert to internal defaults
 	void	Reset();
 
@@ -67,12 +71,24 @@ class SpecMgr
 	//
 	void	SpecToString(const char *type, VALUE hash, StrBuf &b, Error *e);
 
+	//
+	// Bulk versions of the above. The C++ spec engine runs on a pool of
+	// threads without the GVL; Ruby objects are only built at the end.
+	// If a form fails, the error is set and 'failed' is its index.
+	//
+	VALUE	StringsToSpecs( const char *type, VALUE forms, int &failed,
+				Error *e );
+	VALUE	SpecsToStrings( const char *type, VALUE hashes, int &failed,
+				Error *e );
+
 	//
 	// Convert a Perforce StrDict into a Ruby hash. Used when we're 
 	// parsing tagged output that is NOT a spec. e.g. output of
-	// fstat etc.
+	// fstat etc. If fields is given, only the keys it names are
+	// converted.
 	//
-	VALUE	StrDictToHash( StrDict *dict, VALUE hash = Qnil );
+	VALUE	StrDictToHash( StrDict *dict, VALUE hash = Qnil,
+				StrDict *fields = 0 );
 
 	// 
 	// Convert a Perforce StrDict into a P4::Spec object. This is for
@@ -94,11 +110,16 @@ class SpecMgr
 	void	SplitKey( const StrPtr *key, StrBuf &base, StrBuf &index );
 	void	InsertItem( VALUE hash, const StrPtr *var, const StrPtr *val );
 	VALUE	NewSpec( StrPtr *specDef );
+	VALUE	NewSpec( VALUE fields );
 	VALUE	SpecFields( StrPtr *specDef );
 
+	// Makes the P4::Spec objects for a parsed batch, under rb_protect
+	static VALUE	BuildSpecs( VALUE build );
+
     private:
 	int		debug;
 	int convertArray;
+	int		encoding;
 	StrBufDict *	specs;
 };
 
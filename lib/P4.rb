@@ -33,6 +33,8 @@
 #*******************************************************************************
 
 require 'P4/version'
+require 'P4/trace'
+require 'P4/changefeed'
 require 'fiddle'
 
 #
@@ -153,7 +155,7 @@ class P4
 
   # Mappings for P4#each_<spec>
   # Hash of type vs. key
-  SpecTypes = {
+  SpecTypes = Ractor.make_shareable( {
     "clients" => ["client", "client"],
     "labels" => ["label", "label"],
     "branches" => ["branch", "branch"],
@@ -164,7 +166,7 @@ class P4
     "groups" => ["group", "group"],
     "depots" => ["depot", "name"],
     "servers" => ["server", "Name"],
-  }
+  } )
 
   def method_missing( m, *a )
 
@@ -174,7 +176,7 @@ class P4
 
       # Generic fetch_* methods
     elsif ( m.to_s =~ /^fetch_(.*)/ )
-      return self.run( $1, "-o", a ).shift
+      return self.run( $1, "-o", a ).first
 
       # Generic save_* methods
     elsif ( m.to_s =~ /^save_(.*)/ )
@@ -227,12 +229,14 @@ class P4
       raise( P4Exception, "No such method P4##{m.to_s}", caller) unless SpecTypes.has_key?( $1 )
       raise( P4Exception, "Method P4##{m.to_s} requires block", caller) unless block_given?
       specs = self.run( $1, a )
+      # The runs below refill the output array in reuse mode
+      specs = specs.dup if reuse_results?
       cmd = SpecTypes[ $1 ][0].downcase
       key = SpecTypes[ $1 ][1]
 
       specs.each{
         |spec|
-        spec = self.run( cmd, "-o", spec[key] ).shift
+        spec = self.run( cmd, "-o", spec[key] ).first
         yield spec
       }
       return specs
@@ -243,16 +247,39 @@ class P4
     end
   end
 
+  #
+  # Run a command over a file list too big to pass in one go, much as
+  # 'p4 -x' does. The list is read a line or element at a time from any
+  # IO or Enumerable and the command is run in back to back batches of
+  # at most batch_size arguments, so the whole list is never held in
+  # memory. For example:
+  #
+  #   File.open( 'files.txt' ) do |f|
+  #     p4.run_batched( 'edit', '-c', change, from: f )
+  #   end
+  #
+  # Yields each batch's results if a block is given; otherwise returns
+  # them all in one array.
+  #
+  def run_batched( cmd, *args, from:, batch_size: nil, batch_bytes: nil, &block )
+    prepare( cmd, *args ).stream( from, batch_size, batch_bytes, &block )
+  end
+
   #
   # Simple interface for submitting. If any argument is a Hash, (or subclass
   # thereof - like P4::Spec), then it will be assumed to contain the change
-  # form. All other arguments are passed on to the server unchanged.
+  # form, except for the fields: option, which is passed on to run. All
+  # other arguments are passed on to the server unchanged.
   #
   def run_submit( *args )
     form = nil
+    opts = nil
     nargs = args.flatten.collect do
       |a|
-      if( a.kind_of?( Hash ) )
+      if( a.instance_of?( Hash ) && a.has_key?( :fields ) )
+        opts = a
+        nil
+      elsif( a.kind_of?( Hash ) )
         form = a
         nil
       else
@@ -264,6 +291,7 @@ class P4
       self.input = form
       nargs.push( "-i" )
     end
+    nargs.push( opts ) if opts
     return self.run( "submit", nargs )
   end
 
@@ -272,9 +300,13 @@ class P4
 
   def run_shelve( *args )
     form = nil
+    opts = nil
     nargs = args.flatten.collect do
       |a|
-      if( a.kind_of?( Hash ) )
+      if( a.instance_of?( Hash ) && a.has_key?( :fields ) )
+        opts = a
+        nil
+      elsif( a.kind_of?( Hash ) )
         form = a
         nil
       else
@@ -286,6 +318,7 @@ class P4
       self.input = form
       nargs.push( "-i" )
     end
+    nargs.push( opts ) if opts
     return self.run( "shelve", nargs )
   end
 
@@ -315,6 +348,27 @@ class P4
     end
   end
 
+  #
+  # Resolve using a set of path rules, given as a Hash of pattern => action
+  # or an Array of [ pattern, action ] pairs. Patterns use P4::Map syntax
+  # and are matched against the target file in client syntax, the source
+  # file in depot syntax and the local path; later rules win. Actions
+  # are "ay", "at", "am" and "s" as for run_resolve, plus "safe" (accept
+  # only if one side changed) and "automerge" (merge if there are no
+  # conflicts). Both are skipped otherwise.
+  #
+  # The rules are evaluated without calling into Ruby. Files no rule
+  # covers are passed to the block, if given, or skipped.
+  #
+  def run_resolve_with( rules, *args, &block )
+    self.resolve_rules = rules
+    begin
+      run_resolve( *args, &block )
+    ensure
+      self.resolve_rules = nil
+    end
+  end
+
   #
   # Simple interface to 'p4 tickets'
   #
@@ -450,6 +504,104 @@ class P4
     self
   end
 
+  #
+  # Run the block in raw bytes mode: output skips charset translation
+  # and comes back as ASCII-8BIT strings. Use force_encoding or encode
+  # on the values that need it.
+  #
+  def with_raw_bytes
+    return self unless block_given?
+    old_raw = self.raw_bytes?
+    self.raw_bytes = true
+    begin
+      yield( self )
+    ensure
+      self.raw_bytes = old_raw
+    end
+    self
+  end
+
+  #
+  # Run the block with the output of every command written to a capture
+  # file at path. P4#replay feeds the file back through the conversion
+  # to Ruby objects without a server, to benchmark or profile it on
+  # real data.
+  #
+  def with_capture( path )
+    return self unless block_given?
+    self.capture = path
+    begin
+      yield( self )
+    ensure
+      self.capture = nil
+    end
+    self
+  end
+
+  #
+  # Run a command in tagged mode and write its records straight to io
+  # rather than returning them, one JSON object per line (format:
+  # :ndjson) or as CSV with a header row (format: :csv). fields names
+  # the columns and their order; by default they are the keys of the
+  # first record. No Ruby hash is built per record, so this is the way
+  # to dump large fstat or files listings. Messages are still collected
+  # in errors, warnings and messages. Returns the number of records.
+  #
+  # Records have the shape P4#run gives them: indexed keys such as
+  # depotFile0, depotFile1 from describe or filelog are gathered into
+  # an array under depotFile, and fields are named by those base names.
+  # In CSV an array's values are joined by newlines in one cell, and
+  # without fields a column that first turns up after the first record
+  # is left out, so name the fields for commands whose records differ.
+  #
+  # JSON is written as UTF-8, with bytes that aren't valid UTF-8
+  # replaced by U+FFFD. With raw: true, which follows raw_bytes? by
+  # default, bytes are written as they are and the chunks passed to
+  # io are ASCII-8BIT.
+  #
+  #   File.open( 'files.csv', 'w' ) do |f|
+  #     p4.run_export( f, 'fstat', '//depot/...', format: :csv,
+  #                    fields: %w{ depotFile headRev headType } )
+  #   end
+  #
+  def run_export( io, cmd, *args, format: :ndjson, fields: nil,
+                  raw: raw_bytes? )
+    export_start( io, format, fields, raw )
+    opts = fields ? { fields: fields } : {}
+    begin
+      tagged( true ) { run( cmd, *args, **opts ) }
+    ensure
+      count = export_finish
+    end
+    count
+  end
+
+  #
+  # Connect if need be and run 'p4 info -s', so the connection and the
+  # protocol negotiation are done before the first real command. In a
+  # preforking server, call it in each worker once it has forked: the
+  # child replaces the connection it inherited with one of its own.
+  # A child that never uses or disconnects a P4 object it inherited
+  # keeps its copy of the parent's socket open until it exits.
+  #
+  def prewarm
+    connect unless connected?
+    run_info( '-s' )
+    self
+  end
+
+  #
+  # Write the process-wide metrics to a file in the Prometheus text format
+  # for a scraper to pick up. The file is replaced atomically so a reader
+  # never sees it half written.
+  #
+  def self.write_metrics( path )
+    tmp = "#{path}.#{Process.pid}.tmp"
+    File.open( tmp, 'w' ) { |f| f.write( metrics_text ) }
+    File.rename( tmp, path )
+    path
+  end
+
   #
   # Show some handy information when using irb
   #
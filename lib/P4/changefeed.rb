@@ -0,0 +1,234 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Follows the submitted changes under one or more path filters. The
+# feed keeps a high-water change number per filter, so each poll asks
+# the server only for what's new, and one feed serves any number of
+# subscribers in the process in place of each of them polling:
+#
+#   feed = P4::ChangeFeed.new( p4, '//depot/main/...', state: 'main.feed',
+#                              describe: true )
+#   feed.subscribe { |change, filter| puts change[ 'change' ] }
+#   queue = feed.subscribe
+#   feed.start( interval: 30 )
+#
+# A filter with no watermark yet starts from the newest change at the
+# first poll, unless 'from' gives a change number to start after.
+# Watermarks are written to the 'state' file, if there is one, after
+# each page of changes has been delivered, so a restarted feed carries
+# on where it left off. If a subscriber raises, the page is delivered
+# again at the next poll.
+#
+class P4
+  class ChangeFeed
+    attr_reader :filters
+
+    def initialize( p4, *filters, state: nil, from: nil, page_size: 100,
+                    describe: false, describe_args: [ '-s' ] )
+      @filters = filters.flatten.map( &:to_s )
+      raise ArgumentError, 'P4::ChangeFeed needs a path filter' if @filters.empty?
+
+      @p4 = p4
+      @state = state
+      @page_size = page_size
+      @describe = describe
+      @describe_args = describe_args
+      @subscribers = []
+      @subscribers_lock = Mutex.new
+      @lock = Mutex.new
+      @thread = nil
+      @watermarks = load_state
+      @filters.each { |f| @watermarks[ f ] ||= from.to_i } if from
+    end
+
+    # The last change delivered for the filter, or nil before the first poll
+    def watermark( filter = @filters.first )
+      @watermarks[ filter ]
+    end
+
+    #
+    # Subscribe to the changes under one filter, or all of them. With a
+    # block, the block is called with each change and its filter from
+    # the polling thread. Without one, returns a Queue that receives
+    # [change, filter] pairs, so a consumer can take them as a stream
+    # from a thread of its own. Either way the return value can be passed
+    # to unsubscribe.
+    #
+    def subscribe( filter = nil, &block )
+      target = block || Thread::Queue.new
+      @subscribers_lock.synchronize { @subscribers << [ filter, target ] }
+      target
+    end
+
+    def unsubscribe( target )
+      @subscribers_lock.synchronize do
+        @subscribers.reject! { |_, t| t.equal?( target ) }
+      end
+      self
+    end
+
+    #
+    # Fetch and deliver any new changes. Returns the changes delivered,
+    # as [change, filter] pairs, oldest first for each filter.
+    #
+    def poll
+      @lock.synchronize do
+        @p4.connect unless @p4.connected?
+        tagged = @p4.tagged?
+        @p4.tagged = true
+        begin
+          @filters.flat_map { |f| poll_filter( f ) }
+        ensure
+          @p4.tagged = tagged
+        end
+      end
+    end
+
+    #
+    # Poll every 'interval' seconds in a background thread until stop is
+    # called. The feed's P4 object belongs to that thread while it runs.
+    # Errors are passed to the block if one is given, and otherwise
+    # reported with warn; polling carries on either way.
+    #
+    def start( interval: 30, &on_error )
+      raise P4Exception, 'P4::ChangeFeed is already running' if running?
+
+      @stopping = false
+      @thread = Thread.new do
+        until @stopping
+          begin
+            poll
+          rescue StandardError => e
+            on_error ? on_error.call( e ) : warn( "P4::ChangeFeed: #{e.message}" )
+          end
+          sleep( interval ) unless @stopping
+        end
+      end
+      self
+    end
+
+    def stop
+      return self unless @thread
+      @stopping = true
+      @thread.wakeup if @thread.alive?
+      @thread.join
+      @thread = nil
+      self
+    end
+
+    def running?
+      !!@thread&.alive?
+    end
+
+    private
+
+    def poll_filter( filter )
+      mark = @watermarks[ filter ]
+      if mark.nil?
+        newest = @p4.run_changes( '-m1', '-s', 'submitted', filter ).first
+        save_watermark( filter, newest ? newest[ 'change' ].to_i : 0 )
+        return []
+      end
+
+      delivered = []
+      changes_since( filter, mark ).each_slice( @page_size ) do |page|
+        page = describe( page ) if @describe
+        page.each do |change|
+          dispatch( change, filter )
+          delivered << [ change, filter ]
+        end
+        save_watermark( filter, page.last[ 'change' ].to_i )
+      end
+      delivered
+    end
+
+    #
+    # 'p4 changes' lists the newest first, so walk back from #head a
+    # page at a time until we reach the watermark.
+    #
+    def changes_since( filter, mark )
+      found = []
+      upper = '#head'
+      loop do
+        page = @p4.run_changes( '-s', 'submitted', '-m', @page_size.to_s,
+                                "#{filter}@#{mark + 1},#{upper}" )
+        found.concat( page )
+        break if page.length < @page_size
+
+        oldest = page.last[ 'change' ].to_i
+        break if oldest <= mark + 1
+        upper = "@#{oldest - 1}"
+      end
+      found.reverse
+    end
+
+    # Describe the whole page with one command
+    def describe( page )
+      described = @p4.run_describe( *@describe_args, *page.map { |c| c[ 'change' ] } )
+      by_change = described.each_with_object( {} ) do |d, h|
+        h[ d[ 'change' ] ] = d if d.kind_of?( Hash )
+      end
+      page.map { |c| by_change[ c[ 'change' ] ] || c }
+    end
+
+    # Subscribers may come and go from inside a block subscriber
+    def dispatch( change, filter )
+      @subscribers_lock.synchronize { @subscribers.dup }.each do |f, target|
+        next if f && f != filter
+        if target.respond_to?( :call )
+          target.call( change, filter )
+        else
+          target.push( [ change, filter ] )
+        end
+      end
+    end
+
+    def load_state
+      marks = {}
+      return marks unless @state && File.exist?( @state )
+      File.foreach( @state ) do |line|
+        change, filter = line.chomp.split( "\t", 2 )
+        marks[ filter ] = change.to_i if filter
+      end
+      marks
+    end
+
+    # The state file is replaced atomically so it's never seen half written
+    def save_watermark( filter, change )
+      @watermarks[ filter ] = change
+      return unless @state
+
+      tmp = "#{@state}.#{Process.pid}.tmp"
+      File.open( tmp, 'w' ) do |f|
+        @watermarks.each { |fl, c| f.puts( "#{c}\t#{fl}" ) }
+      end
+      File.rename( tmp, @state )
+    end
+  end
+end
@@ -0,0 +1,91 @@
+# vim:ts=2:sw=2:et:
+#-------------------------------------------------------------------------------
+# Copyright (c) 2026, Perforce Software, Inc.  All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1.  Redistributions of source code must retain the above copyright
+#     notice, this list of conditions and the following disclaimer.
+#
+# 2.  Redistributions in binary form must reproduce the above copyright
+#     notice, this list of conditions and the following disclaimer in the
+#     documentation and/or other materials provided with the distribution.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL PERFORCE
+# SOFTWARE, INC. BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+# ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+# THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+# DAMAGE.
+#-------------------------------------------------------------------------------
+
+#
+# Decoder for the binary event traces written by P4.trace_dump, for
+# offline analysis. Needs nothing but Ruby, so it can be run anywhere:
+#
+#   ruby lib/P4/trace.rb p4trace.bin
+#
+class P4
+  module Trace
+    MAGIC = "P4TRACE\0".b.freeze
+    HEADER_SIZE = 40
+    BYTE_ORDER_MARK = 0x01020304
+
+    TYPES = Ractor.make_shareable( %w( - cmd_start cmd_end connect
+                disconnect output_text output_binary output_stat message
+                input resolve exception ) )
+
+    #
+    # Returns the events in the file, oldest first, as Hashes with
+    # 'time' (seconds since the epoch), 'type', 'session', 'size',
+    # 'extra' and 'tag'.
+    #
+    def self.decode( path )
+      data = File.binread( path )
+      raise ArgumentError, "#{path} is not a P4 trace" unless data[ 0, 8 ] == MAGIC
+
+      # Traces are written in the byte order of the host that made them
+      little = data[ 16, 4 ].unpack1( 'V' ) == BYTE_ORDER_MARK
+      u32, u64 = little ? %w( V Q< ) : %w( N Q> )
+      u16 = little ? 'v' : 'n'
+
+      version, size = data[ 8, 8 ].unpack( u32 * 2 )
+      raise ArgumentError, "Unsupported trace version #{version}" if version != 1
+      count, start = data[ 24, 16 ].unpack( u64 * 2 )
+
+      Array.new( count ) do |i|
+        e = data[ HEADER_SIZE + i * size, size ]
+        time, type, session, bytes, extra, tag =
+          e.unpack( "#{u64}#{u16}#{u16}#{u32}#{u32}Z12" )
+        {
+          'time'    => ( start + time ) / 1e9,
+          'type'    => TYPES[ type ] || type.to_s,
+          'session' => session,
+          'size'    => bytes,
+          'extra'   => extra,
+          'tag'     => tag
+        }
+      end
+    end
+
+    def self.format( event )
+      Time.at( event[ 'time' ] ).strftime( '%Y/%m/%d %H:%M:%S.%6N' ) +
+        sprintf( ' %04x %-14s %10d %10d %s', event[ 'session' ],
+                 event[ 'type' ], event[ 'size' ], event[ 'extra' ],
+                 event[ 'tag' ] )
+    end
+  end
+end
+
+if __FILE__ == $0
+  ARGV.each do |path|
+    P4::Trace.decode( path ).each { |e| puts P4::Trace.format( e ) }
+  end
+end
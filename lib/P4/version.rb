@@ -1,3 +1,3 @@
 class P4
-  Version = VERSION = '2025.1.2756918'
+  Version = VERSION = '2025.1.2756918'.freeze
 end
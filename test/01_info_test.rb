@@ -48,8 +48,120 @@ class TC_Info < Test::Unit::TestCase
       info = info.shift
       assert( info.kind_of?( Hash ), "P4#run_info not in tagged mode?" )
       assert_equal( info[ 'serverRoot' ], server_root, "Incorrect server root" )
+
+      # Commands run in a Ractor of their own, through the same Ruby
+      # side methods as in the main one
+      Warning[ :experimental ] = false
+      r = Ractor.new( p4.port, p4.user, p4.client ) do
+        |port, user, client|
+        c = P4.new
+        c.port = port
+        c.user = user
+        c.client = client
+        c.connect
+        begin
+          [ c.run_info.first[ 'serverRoot' ], c.fetch_user[ 'User' ],
+            c.last_command_stats[ 'records' ], P4::VERSION ]
+        ensure
+          c.disconnect
+        end
+      end
+      assert_equal( [ server_root, p4.user, 1, P4::VERSION ],
+                    r.respond_to?( :value ) ? r.value : r.take )
+
+      # A forked child connects again by itself and leaves the parent's
+      # connection alone, closing its own copy of the descriptors
+      if Process.respond_to?( :fork )
+        channels = lambda do
+          Dir.glob( '/proc/self/fd/*' ).map do
+            |f|
+            File.readlink( f ) rescue nil
+          end.grep( /^(socket|pipe):/ )
+        end
+        p4.disconnect
+        before = channels.call
+        p4.connect
+        conn = channels.call - before
+        pid = fork do
+          ok = p4.connected? && p4.prewarm == p4 && p4.run_info.length == 1
+          ok &&= ( channels.call & conn ).empty?
+          exit!( ok ? 0 : 1 )
+        end
+        Process.wait( pid )
+        assert( $?.success?, "Forked child couldn't run commands" )
+        assert_equal( 1, p4.run_info.length )
+
+        # If the child closed those descriptors itself and the numbers
+        # were reused, what now has them is left alone
+        pid = fork do
+          fds = Dir.children( '/proc/self/fd' ).map( &:to_i ).select do
+            |fd|
+            conn.include?( File.readlink( "/proc/self/fd/#{fd}" ) ) rescue false
+          end
+          fds.each { |fd| IO.for_fd( fd ).close rescue nil }
+          pipes = fds.map { IO.pipe }
+          ok = p4.prewarm == p4
+          ok &&= pipes.all? do
+            |r, w|
+            w.write( 'x' )
+            r.read_nonblock( 1 ) == 'x'
+          end rescue false
+          exit!( ok ? 0 : 1 )
+        end
+        Process.wait( pid )
+        assert( $?.success?, "Forked child closed reused descriptors" )
+      end
     ensure
       p4.disconnect
     end
   end
+
+  def test_metrics
+    P4.reset_metrics
+    assert( p4.connect, "Failed to connect to Perforce server" )
+    begin
+      3.times { p4.run_info }
+      m = P4.metrics
+      assert_equal( 1, m[ 'connects' ] )
+      info = m[ 'commands' ][ 'info' ]
+      assert_equal( 3, info[ 'calls' ] )
+      assert_equal( 0, info[ 'errors' ] )
+      assert_equal( 3, info[ 'records' ] )
+      assert( info[ 'p50' ] <= info[ 'p99' ] )
+      assert( info[ 'p99' ] <= info[ 'max' ] * 1.125 + 1e-6 )
+
+      text = P4.metrics_text
+      assert_match( /^p4ruby_commands_total\{command="info"\} 3$/, text )
+      assert_match( /^p4ruby_command_duration_seconds_count\{command="info"\} 3$/, text )
+
+      path = File.join( client_root, 'metrics.prom' )
+      P4.write_metrics( path )
+      assert_equal( text.lines.first, File.read( path ).lines.first )
+    ensure
+      p4.disconnect
+    end
+  end
+
+  def test_trace
+    path = File.join( client_root, 'p4trace.bin' )
+    P4.trace_start( 1024 )
+    assert( P4.trace? )
+    begin
+      assert( p4.connect, "Failed to connect to Perforce server" )
+      p4.run_info
+      p4.disconnect
+    ensure
+      P4.trace_stop
+    end
+    assert( P4.trace_dump( path ) > 0 )
+
+    events = P4::Trace.decode( path )
+    types = events.map { |e| e[ 'type' ] }
+    assert_equal( %w( connect cmd_start output_stat cmd_end disconnect ),
+                  types.last( 5 ) )
+    cmd = events.find { |e| e[ 'type' ] == 'cmd_end' }
+    assert_equal( 'info', cmd[ 'tag' ] )
+    assert_equal( 1, cmd[ 'extra' ] )
+    assert_equal( 1, events.map { |e| e[ 'session' ] }.uniq.length )
+  end
 end
@@ -100,6 +100,101 @@ class TC_Files < Test::Unit::TestCase
       assert_submit( "Failed to submit branch2", change )
       assert( p4.run_opened.length == 0 )
 
+      # Prepared commands keep their leading args and settings
+      fstat = p4.prepare( 'fstat', '-T', 'depotFile,headRev' )
+      assert_equal( 'fstat', fstat.command )
+      assert_equal( [ '-T', 'depotFile,headRev' ], fstat.args )
+      p4.tagged = false
+      %w{ foo bar baz }.each do
+        |fn|
+        r = fstat.call( "test_files/#{fn}.txt" )
+        assert_equal( 1, r.length )
+        assert_equal( [ 'depotFile', 'headRev' ], r[ 0 ].keys.sort )
+      end
+      assert_equal( 6, fstat.call( 'test_files/...', [ 'test_branch/...' ] ).length )
+      p4.tagged = true
+
+      # Streamed arguments run in batches
+      require 'stringio'
+      list = StringIO.new( %w{ foo bar baz }.map { |f| "test_files/#{f}.txt\n" }.join )
+      batches = []
+      p4.run_batched( 'fstat', '-T', 'depotFile', from: list, batch_size: 2 ) do
+        |r|
+        batches << r.length
+      end
+      assert_equal( [ 2, 1 ], batches )
+      paths = ( 1..3 ).lazy.map { 'test_branch2/...' }
+      assert_equal( 9, p4.run_batched( 'fstat', from: paths ).length )
+
+      # Exported records match the ones run_fstat returns
+      require 'json'
+      fstat = p4.run_fstat( 'test_files/...' )
+      out = StringIO.new
+      assert_equal( 3, p4.run_export( out, 'fstat', 'test_files/...' ) )
+      lines = out.string.lines
+      assert_equal( 3, lines.length )
+      lines.each_with_index do
+        |l, i|
+        assert_equal( fstat[ i ].to_h, JSON.parse( l ) )
+      end
+      out = StringIO.new
+      n = p4.run_export( out, 'fstat', 'test_files/...', format: :csv,
+                         fields: %w{ depotFile headRev } )
+      assert_equal( 3, n )
+      rows = out.string.lines.map { |l| l.chomp }
+      assert_equal( 'depotFile,headRev', rows[ 0 ] )
+      assert_equal( "//depot/test_files/bar.txt,#{fstat[ 0 ][ 'headRev' ]}", rows[ 1 ] )
+      assert_raise( ArgumentError ) { p4.run_export( out, 'files', format: :xml ) }
+
+      # A projection keeps only the fields named, including the indexed
+      # ones, and fstat gets them as -T as well
+      r = p4.run_fstat( 'test_files/...', fields: %w{ depotFile headRev } )
+      assert_equal( 3, r.length )
+      assert_equal( [ 'depotFile', 'headRev' ], r[ 0 ].keys.sort )
+      assert_equal( fstat[ 0 ][ 'headRev' ], r[ 0 ][ 'headRev' ] )
+      r = p4.run_fstat( '-TdepotFile,headRev', 'test_files/...', fields: [ 'depotFile' ] )
+      assert_equal( [ 'depotFile' ], r[ 0 ].keys )
+      change = p4.run_changes( '-m1', 'test_files/...' )[ 0 ][ 'change' ]
+      d = p4.run_describe( '-s', change, fields: [ 'change', :depotFile ] )
+      assert_equal( [ 'change', 'depotFile' ], d[ 0 ].keys.sort )
+      assert_equal( 3, d[ 0 ][ 'depotFile' ].length )
+      assert_raise( ArgumentError ) { p4.run_files( 'test_files/...', field: [] ) }
+
+      # Exports gather indexed keys under their base names too
+      out = StringIO.new
+      assert_equal( 1, p4.run_export( out, 'describe', '-s', change ) )
+      assert_equal( p4.run_describe( '-s', change )[ 0 ].to_h, JSON.parse( out.string ) )
+      out = StringIO.new
+      p4.run_export( out, 'describe', '-s', change, fields: %w{ depotFile } )
+      rec = JSON.parse( out.string )
+      assert_equal( [ 'depotFile' ], rec.keys )
+      assert_equal( d[ 0 ][ 'depotFile' ], rec[ 'depotFile' ] )
+      out = StringIO.new
+      p4.run_export( out, 'describe', '-s', change, format: :csv,
+                     fields: %w{ change depotFile } )
+      assert_equal( "change,depotFile\n" +
+                    "#{change},\"#{d[ 0 ][ 'depotFile' ].join( "\n" )}\"\n",
+                    out.string )
+      out = StringIO.new
+      assert_equal( 3, p4.run_export( out, 'filelog', 'test_files/...' ) )
+      logs = out.string.lines.map { |l| JSON.parse( l ) }
+      filelog = p4.run( 'filelog', 'test_files/...' )
+      assert_equal( 4, logs[ 0 ][ 'rev' ].length )
+      assert_equal( filelog[ 0 ][ 'how' ], logs[ 0 ][ 'how' ] )
+      out = StringIO.new
+      p4.run_export( out, 'filelog', 'test_files/...', fields: %w{ depotFile rev } )
+      rec = JSON.parse( out.string.lines.first )
+      assert_equal( [ 'depotFile', 'rev' ], rec.keys )
+      assert_equal( filelog[ 0 ][ 'rev' ], rec[ 'rev' ] )
+
+      # Raw exports hand the bytes over as they are
+      chunks = []
+      sink = Object.new
+      sink.define_singleton_method( :write ) { |s| chunks << s; s.bytesize }
+      assert_equal( 3, p4.run_export( sink, 'fstat', 'test_files/...', raw: true ) )
+      assert_equal( [ Encoding::ASCII_8BIT ], chunks.map( &:encoding ).uniq )
+      assert_equal( fstat[ 0 ].to_h, JSON.parse( chunks.join.lines.first ) )
+
       # Now check out 'p4 filelog'
       files = p4.run_filelog( 'test_files/...' )
       assert( files.length == 3 )
@@ -124,6 +219,95 @@ class TC_Files < Test::Unit::TestCase
       assert( rev.rev == 3 )
       assert( rev.action == "delete" )
       assert( rev.digest == nil )
+
+      # Pinned queries are answered from the query cache the second time
+      require 'tmpdir'
+      Dir.mktmpdir( 'p4qc' ) do
+        |dir|
+        p4.query_cache = dir
+        assert_equal( dir, p4.query_cache )
+        live = p4.run_filelog( 'test_files/foo.txt#2' )
+        cached = p4.run_filelog( 'test_files/foo.txt#2' )
+        assert_equal( live[ 0 ].revisions.length, cached[ 0 ].revisions.length )
+        assert_equal( live[ 0 ].depot_file, cached[ 0 ].depot_file )
+        text = p4.run_print( '//depot/test_files/foo.txt#1' )
+        assert_equal( text, p4.run_print( '//depot/test_files/foo.txt#1' ) )
+        p4.run_fstat( 'test_files/foo.txt' )
+        stats = p4.query_cache_stats
+        assert_equal( 2, stats[ 'hits' ] )
+        assert_equal( 2, stats[ 'stores' ] )
+        assert_equal( 2, Dir.glob( File.join( dir, '*.p4qc' ) ).length )
+
+        # A revision on a wildcard, or a change that isn't submitted yet,
+        # can still give different results later
+        2.times { p4.run_files( 'test_files/...#1' ) }
+        2.times { p4.run_files( 'test_files/foo.txt@999999' ) }
+        assert_equal( 2, p4.query_cache_stats[ 'stores' ] )
+        p4.query_cache = nil
+        assert_nil( p4.query_cache )
+      end
+
+      # Printed content is kept in the print store by digest, so the
+      # branches are served without printing them at all
+      Dir.mktmpdir( 'p4ps' ) do
+        |dir|
+        p4.print_store = dir
+        assert_equal( dir, p4.print_store )
+        live = p4.run_print( 'test_files/...' )
+        first = p4.print_cached( 'test_files/...' )
+        assert_equal( first, p4.print_cached( 'test_files/...' ) )
+        assert_equal( 6, first.length )
+        assert_equal( live[ 0 ][ 'depotFile' ], first[ 0 ][ 'depotFile' ] )
+        assert_equal( live[ 0 ][ 'rev' ], first[ 0 ][ 'rev' ] )
+        assert_equal( "This is a test file\n", first[ 1 ] )
+        branch = p4.print_cached( 'test_branch/...' )
+        assert_equal( 6, branch.length )
+        assert_equal( '//depot/test_branch/bar.txt', branch[ 0 ][ 'depotFile' ] )
+        assert_equal( [], p4.print_cached( 'test_files/foo.txt#3' ) )
+        stats = p4.print_store_stats
+        assert_equal( 3, stats[ 'misses' ] )
+        assert_equal( 6, stats[ 'hits' ] )
+        assert_equal( 1, Dir.glob( File.join( dir, '*', '*' ) ).length )
+
+        # Expanded keywords never come from an entry stored by digest
+        Dir.mkdir( "test_ktext" )
+        %w{ plain.txt k.txt }.each do
+          |fn|
+          File.open( "test_ktext/#{fn}", "w" ) { |f| f.puts( "$Change$" ) }
+        end
+        p4.run_add( 'test_ktext/plain.txt' )
+        p4.run_add( '-t', 'text+k', 'test_ktext/k.txt' )
+        change = p4.fetch_change
+        change._description = "Add keyword files"
+        r = p4.run_submit( change, fields: %w{ submittedChange } )
+        assert_equal( [ 'submittedChange' ], r[ -1 ].keys )
+        assert_equal( "$Change$\n", p4.print_cached( 'test_ktext/plain.txt' )[ 1 ] )
+        live = p4.run_print( 'test_ktext/k.txt' )
+        assert_equal( live[ 1 ], p4.print_cached( 'test_ktext/k.txt' )[ 1 ] )
+        assert_equal( live[ 1 ], p4.print_cached( 'test_ktext/k.txt' )[ 1 ] )
+        assert_not_equal( "$Change$\n", live[ 1 ] )
+        p4.print_store = nil
+        assert_raise( P4Exception ) { p4.print_cached( 'test_files/...' ) }
+      end
+
+      # The change feed pages through the four changes to test_files and
+      # keeps its watermark in the state file
+      Dir.mktmpdir( 'p4cf' ) do
+        |dir|
+        state = File.join( dir, 'feed.state' )
+        feed = P4::ChangeFeed.new( p4, '//depot/test_files/...', state: state,
+                                   from: 0, page_size: 2, describe: true )
+        seen = []
+        feed.subscribe { |c, f| seen << c[ 'change' ].to_i }
+        queue = feed.subscribe
+        assert_equal( 4, feed.poll.length )
+        assert_equal( seen.sort, seen )
+        assert_equal( 4, queue.size )
+        assert( queue.pop[ 0 ].has_key?( 'depotFile' ) )
+        assert_equal( [], feed.poll )
+        again = P4::ChangeFeed.new( p4, '//depot/test_files/...', state: state )
+        assert_equal( seen.last, again.watermark )
+      end
     ensure
       p4.disconnect
     end
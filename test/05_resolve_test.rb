@@ -337,6 +337,75 @@ class TC_Resolve < Test::Unit::TestCase
     end
   end
 
+  def test_resolve_with
+    puts "05 - Rule based resolve test"
+    assert(p4, "Failed to create Perforce client")
+
+    begin
+      test_dir = "test_resolve_with"
+      Dir.mkdir(test_dir)
+      names = %w( a.txt b.txt c.dat )
+      files = names.collect { |n| File.join(test_dir, n) }
+
+      assert(p4.connect, "Failed to connect to Perforce server")
+      assert(create_client, "Failed to create test workspace")
+      client = p4.client
+
+      files.each { |f| File.open(f, 'w') { |fd| fd.puts("First Line!") } }
+      p4.run_add(files)
+      assert_submit("Failed to add files", "-dFirst")
+
+      p4.run_edit(files)
+      files.each { |f| File.open(f, 'a') { |fd| fd.puts("Second Line.") } }
+      assert_submit("Failed to edit files", "-dSecond")
+
+      p4.run_sync(test_dir + "/...#1")
+      p4.run_edit(files)
+      p4.run_sync(test_dir + "/...")
+      assert_equal(3, p4.run_resolve("-n").length, "Unexpected number of resolves scheduled")
+
+      # Later rules win; files not covered go to the block
+      seen = []
+      p4.run_resolve_with([["//#{client}/#{test_dir}/a*", "ay"],
+                           ["//#{client}/#{test_dir}/*.txt", :theirs]]) do |md|
+        seen << md.your_name
+        "s"
+      end
+      assert_equal(["//#{client}/#{test_dir}/c.dat"], seen, "Unexpected files yielded")
+      assert_equal(0, p4.run_resolve("-n").length, "Unexpected number of resolves scheduled")
+      assert_equal("First Line!\nSecond Line.\n", File.read(files[0]), "Rule did not accept theirs")
+
+      # Without a block, uncovered files are skipped
+      p4.run_revert(files)
+      p4.run_sync(test_dir + "/...#1")
+      p4.run_edit(files)
+      p4.run_sync(test_dir + "/...")
+      p4.run_resolve_with("....dat" => "at")
+      assert_equal(2, p4.run_resolve("-n").length, "Unexpected number of resolves scheduled")
+
+      # The rules only last for the one resolve
+      p4.run_resolve do |md|
+        "ay"
+      end
+      assert_equal(0, p4.run_resolve("-n").length, "Unexpected number of resolves scheduled")
+
+      assert_raise(ArgumentError) do
+        p4.run_resolve_with("//..." => "bogus")
+      end
+
+      # Setting rules on a fresh connection doesn't run anything
+      p4.disconnect
+      assert(p4.connect, "Failed to reconnect to Perforce server")
+      P4.reset_metrics
+      p4.resolve_rules = { "//..." => "ay" }
+      assert_equal(0, P4.metrics['commands'].length, "Setting rules ran a command")
+      p4.resolve_rules = nil
+    ensure
+      p4.run_revert('//...') unless (p4.run_opened.empty?)
+      p4.disconnect
+    end
+  end
+
   #
   # Local method to help ensure submits are working
   #
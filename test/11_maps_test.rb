@@ -88,5 +88,20 @@ class TC_Maps < Test::Unit::TestCase
     p = space_map.translate( "//depot/space dir3/foo" )
     assert_equal( p, "//ws/space 3/foo" )
 
+    # Maps report the native memory they hold
+    require 'objspace'
+    big_map = P4::Map.new( ( 1..1000 ).map { |i| "//depot/#{i}/... //ws/#{i}/..." } )
+    assert( ObjectSpace.memsize_of( big_map ) > ObjectSpace.memsize_of( space_map ) )
+    assert( ObjectSpace.memsize_of( big_map ) > 1000 * 30 )
+
+    # Maps and spec parsing work in a Ractor of their own
+    Warning[ :experimental ] = false
+    r = Ractor.new do
+      map = P4::Map.new( [ "//depot/main/... //ws/main/..." ] )
+      branch = P4.new.parse_branch( "Branch: b\n\nView:\n\t//a/... //b/...\n" )
+      [ map.translate( "//depot/main/foo" ), branch[ 'Branch' ], branch[ 'View' ] ]
+    end
+    assert_equal( [ "//ws/main/foo", "b", [ "//a/... //b/..." ] ],
+                  r.respond_to?( :value ) ? r.value : r.take )
   end
 end
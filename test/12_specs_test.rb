@@ -263,6 +263,30 @@ Description:
       assert_not_nil( client['ServerID'], "Key 'ServerID' missing from client P4::Spec")
       assert_not_nil( client['View'], "Key 'View' missing from client P4::Spec")
 
+      # List fields survive a round trip line for line
+      view = Array.new( 1000 ) { |i| "//depot/d#{i}/... //#{client['Client']}/d#{i}/..." }
+      client['View'] = view
+      client = p4.parse_client( p4.format_client( client ) )
+      assert_equal( view, client['View'], "View changed in format/parse round trip" )
+
+      # Bulk parsing and formatting matches the one at a time versions
+      clients = Array.new( 200 ) do |i|
+        c = client.dup
+        c['Client'] = "bulk#{i}"
+        c['View'] = view.first( i % 10 + 1 )
+        c
+      end
+      forms = p4.format_specs( 'client', clients )
+      assert_equal( clients.collect { |c| p4.format_client( c ) }, forms,
+                    "format_specs differs from format_client" )
+      parsed = p4.parse_specs( 'client', forms )
+      assert_equal( 200, parsed.length, "Unexpected number of parsed specs" )
+      assert_kind_of( P4::Spec, parsed[ 0 ], "Parsed spec is not a P4::Spec" )
+      assert_equal( forms.collect { |f| p4.parse_client( f ) }, parsed,
+                    "parse_specs differs from parse_client" )
+      assert_equal( [], p4.parse_specs( 'client', [] ) )
+      assert_raise( P4Exception ) { p4.parse_specs( 'nosuchspec', forms ) }
+
       #	Depot
       assert( depot = p4.parse_depot( DEPOTSPEC ), "Failed to format depot spec" )
       assert_kind_of( P4::Spec, depot, "Depot spec is not a P4::Spec" )
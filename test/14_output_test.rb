@@ -98,6 +98,98 @@ class TC_Output < Test::Unit::TestCase
       assert_not_equal(dict['fmt0'], nil, "No message format present")
       assert_not_equal(dict['code0'], nil, "No message code present")
       assert_not_equal(dict['func'], nil, "No message func present")
+
+      # Untagged info messages land in the output in arrival order, as
+      # strings in a plain array
+      p4.run_sync( '//...#none' )
+      out = p4.run_sync( '//depot/...' )
+      assert_instance_of( Array, out )
+      assert_equal( 3, out.length )
+      assert( out.all? { |o| o.kind_of?( String ) } )
+      assert_equal( p4.messages.map { |m| m.to_s }, out )
+      p4.tagged = true
+
+      # Suppressed messages never reach the results at all
+      p4.suppressed_messages = [ 6532 ]
+      assert_equal( [ 6532 ], p4.suppressed_messages )
+      p4.exception_level = P4::RAISE_ALL
+      assert_equal( [], p4.run_sync )
+      assert( p4.warnings.empty?, "Suppressed warning was reported" )
+      assert( p4.messages.empty?, "Suppressed message was reported" )
+      p4.suppressed_messages = nil
+      assert_equal( [], p4.suppressed_messages )
+
+      # In reuse mode each run refills the same output array, so results
+      # are only valid until the next run unless they're copied or
+      # frozen. Empty results are one shared frozen array.
+      p4.reuse_results = true
+      assert( p4.reuse_results? )
+      foo = p4.run_files( '//depot/foo' )
+      assert_equal( 1, foo.length )
+      assert_equal( '//depot/foo', foo[ 0 ][ 'depotFile' ] )
+      kept = foo.dup
+      bar = p4.run_files( '//depot/bar' )
+      assert_same( foo, bar )
+      assert_equal( 1, bar.length )
+      assert_equal( '//depot/bar', bar[ 0 ][ 'depotFile' ] )
+      assert_equal( '//depot/foo', kept[ 0 ][ 'depotFile' ] )
+      frozen = p4.run_files( '//depot/foo' ).freeze
+      assert_not_same( frozen, p4.run_files( '//depot/bar' ) )
+      assert_equal( '//depot/foo', frozen[ 0 ][ 'depotFile' ] )
+      count = 0
+      p4.each_clients { |c| count += 1 }
+      assert( count > 0, "each_clients lost its list in reuse mode" )
+      assert_kind_of( P4::Spec, p4.fetch_client )
+      assert( p4.errors.frozen? )
+      assert_same( p4.errors, p4.warnings )
+      p4.suppressed_messages = [ 6532 ]
+      assert( p4.run_sync.frozen? )
+      p4.suppressed_messages = nil
+      p4.reuse_results = false
+      assert_not_same( p4.run_files( '//depot/foo' ), p4.run_files( '//depot/foo' ) )
+
+      # The results a P4 object holds survive the GC moving them, and
+      # its native memory is reported
+      p4.run_files( '//depot/...' )
+      p4.messages
+      begin
+        GC.compact
+      rescue NotImplementedError
+      end
+      assert_equal( 3, p4.run_files( '//depot/...' ).length )
+      assert_equal( [], p4.messages )
+      require 'objspace'
+      assert( ObjectSpace.memsize_of( p4 ) > 0 )
+
+      # Every run records where its time went
+      files = p4.run_files( '//depot/...' )
+      stats = p4.last_command_stats
+      assert_equal( files.length, stats[ 'records' ] )
+      assert_equal( files.length, stats[ 'peak_results' ] )
+      assert_equal( 0, stats[ 'messages' ] )
+      assert( stats[ 'bytes_received' ] > 0 )
+      assert( stats[ 'bytes_sent' ] > 0 )
+      assert( stats[ 'wall' ] >= stats[ 'callback' ] )
+      assert( stats[ 'callback' ] >= stats[ 'conversion' ] )
+      assert_in_delta( stats[ 'wall' ], stats[ 'api' ] + stats[ 'callback' ], 1e-6 )
+
+      # Captured output replays to the same results without a server
+      require 'tmpdir'
+      Dir.mktmpdir( 'p4cap' ) do
+        |dir|
+        path = File.join( dir, 'files.p4cap' )
+        live = nil
+        p4.with_capture( path ) do
+          assert_equal( path, p4.capture )
+          live = p4.run_files( '//depot/...' )
+          p4.at_exception_level( P4::RAISE_NONE ) { p4.run_sync }
+        end
+        assert_nil( p4.capture )
+        offline = P4.new
+        assert_equal( [ live, [] ], offline.replay( path ) )
+        assert_equal( 1, offline.warnings.length )
+        assert( offline.warnings[ 0 ] =~ /up-to-date/ )
+      end
     ensure
       p4.disconnect
     end
@@ -62,6 +62,16 @@ class TC_Track < Test::Unit::TestCase
         end
       end
       assert( found, "Failed to report expected performance tracking output" )
+
+      # The same output, parsed
+      data = p4.track_data
+      assert_kind_of( Float, data[ 'lapse' ] )
+      assert_kind_of( Integer, data[ 'rpc' ][ 'msgs_in' ] )
+      assert_kind_of( Hash, data[ 'tables' ] )
+      data[ 'tables' ].each do
+        |name, table|
+        assert_kind_of( Hash, table, "No details for #{name}" )
+      end
     ensure
       p4.disconnect
     end
@@ -166,6 +166,17 @@ class TC_Progress < Test::Unit::TestCase
           p4.progress = SyncProgress.new
           p4.run_sync( "-f", "-q", "//..." )
           assert_equal( p4.handler.totalFiles, p4.progress.position, "Total does not match position." )
+
+          # Coalesced updates must still finish on the final position,
+          # and the native totals see every update regardless.
+          p4.progress = SyncProgress.new
+          p4.progress_step = 100
+          p4.run_sync( "-f", "-q", "//..." )
+          assert_equal( p4.handler.totalFiles, p4.progress.position, "Coalesced total does not match position." )
+          totals = p4.progress_totals
+          assert( totals[ "callbacks" ] <= totals[ "updates" ], "More callbacks than updates" )
+          assert( totals[ "elapsed" ] >= 0.0 )
+          p4.progress_step = 0
         end
       end
     ensure
@@ -42,4 +42,26 @@ class TC_IgnoreFile < Test::Unit::TestCase
     assert( ! p4.ignored?( 'foo' ) )
   end
 
+  def test_ignore_batch
+    assert( p4, "Failed to create Perforce client" )
+    p4.ignore_file = '.p4ignore'
+    File.open( File.join( client_root, '.p4ignore' ), 'w' ) { |f| f.puts( '*.o' ) }
+
+    paths = %w( a.c a.o b.c b.o ).map { |f| File.join( client_root, f ) }
+    assert_equal( paths.values_at( 1, 3 ), p4.ignored_paths( paths ) )
+    assert_equal( paths.values_at( 0, 2 ), p4.filter_ignored( paths ) )
+    assert_equal( paths.map { |f| p4.ignored?( f ) },
+                  paths.map { |f| p4.ignored_paths( [ f ] ).length == 1 } )
+
+    # Rules are recompiled when the ignore file changes
+    ignore = File.join( client_root, '.p4ignore' )
+    later = File.mtime( ignore ) + 10
+    File.open( ignore, 'w' ) { |f| f.puts( '*.c' ) }
+    File.utime( later, later, ignore )
+    assert_equal( paths.values_at( 0, 2 ), p4.ignored_paths( paths ) )
+
+    assert_equal( [], p4.ignored_paths( [] ) )
+    assert_raise( TypeError ) { p4.filter_ignored( 'a.o' ) }
+  end
+
 end
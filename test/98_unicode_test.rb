@@ -88,6 +88,57 @@ class TC_Unicode < Test::Unit::TestCase
           (RUBY_VERSION.split('.')[0].to_i == 1 and RUBY_VERSION.split('.')[1].to_i > 8)
         buf.force_encoding( "UTF-8" )
         assert( buf == 'This file cost £1', "Unicode support broken" )
+
+        # Strings from the server are created as UTF-8
+        f = p4.run_fstat( tf ).shift
+        assert_equal( Encoding::UTF_8, f['depotFile'].encoding,
+                      "Tagged output not in UTF-8" )
+        assert_equal( Encoding::UTF_8, p4.client.encoding,
+                      "Client name not in UTF-8" )
+
+        # Raw bytes mode leaves the output alone
+        p4.with_raw_bytes do
+          f = p4.run_fstat( tf ).shift
+          assert_equal( Encoding::ASCII_8BIT, f['depotFile'].encoding,
+                        "Raw output not in ASCII-8BIT" )
+          text = p4.run_print( tf ).last
+          assert_equal( "This file cost \xC2\xA31\n".b, text,
+                        "Raw print output changed" )
+        end
+        assert( !p4.raw_bytes?, "Raw bytes mode not restored" )
+
+        # Raw bytes mode belongs to its connection. Commands on a raw
+        # and a translating connection that interleave, by switching
+        # threads from their handlers, each keep their own encoding.
+        raw = P4.new
+        raw.port = p4.port
+        raw.user = p4.user
+        raw.client = p4.client
+        raw.charset = "utf8"
+        raw.raw_bytes = true
+        raw.connect
+        begin
+          yielder = Class.new( P4::OutputHandler ) do
+            def outputStat( stat )
+              Thread.pass
+              P4::REPORT
+            end
+          end
+          p4.handler = yielder.new
+          raw.handler = yielder.new
+          seen = [ p4, raw ].map do |c|
+            Thread.new do
+              10.times.map { c.run_fstat( tf ).shift['depotFile'].encoding }
+            end
+          end.map( &:value )
+          assert_equal( [ Encoding::UTF_8 ], seen[ 0 ].uniq,
+                        "Raw mode leaked into another connection" )
+          assert_equal( [ Encoding::ASCII_8BIT ], seen[ 1 ].uniq,
+                        "Raw mode lost while another connection ran" )
+        ensure
+          p4.handler = nil
+          raw.disconnect
+        end
       else
         assert( buf == "This file cost \xC2\xA31", "Unicode support broken" )
       end